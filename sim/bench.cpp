@@ -0,0 +1,451 @@
+// Host benchmarks of single parts of the sketch, run by "xplorasim --bench NAME". They call
+// straight into a loaded copy of the node library, so they measure the code the boards run
+// (though at the speed of the host, not of an ESP32).
+
+#include "hal/Arduino.h"
+#include "simnode.h"
+
+#include <dlfcn.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double now()
+{
+  struct timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static void *sym(void *lib, const char *name)
+{
+  void *p = dlsym(lib, name);
+  if (!p) {
+    fprintf(stderr, "node library lacks %s\n", name);
+    exit(1);
+  }
+  return p;
+}
+
+static std::vector<std::string> readLines(const std::string &path)
+{
+  std::vector<std::string> lines;
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f) {
+    perror(path.c_str());
+    exit(1);
+  }
+  char buf[1024];
+  while (fgets(buf, sizeof(buf), f)) {
+    size_t n = strcspn(buf, "\r\n");
+    buf[n] = 0;
+    if (n) lines.push_back(buf);
+  }
+  fclose(f);
+  return lines;
+}
+
+// chat text compression (myZipEncode/myZipDecode): ratio, speed, and what it saves on air
+static int benchZip(void *lib, const std::string &corpus)
+{
+  typedef int (*ZipFn)(const uint8_t *, int, uint8_t *, int);
+  ZipFn enc = (ZipFn)sym(lib, "_Z11myZipEncodePKhiPhi");
+  ZipFn dec = (ZipFn)sym(lib, "_Z11myZipDecodePKhiPhi");
+  std::vector<std::string> lines = readLines(corpus);
+  std::vector<std::vector<uint8_t> > packed;
+  uint8_t out[255], back[255];
+  long raw = 0, sent = 0, shrunk = 0, bad = 0;
+
+  for (const std::string &l : lines) {
+    const uint8_t *p = (const uint8_t *)l.data();
+    int n = (int)l.size();
+    int z = enc(p, n, out, sizeof(out));
+    int u = z > 0 ? dec(out, z, back, sizeof(back)) : -1;
+    if (z > 0 && (u != n || memcmp(back, p, n) != 0)) bad++;
+    raw += n;
+    if (z > 0 && z < n) { // what myLoraSend() would do
+      sent += z;
+      shrunk++;
+    } else {
+      sent += n;
+    }
+    packed.push_back(std::vector<uint8_t>(out, out + (z > 0 ? z : 0)));
+  }
+
+  // speed: repeat the whole corpus for about half a second each way
+  long reps = 0, bytes = 0;
+  double t0 = now(), t1;
+  do {
+    for (const std::string &l : lines) bytes += enc((const uint8_t *)l.data(), (int)l.size(), out, sizeof(out)) >= 0 ? l.size() : 0;
+    reps++;
+  } while ((t1 = now()) - t0 < 0.5);
+  double encMBs = bytes / (t1 - t0) / 1e6, encUs = (t1 - t0) * 1e6 / (reps * lines.size());
+  reps = 0;
+  bytes = 0;
+  t0 = now();
+  do {
+    for (const std::vector<uint8_t> &z : packed) bytes += std::max(dec(z.data(), (int)z.size(), back, sizeof(back)), 0);
+    reps++;
+  } while ((t1 = now()) - t0 < 0.5);
+  double decMBs = bytes / (t1 - t0) / 1e6, decUs = (t1 - t0) * 1e6 / (reps * lines.size());
+
+  printf("chat text compression, %zu lines from %s\n", lines.size(), corpus.c_str());
+  printf("ratio           %ld -> %ld bytes (%.1f%%), %ld lines got shorter, %ld round trip errors\n", raw, sent,
+         100.0 * sent / raw, shrunk, bad);
+  printf("host speed      encode %.1f MB/s (%.2f us per line), decode %.1f MB/s (%.2f us per line)\n", encMBs, encUs,
+         decMBs, decUs);
+
+  // airtime per message, 125 kHz, 4/5, 8 symbol preamble, explicit header, no CRC (the defaults)
+  const int header = 9 + 3; // version 1 frame header plus a three letter name
+  printf("airtime         per message, mean over the corpus\n");
+  for (int sf = 7; sf <= 12; sf++) {
+    double a = 0, b = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+      int n = (int)lines[i].size(), z = (int)packed[i].size();
+      a += radioTimeOnAir(sf, 125000, 5, 8, false, false, header + n);
+      b += radioTimeOnAir(sf, 125000, 5, 8, false, false, header + (z > 0 && z < n ? z : n));
+    }
+    a /= lines.size();
+    b /= lines.size();
+    printf("  SF%-2d          %7.1f ms -> %7.1f ms, saves %6.1f ms (%.0f%%)\n", sf, a * 1e3, b * 1e3, (a - b) * 1e3,
+           100.0 * (a - b) / a);
+  }
+  return bad ? 1 : 0;
+}
+
+// the queues between the two cores (mySendPost/mySendRun and myUiPost/myUiRun) on two real
+// threads: every message the UI side posts must come back as a chat line, in order. Build with
+// "make tsan" to have ThreadSanitizer watch the handover.
+static int benchCores(void *lib)
+{
+  typedef int (*PostFn)(int, int, uint16_t, const String &);
+  typedef void (*RunFn)();
+  PostFn post = (PostFn)sym(lib, "_Z10mySendPostiitRK6String");
+  RunFn sendRun = (RunFn)sym(lib, "_Z9mySendRunv");
+  RunFn uiRun = (RunFn)sym(lib, "_Z7myUiRunv");
+  typedef const char *(*GetFn)(int);
+  GetFn chatGet = (GetFn)sym(lib, "_Z9myChatGeti");
+  unsigned long *chatLines = (unsigned long *)sym(lib, "chat_lines");
+  unsigned long *uiOverflows = (unsigned long *)sym(lib, "ui_q_overflows");
+  unsigned int *txHead = (unsigned int *)sym(lib, "tx_q_head");
+  unsigned int *txTail = (unsigned int *)sym(lib, "tx_q_tail");
+  const int count = 200000;
+  std::atomic<int> done(0);
+
+  static SimNode node; // millis() reads the clock of the current node
+  simCurrent = simTask = &node;
+  *(int *)sym(lib, "tx_busy") = 1; // so myTxRun() leaves the radio alone
+  *(unsigned long *)sym(lib, "tx_toa") = ~0UL / 2;
+
+  unsigned long *uiLines = (unsigned long *)sym(lib, "ui_q_lines");
+  int retries = 0, seen = 0, bad = 0, last = -1;
+  unsigned long lines = 0;
+  double t0 = now();
+  std::thread radio([&] { // only reads what the radio task itself writes
+    while (*uiLines + *uiOverflows < (unsigned long)count) {
+      sendRun();
+      txTail[0] = txHead[0]; // (tx_prio_own) nothing goes on air
+      std::this_thread::yield();
+    }
+    done.store(1);
+  });
+  for (int i = 0, end = 0; !end;) {
+    end = done.load();
+    if (i < count) {
+      if (post(0, 0, 0, String("m") + String(i))) i++;
+      else {
+        retries++;
+        std::this_thread::yield(); // (a single CPU host has to switch threads)
+      }
+    }
+    uiRun();
+    for (; lines < *chatLines; lines++) {
+      int k = atoi(strchr(chatGet(*chatLines - lines - 1), '>') + 2); // "<name>>m<k>"
+      if (k <= last) bad++;
+      last = k;
+      seen++;
+    }
+  }
+  radio.join();
+  double t = now() - t0;
+
+  printf("core handover, %d messages UI -> radio -> chat\n", count);
+  printf("delivered       %d in order, %d out of order, %lu dropped (chat queue full), %d posts retried (send queue full)\n",
+         seen - bad, bad, *uiOverflows, retries);
+  printf("host speed      %.2f us per message round trip\n", t * 1e6 / count);
+  return bad ? 1 : 0;
+}
+
+// the chat store on core 1 (myUiRun() taking the lines myChatAdd() posted): time and String
+// allocations per line, and how many lines it keeps, fed the corpus over and over. Run it with
+// --lib on an older build to compare.
+static int benchChat(void *lib, const std::string &corpus)
+{
+  typedef unsigned long (*AddFn)(String);
+  typedef void (*RunFn)();
+  AddFn add = (AddFn)sym(lib, "_Z9myChatAdd6String");
+  RunFn uiRun = (RunFn)sym(lib, "_Z7myUiRunv");
+  int *kept = (int *)dlsym(lib, "chat_kept"); // (builds before the chat store kept 100 Strings)
+  std::vector<std::string> lines = readLines(corpus);
+  const int count = 100000;
+  const int batch = 8; // ui_qsize
+  unsigned long allocs = 0;
+  double t = 0;
+
+  static SimNode node; // millis() reads the clock of the current node
+  simCurrent = simTask = &node;
+  for (int i = 0; i < count; i += batch) {
+    for (int j = i; j < i + batch; j++) add(String(lines[j % lines.size()].c_str()));
+    unsigned long a0 = simStringAllocs;
+    double t0 = now();
+    uiRun();
+    t += now() - t0;
+    allocs += simStringAllocs - a0;
+  }
+
+  printf("chat store, %d lines from %s\n", count, corpus.c_str());
+  printf("per line        %.3f us, %.2f String allocations\n", t * 1e6 / count, (double)allocs / count);
+  printf("kept            the last %d lines\n", kept ? *kept : 100);
+  return 0;
+}
+
+// the chat log in flash (hal/esp_partition.h, a temporary file): appending, scrolling back through
+// all of it, the wear, then power losses at random points while appending, each followed by a
+// boot (myLogInit()) that must find every line written before the loss.
+static int benchLog(void *lib, const std::string &corpus)
+{
+  typedef void (*InitFn)();
+  typedef int (*AppendFn)(const char *, uint16_t, int, int, uint16_t);
+  typedef const char *(*GetFn)(unsigned long);
+  typedef unsigned long (*OldestFn)();
+  InitFn init = (InitFn)sym(lib, "_Z9myLogInitv");
+  AppendFn append = (AppendFn)sym(lib, "_Z11myLogAppendPKctiit");
+  GetFn get = (GetFn)sym(lib, "_Z8myLogGetm");
+  OldestFn oldest = (OldestFn)sym(lib, "_Z11myLogOldestv");
+  unsigned long *chatLines = (unsigned long *)sym(lib, "chat_lines");
+  unsigned long *pageins = (unsigned long *)sym(lib, "log_pageins");
+  unsigned long *torn = (unsigned long *)sym(lib, "log_torn");
+  uint16_t *erases = (uint16_t *)sym(lib, "log_erases");
+  const int sectors = 64; // log_sectors
+  std::vector<std::string> lines = readLines(corpus);
+  std::vector<std::string> logged(1); // by line number
+  const int count = 20000;
+
+  static SimNode node; // its flash, see hal.cpp
+  simCurrent = simTask = &node;
+  init();
+  auto add = [&]() {
+    std::string l = lines[logged.size() % lines.size()] + " #" + std::to_string(logged.size());
+    append(l.c_str(), 0x1234, -90, 1, (uint16_t)logged.size());
+    logged.push_back(l);
+  };
+
+  double t0 = now(), flash0 = node.stats.flashTime;
+  for (int i = 0; i < count; i++) add();
+  double appendUs = (now() - t0) * 1e6 / count, appendFlash = (node.stats.flashTime - flash0) * 1e3 / count;
+  unsigned long first = oldest(), last = logged.size() - 1, bad = 0, p0 = *pageins;
+  t0 = now();
+  flash0 = node.stats.flashTime;
+  for (unsigned long k = last; k >= first; k--) bad += logged[k] != get(k);
+  double getUs = (now() - t0) * 1e6 / (last - first + 1), getFlash = (node.stats.flashTime - flash0) * 1e3 / (last - first + 1);
+  int emin = 65535, emax = 0;
+  for (int s = 0; s < sectors; s++) {
+    emin = std::min(emin, (int)erases[s]);
+    emax = std::max(emax, (int)erases[s]);
+  }
+
+  printf("chat log, %d lines from %s, %d sectors of 4 KB\n", count, corpus.c_str(), sectors);
+  printf("append          %.2f us per line on the host, %.2f ms flash time per line (modelled)\n", appendUs, appendFlash);
+  printf("scroll back     %lu lines kept, %.2f us per line on the host, %.3f ms flash time per line, %lu pages read, %lu wrong\n",
+         last - first + 1, getUs, getFlash, *pageins - p0, bad);
+  printf("wear            %d to %d erases per sector\n", emin, emax);
+
+  // power losses
+  const int trials = 300;
+  uint64_t rng = 1;
+  unsigned long lost = 0, wrong = 0, boots = 0;
+  double bootMs = 0;
+  for (int i = 0; i < trials; i++) {
+    node.flash.cut = 1 + simRand32(rng) % 8192;
+    unsigned long done = logged.size() - 1;
+    while (!node.flash.dead) {
+      add();
+      if (!node.flash.dead) done = logged.size() - 1; // written before the power went
+    }
+    node.flash.dead = false;
+    node.flash.cut = -1;
+    flash0 = node.stats.flashTime;
+    init(); // boot
+    bootMs += (node.stats.flashTime - flash0) * 1e3;
+    boots++;
+    unsigned long got = *chatLines;
+    if (got < done) lost += done - got;
+    if (got > done + 1 || got < done) wrong++;
+    logged.resize(got + 1); // numbering goes on after the last line found
+    for (unsigned long k = oldest(); k <= got; k++) wrong += logged[k] != get(k);
+  }
+  printf("power losses    %d at random points while appending: %lu lines lost that were written, %lu wrong, %lu records\n"
+         "                found cut short, boot %.0f ms flash time (modelled)\n",
+         trials, lost, wrong, *torn, bootMs / boots);
+  return bad || lost || wrong ? 1 : 0;
+}
+
+// a display for the screen benchmarks: the library's init(), and a flush task that never runs, so
+// myOledSend() leaves every frame in oled_tx and no bus time is in them
+static void benchDisplay(void *lib, SimNode *node, SimNode *flush)
+{
+  typedef bool (*DisplayFn)(void *);
+  DisplayFn displayInit = (DisplayFn)sym(lib, "_ZN11OLEDDisplay4initEv");
+  simCurrent = simTask = node;
+  displayInit(sym(lib, "display"));
+  *(void **)sym(lib, "oled_task") = flush;
+  *(long *)sym(lib, "screensaverT") = 1L << 40;
+}
+
+// the chat screen (myLoraChat()) drawing its lines with drawString() every frame, and blitting
+// their cached strips (chat_strips=1): time per frame, and whether both frames are the same. Lines
+// come in, the mouse moves from line to line (so long ones scroll sideways), and now and then the
+// view jumps back into the chat log.
+static int benchStrips(void *lib, const std::string &corpus)
+{
+  typedef unsigned long (*AddFn)(String);
+  typedef void (*RunFn)();
+  AddFn add = (AddFn)sym(lib, "_Z9myChatAdd6String");
+  RunFn uiRun = (RunFn)sym(lib, "_Z7myUiRunv");
+  RunFn logInit = (RunFn)sym(lib, "_Z9myLogInitv");
+  RunFn chat = (RunFn)sym(lib, "_Z10myLoraChatv");
+  int *strips = (int *)sym(lib, "chat_strips");
+  int *chatxo = (int *)sym(lib, "chatxo");
+  int *scroll = (int *)sym(lib, "chat_scroll");
+  uint8_t *tx = (uint8_t *)sym(lib, "oled_tx");
+  unsigned int *txFull = (unsigned int *)sym(lib, "oled_tx_full");
+  unsigned long *hits = (unsigned long *)sym(lib, "strip_hits");
+  unsigned long *makes = (unsigned long *)sym(lib, "strip_makes");
+  unsigned long *drops = (unsigned long *)sym(lib, "strip_drops");
+  std::vector<std::string> lines = readLines(corpus);
+  const int frames = 20000;
+
+  static SimNode node, flush;
+  benchDisplay(lib, &node, &flush);
+  logInit();
+  *(int *)sym(lib, "chat_scrollmode") = 1;
+  *(int *)sym(lib, "realmousex") = 64;
+  int *mousey = (int *)sym(lib, "realmousey");
+  unsigned long n = 0, wrong = 0;
+  auto line = [&]() {
+    std::string l = "st" + std::to_string(n % 7) + ": " + lines[n % lines.size()];
+    if (n % 5 == 0) l += " " + lines[(n * 7 + 3) % lines.size()]; // wider than the screen
+    add(String(l.c_str()));
+    n++;
+  };
+  for (int i = 0; i < 300; i++) line();
+  uiRun();
+
+  uint64_t rng = 1;
+  double t[2] = {0, 0}, flash[2] = {0, 0};
+  uint8_t frame[2][1024];
+  for (int f = 0; f < frames; f++) {
+    if (f % 25 == 0) {
+      line();
+      uiRun();
+    }
+    if (f % 150 == 0) *mousey = 9 + simRand32(rng) % 4 * 9; // lines 1 to 4, they don't scroll the view
+    if (f % 1000 == 0) *scroll = f % 3000 == 0 ? 0 : simRand32(rng) % 250;
+    int xo = *chatxo;
+    for (int k = 0; k < 2; k++) {
+      int m = (f + k) & 1; // each goes first every other frame
+      *strips = m;
+      *chatxo = xo;
+      *txFull = 0;
+      double t0 = now(), flash0 = node.stats.flashTime;
+      chat();
+      t[m] += now() - t0;
+      flash[m] += node.stats.flashTime - flash0;
+      memcpy(frame[m], tx, sizeof(frame[m]));
+    }
+    wrong += memcmp(frame[0], frame[1], sizeof(frame[0])) != 0;
+    simNow += 33000;
+  }
+
+  printf("chat screen, %d frames, lines from %s\n", frames, corpus.c_str());
+  printf("drawString()    %.2f us per frame on the host, %.3f ms flash time per frame (modelled)\n", t[0] * 1e6 / frames,
+         flash[0] * 1e3 / frames);
+  printf("strips          %.2f us per frame on the host, %.3f ms flash time per frame (modelled)\n", t[1] * 1e6 / frames,
+         flash[1] * 1e3 / frames);
+  printf("                %lu lines drawn from their strip, %lu rasterized, %lu strips dropped for room\n", *hits, *makes,
+         *drops);
+  printf("frames          %lu of %d not the same\n", wrong, frames);
+  return wrong ? 1 : 0;
+}
+
+// the keyboard screen (myKeybTextInput()) drawing its keys one by one (keyb_layers=0), and copying
+// the layer drawn at boot: time and String allocations per frame, and whether both frames are the
+// same. The mouse moves over the keys and the buttons, the shift state and the typed line change.
+static int benchKeyb(void *lib, const std::string &corpus)
+{
+  typedef void (*RunFn)();
+  RunFn keybInit = (RunFn)sym(lib, "_Z10myKeybInitv");
+  RunFn keyb = (RunFn)sym(lib, "_Z15myKeybTextInputv");
+  int *layers = (int *)sym(lib, "keyb_layers");
+  int *shift = (int *)sym(lib, "myShift");
+  int *mousex = (int *)sym(lib, "realmousex");
+  int *mousey = (int *)sym(lib, "realmousey");
+  String *input = (String *)sym(lib, "my_inp");
+  uint8_t *tx = (uint8_t *)sym(lib, "oled_tx");
+  unsigned int *txFull = (unsigned int *)sym(lib, "oled_tx_full");
+  std::vector<std::string> lines = readLines(corpus);
+  const int frames = 20000;
+
+  static SimNode node, flush;
+  benchDisplay(lib, &node, &flush);
+  keybInit();
+
+  uint64_t rng = 1;
+  double t[2] = {0, 0};
+  unsigned long allocs[2] = {0, 0}, wrong = 0;
+  uint8_t frame[2][1024];
+  for (int f = 0; f < frames; f++) {
+    if (f % 10 == 0) {
+      *mousex = simRand32(rng) % 128;
+      *mousey = simRand32(rng) % 64;
+    }
+    if (f % 500 == 0) *shift = simRand32(rng) % 4 * 3;
+    if (f % 200 == 0) *input = lines[simRand32(rng) % lines.size()].substr(0, simRand32(rng) % 40).c_str();
+    for (int k = 0; k < 2; k++) {
+      int m = (f + k) & 1; // each goes first every other frame
+      *layers = m;
+      *txFull = 0;
+      unsigned long a0 = simStringAllocs;
+      double t0 = now();
+      keyb();
+      t[m] += now() - t0;
+      allocs[m] += simStringAllocs - a0;
+      memcpy(frame[m], tx, sizeof(frame[m]));
+    }
+    wrong += memcmp(frame[0], frame[1], sizeof(frame[0])) != 0;
+    simNow += 10000;
+  }
+
+  printf("keyboard screen, %d frames\n", frames);
+  printf("keys one by one %.2f us per frame on the host, %.1f String allocations\n", t[0] * 1e6 / frames,
+         (double)allocs[0] / frames);
+  printf("layers          %.2f us per frame on the host, %.1f String allocations\n", t[1] * 1e6 / frames,
+         (double)allocs[1] / frames);
+  printf("frames          %lu of %d not the same\n", wrong, frames);
+  return wrong ? 1 : 0;
+}
+
+int simBench(const std::string &name, void *lib, const std::string &corpus)
+{
+  if (name == "zip") return benchZip(lib, corpus);
+  if (name == "cores") return benchCores(lib);
+  if (name == "chat") return benchChat(lib, corpus);
+  if (name == "log") return benchLog(lib, corpus);
+  if (name == "strips") return benchStrips(lib, corpus);
+  if (name == "keyb") return benchKeyb(lib, corpus);
+  fprintf(stderr, "unknown benchmark %s (there is: zip, cores, chat, log, strips, keyb)\n", name.c_str());
+  return 1;
+}
@@ -0,0 +1,458 @@
+// Arduino/ESP32 core stand-ins for the simulated nodes (see hal/Arduino.h).
+
+#include "hal/Arduino.h"
+#include "hal/SPI.h"
+#include "hal/Wire.h"
+#include "hal/esp_partition.h"
+#include "simnode.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+SPIClass SPI;
+TwoWire Wire(0);
+TwoWire Wire1(1);
+unsigned long simStringAllocs = 0;
+
+void simInjectDue(SimNode *n);
+
+unsigned long millis()
+{
+  return (unsigned long)((simNow - simCurrent->bootT) / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)(simNow - simCurrent->bootT);
+}
+
+void delay(unsigned long ms)
+{
+  simSleep((int64_t)ms * 1000);
+  simInjectDue(simCurrent);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  simSleep(us);
+}
+
+void yield()
+{
+}
+
+// ESP32 core: random() is esp_random() until randomSeed() was called with a
+// non zero seed, then it is the C library's rand(). Both are per node here.
+long random(long howbig)
+{
+  if (howbig <= 0) return 0;
+  return (long)(simRand32(simCurrent->rng) % (uint32_t)howbig);
+}
+
+long random(long howsmall, long howbig)
+{
+  if (howsmall >= howbig) return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+  if (seed != 0) simCurrent->rng = seed * 0x9E3779B97F4A7C15ull + simCurrent->id;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  (void)pin;
+  (void)val;
+}
+
+int digitalRead(uint8_t pin)
+{
+  (void)pin;
+  return LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+  (void)pin;
+  return 0;
+}
+
+// untouched pads: a base level around 60 with a little noise
+uint16_t touchRead(uint8_t pin)
+{
+  return (uint16_t)(56 + (pin & 7) + simRand32(simCurrent->rng) % 3);
+}
+
+// ------------------------------------------------------------------- Serial
+
+size_t Print::printf(const char *fmt, ...)
+{
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n < 0) return 0;
+  return write((const uint8_t *)buf, std::min(n, (int)sizeof(buf) - 1));
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  (void)baud;
+}
+
+int HardwareSerial::available()
+{
+  return (int)simCurrent->serialIn.size();
+}
+
+int HardwareSerial::read()
+{
+  std::string &in = simCurrent->serialIn;
+  if (in.empty()) return -1;
+  int c = (uint8_t)in[0];
+  in.erase(0, 1);
+  return c;
+}
+
+int HardwareSerial::peek()
+{
+  std::string &in = simCurrent->serialIn;
+  return in.empty() ? -1 : (uint8_t)in[0];
+}
+
+// The UART sends 11.52 bytes per ms at 115200 baud (10 bits a byte). Bytes it hasn't sent yet
+// wait in its 128 byte FIFO and the buffer setTxBufferSize() asked for, a write that doesn't fit
+// blocks until the UART has made room, like on the ESP32.
+static const double serialBytesPerUs = 115200 / 10 / 1e6;
+
+static void serialDrain(SimNode *n)
+{
+  n->serialTxPending = std::max(0.0, n->serialTxPending - (simNow - n->serialTxT) * serialBytesPerUs);
+  n->serialTxT = simNow;
+}
+
+size_t HardwareSerial::setTxBufferSize(size_t size)
+{
+  simCurrent->serialTxBuf = (int)size;
+  return size;
+}
+
+int HardwareSerial::availableForWrite()
+{
+  SimNode *n = simCurrent;
+  serialDrain(n);
+  return std::max(0, 128 + n->serialTxBuf - (int)ceil(n->serialTxPending));
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  SimNode *n = simCurrent;
+  serialDrain(n);
+  double over = n->serialTxPending + size - (128 + n->serialTxBuf);
+  if (over > 0) {
+    int64_t us = (int64_t)ceil(over / serialBytesPerUs);
+    n->stats.serialWait += us / 1e6;
+    if (simTask && simTask->stack) simSleep(us); // (see flashBusy())
+    serialDrain(n);
+  }
+  n->serialTxPending += size;
+  if (n->serialRaw) {
+    n->serialOut.append((const char *)buffer, size);
+    return size;
+  }
+  for (size_t i = 0; i < size; i++) {
+    char c = (char)buffer[i];
+    if (c == '\r') continue;
+    if (c == '\n') {
+      if (simVerbose) ::printf("%9.3f [%d] %s\n", simNow / 1e6, n->id, n->serialOut.c_str());
+      n->serialOut.clear();
+    } else {
+      n->serialOut += c;
+    }
+  }
+  return size;
+}
+
+// ---------------------------------------------------------------- FreeRTOS
+
+struct SimMutex {
+  bool taken = false;
+};
+
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void *), const char *name, uint32_t stack, void *arg, unsigned prio,
+                                   TaskHandle_t *handle, int core)
+{
+  (void)name;
+  (void)stack;
+  (void)prio;
+  (void)core;
+  SimNode *t = simTaskCreate(fn, arg);
+  if (handle) *handle = t;
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  simSleep((int64_t)ticks * 1000);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  SimNode *t = (SimNode *)task;
+  t->notified++;
+  simWakeAt(t, simNow);
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t wait)
+{
+  SimNode *t = simTask;
+  int64_t until = wait == portMAX_DELAY ? LLONG_MAX / 2 : simNow + (int64_t)wait * 1000;
+  while (t->notified == 0 && simNow < until) simWait(until - simNow);
+  uint32_t n = t->notified;
+  if (n) t->notified = clearCountOnExit ? 0 : n - 1;
+  return n;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return new SimMutex();
+}
+
+// the other task of the node holds it: it lets go at one of its sleeps, so look again every 100 us
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t wait)
+{
+  int64_t until = simNow + (int64_t)wait * 1000;
+  while (m->taken) {
+    if (wait != portMAX_DELAY && simNow >= until) return pdFALSE;
+    simSleep(100);
+  }
+  m->taken = true;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m)
+{
+  m->taken = false;
+  return pdTRUE;
+}
+
+// ---------------------------------------------------------------- ESP/Wire
+
+uint64_t EspClass::getEfuseMac()
+{
+  return simCurrent->mac;
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+  return 200000;
+}
+
+void EspClass::restart()
+{
+}
+
+// The display at 0x3c gets what an SSD1306 gets: after a control byte 0x00 commands, after 0x80
+// one command (byte), after 0x40 data for the display RAM. Of the commands only the addressing
+// ones matter here, the others are read past with their arguments.
+static int panelArgs(int cmd)
+{
+  switch (cmd) {
+  case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3: case 0xD5: case 0xD9: case 0xDA: case 0xDB: return 1;
+  case 0x21: case 0x22: case 0xA3: return 2;
+  case 0x29: case 0x2A: return 5;
+  case 0x26: case 0x27: return 6;
+  default: return 0;
+  }
+}
+
+static void panelCommand(SimPanel &p, uint8_t b)
+{
+  if (p.cmd < 0) {
+    p.cmd = b;
+    p.args = 0;
+  } else
+    p.arg[p.args++] = b;
+  if (p.args < panelArgs(p.cmd)) return;
+  if (p.cmd == 0x21) { // COLUMNADDR
+    p.col0 = p.col = p.arg[0] & 127;
+    p.col1 = p.arg[1] & 127;
+  }
+  if (p.cmd == 0x22) { // PAGEADDR
+    p.page0 = p.page = p.arg[0] & 7;
+    p.page1 = p.arg[1] & 7;
+  }
+  if (p.cmd == 0xAE || p.cmd == 0xAF) p.on = p.cmd == 0xAF;
+  p.cmd = -1;
+}
+
+static void panelData(SimPanel &p, uint8_t b)
+{
+  p.ram[p.page * 128 + p.col] = b;
+  if (p.col++ < p.col1) return;
+  p.col = p.col0;
+  if (p.page++ >= p.page1) p.page = p.page0;
+}
+
+// Every transaction costs 9 bits per byte at the bus clock, plus the time
+// the ESP32 i2c driver needs to set up and finish one.
+uint8_t TwoWire::endTransmission(bool stop)
+{
+  (void)stop;
+  SimNode *n = simCurrent;
+  int64_t us = (int64_t)(pending * 9 * 1e6 / clock) + 30;
+  n->stats.i2cBytes += pending;
+  n->stats.i2cTime += us / 1e6;
+  if (address == 0x3c && kept > 1) {
+    for (size_t i = 1; i < kept; i++) {
+      if (data[0] == 0x40) panelData(n->panel, data[i]);
+      else panelCommand(n->panel, data[i]);
+      if (data[0] == 0x80) break;
+    }
+  }
+  pending = 0;
+  kept = 0;
+  if (simTask && simTask->stack) simSleep(us); // (see flashBusy())
+  return 0;
+}
+
+// ---------------------------------------------------------------- flash
+
+static const esp_partition_t spiffsPartition = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000, 0x170000,
+                                                "spiffs", false};
+
+static int flashFile(SimNode *n)
+{
+  if (n->flash.fd >= 0) return n->flash.fd;
+  if (simFlashDir.empty()) {
+    FILE *f = tmpfile();
+    n->flash.fd = f ? dup(fileno(f)) : -1;
+    if (f) fclose(f);
+  } else {
+    char path[64];
+    snprintf(path, sizeof(path), "/node%03d.flash", n->id);
+    n->flash.fd = open((simFlashDir + path).c_str(), O_RDWR | O_CREAT, 0644);
+  }
+  if (n->flash.fd < 0) perror("flash image");
+  return n->flash.fd;
+}
+
+// the calling task waits as long as the chip is busy. On the ESP32 the flash cache is off for
+// that long: the other core is parked, and interrupts whose handlers aren't in IRAM wait, the
+// LoRa DIO0 one among them. So every task of the node and its radio interrupts wait too.
+static void flashBusy(SimNode *n, int64_t us)
+{
+  n->stats.flashTime += us / 1e6;
+  n->flash.busyUntil = simNow + us;
+  n->flash.busyTask = simTask;
+  if (simTask && simTask->stack) simSleep(us); // (not in the benchmarks, they have no coroutine)
+}
+
+static void flashRead(int fd, size_t off, uint8_t *b, size_t size)
+{
+  ssize_t got = pread(fd, b, size, off);
+  if (got < 0) got = 0;
+  memset(b + got, 0xFF, size - got); // past the end of the file: erased
+}
+
+// stores b[0..size-1] at off as it is, the file grows with erased bytes if it must
+static void flashStore(int fd, size_t off, const uint8_t *b, size_t size)
+{
+  off_t end = lseek(fd, 0, SEEK_END);
+  uint8_t ff[4096];
+  memset(ff, 0xFF, sizeof(ff));
+  while (end >= 0 && (size_t)end < off) {
+    size_t k = std::min(sizeof(ff), off - (size_t)end);
+    if (pwrite(fd, ff, k, end) != (ssize_t)k) break;
+    end += k;
+  }
+  if (pwrite(fd, b, size, off) != (ssize_t)size) perror("flash image");
+}
+
+// how much of a size byte operation the power lets through (fault injection, see SimFlash)
+static size_t flashPower(SimNode *n, size_t size)
+{
+  if (n->flash.dead) return 0;
+  if (n->flash.cut < 0) return size;
+  size = std::min(size, (size_t)n->flash.cut);
+  n->flash.cut -= size;
+  if (n->flash.cut == 0) n->flash.dead = true;
+  return size;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+  if (type != ESP_PARTITION_TYPE_DATA) return 0;
+  if (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != spiffsPartition.subtype) return 0;
+  if (label && strcmp(label, spiffsPartition.label) != 0) return 0;
+  return flashFile(simCurrent) >= 0 ? &spiffsPartition : 0;
+}
+
+// reads come through the flash cache at about 20 MB/s
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+  SimNode *n = simCurrent;
+  if (src_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+  flashRead(flashFile(n), src_offset, (uint8_t *)dst, size);
+  flashBusy(n, 10 + size / 20);
+  return ESP_OK;
+}
+
+// NOR flash: bits go from 1 to 0 only. About 0.7 ms per 256 byte page programmed.
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+  SimNode *n = simCurrent;
+  uint8_t b[4096];
+  if (dst_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+  if (size == 0) return ESP_OK;
+  int fd = flashFile(n);
+  size_t pages = (dst_offset + size - 1) / 256 - dst_offset / 256 + 1;
+  size_t left = flashPower(n, size);
+  for (size_t done = 0; done < left;) {
+    size_t k = std::min(sizeof(b), left - done);
+    flashRead(fd, dst_offset + done, b, k);
+    for (size_t i = 0; i < k; i++) b[i] &= ((const uint8_t *)src)[done + i];
+    flashStore(fd, dst_offset + done, b, k);
+    done += k;
+  }
+  n->stats.flashBytes += size;
+  flashBusy(n, 700 * pages);
+  return ESP_OK;
+}
+
+// 45 ms per 4 KB sector
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  SimNode *n = simCurrent;
+  uint8_t ff[SPI_FLASH_SEC_SIZE];
+  if ((offset % SPI_FLASH_SEC_SIZE) || (size % SPI_FLASH_SEC_SIZE)) return ESP_ERR_INVALID_ARG;
+  if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+  int fd = flashFile(n);
+  memset(ff, 0xFF, sizeof(ff));
+  size_t left = flashPower(n, size); // (a cut erase leaves the rest of the sector as it was)
+  for (size_t done = 0; done < left; done += SPI_FLASH_SEC_SIZE)
+    flashStore(fd, offset + done, ff, std::min((size_t)SPI_FLASH_SEC_SIZE, left - done));
+  n->stats.flashErases += size / SPI_FLASH_SEC_SIZE;
+  flashBusy(n, 45000 * (size / SPI_FLASH_SEC_SIZE));
+  return ESP_OK;
+}
@@ -0,0 +1,333 @@
+// Host stand-in for the Arduino/ESP32 core, just enough of it to compile
+// src/xplora1src.cpp and the ThingPulse OLED library on Linux for the
+// mesh simulator (see sim/xplorasim.cpp). Time, random numbers, touch pins
+// and the chip's MAC address all come from the simulated node that is
+// currently running.
+
+#ifndef XPLORA_HOST_ARDUINO_H
+#define XPLORA_HOST_ARDUINO_H
+
+#define XPLORA_HOST 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using std::min;
+using std::max;
+using std::abs;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT  0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define LED_BUILTIN 25 // TTGO lora32 V1.6.1
+#define SDA 21
+#define SCL 22
+
+#define PROGMEM
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define pgm_read_word(addr) (*(const unsigned short *)(addr))
+
+// timing, driven by the simulator's virtual clock
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// per node pseudo random numbers (ESP32 core semantics)
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// gpio
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+uint16_t touchRead(uint8_t pin);
+
+// ------------------------------------------------------------------ String
+// Heap backed like the Arduino WString, so allocations can be counted.
+extern unsigned long simStringAllocs;
+
+class String {
+public:
+  String(const char *s = "") { init(); copy(s, s ? strlen(s) : 0); }
+  String(const String &s) { init(); copy(s.buf, s.len); }
+  String(char c) { init(); char t[2] = {c, 0}; copy(t, 1); }
+  String(unsigned char v, unsigned char base = 10) { init(); fromULong(v, base); }
+  String(int v, unsigned char base = 10) { init(); fromLong(v, base); }
+  String(unsigned int v, unsigned char base = 10) { init(); fromULong(v, base); }
+  String(long v, unsigned char base = 10) { init(); fromLong(v, base); }
+  String(unsigned long v, unsigned char base = 10) { init(); fromULong(v, base); }
+  String(float v, unsigned char places = 2) { init(); fromDouble(v, places); }
+  String(double v, unsigned char places = 2) { init(); fromDouble(v, places); }
+  ~String() { free(buf); }
+
+  String &operator=(const String &s) { if (this != &s) copy(s.buf, s.len); return *this; }
+  String &operator=(const char *s) { copy(s, s ? strlen(s) : 0); return *this; }
+
+  unsigned int length() const { return len; }
+  const char *c_str() const { return buf ? buf : ""; }
+  bool reserve(unsigned int size) { return grow(size); }
+
+  bool concat(const char *s, unsigned int n) {
+    if (!n) return true;
+    if (!grow(len + n)) return false;
+    memmove(buf + len, s, n);
+    len += n;
+    buf[len] = 0;
+    return true;
+  }
+  bool concat(const String &s) { return concat(s.c_str(), s.len); }
+  bool concat(const char *s) { return concat(s, strlen(s)); }
+  bool concat(char c) { return concat(&c, 1); }
+  bool concat(int v) { String t(v); return concat(t); }
+  bool concat(long v) { String t(v); return concat(t); }
+  bool concat(unsigned int v) { String t(v); return concat(t); }
+  bool concat(unsigned long v) { String t(v); return concat(t); }
+  bool concat(double v) { String t(v); return concat(t); }
+
+  String &operator+=(const String &s) { concat(s); return *this; }
+  String &operator+=(const char *s) { concat(s); return *this; }
+  String &operator+=(char c) { concat(c); return *this; }
+  String &operator+=(int v) { concat(v); return *this; }
+  String &operator+=(long v) { concat(v); return *this; }
+  String &operator+=(unsigned int v) { concat(v); return *this; }
+  String &operator+=(unsigned long v) { concat(v); return *this; }
+
+  bool equals(const String &s) const { return len == s.len && memcmp(c_str(), s.c_str(), len) == 0; }
+  bool equals(const char *s) const { return strcmp(c_str(), s ? s : "") == 0; }
+  bool operator==(const String &s) const { return equals(s); }
+  bool operator==(const char *s) const { return equals(s); }
+  bool operator!=(const String &s) const { return !equals(s); }
+  bool operator!=(const char *s) const { return !equals(s); }
+  bool operator<(const String &s) const { return strcmp(c_str(), s.c_str()) < 0; }
+
+  char charAt(unsigned int i) const { return i < len ? buf[i] : 0; }
+  void setCharAt(unsigned int i, char c) { if (i < len) buf[i] = c; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  char &operator[](unsigned int i) { static char dummy; if (i >= len) { dummy = 0; return dummy; } return buf[i]; }
+
+  void getBytes(unsigned char *out, unsigned int size, unsigned int index = 0) const {
+    if (!size || !out) return;
+    if (index >= len) { out[0] = 0; return; }
+    unsigned int n = std::min(size - 1, len - index);
+    memcpy(out, buf + index, n);
+    out[n] = 0;
+  }
+  void toCharArray(char *out, unsigned int size, unsigned int index = 0) const { getBytes((unsigned char *)out, size, index); }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    if (from >= len) return -1;
+    const char *p = strchr(buf + from, c);
+    return p ? (int)(p - buf) : -1;
+  }
+  int indexOf(const String &s, unsigned int from = 0) const {
+    if (from > len) return -1;
+    const char *p = strstr(c_str() + from, s.c_str());
+    return p ? (int)(p - c_str()) : -1;
+  }
+  int lastIndexOf(char c) const {
+    for (int i = (int)len - 1; i >= 0; i--) if (buf[i] == c) return i;
+    return -1;
+  }
+  bool startsWith(const String &s) const { return s.len <= len && memcmp(c_str(), s.c_str(), s.len) == 0; }
+  bool endsWith(const String &s) const { return s.len <= len && memcmp(c_str() + len - s.len, s.c_str(), s.len) == 0; }
+
+  String substring(unsigned int from) const { return substring(from, len); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    String out;
+    if (from >= len) return out;
+    if (to > len) to = len;
+    out.copy(buf + from, to - from);
+    return out;
+  }
+  void remove(unsigned int index) { if (index < len) { len = index; buf[len] = 0; } }
+  void remove(unsigned int index, unsigned int count) {
+    if (index >= len || !count) return;
+    if (count > len - index) count = len - index;
+    memmove(buf + index, buf + index + count, len - index - count + 1);
+    len -= count;
+  }
+  void trim() {
+    unsigned int b = 0, e = len;
+    while (b < e && isspace((unsigned char)buf[b])) b++;
+    while (e > b && isspace((unsigned char)buf[e - 1])) e--;
+    memmove(buf, buf + b, e - b);
+    len = e - b;
+    if (buf) buf[len] = 0;
+  }
+  void toUpperCase() { for (unsigned int i = 0; i < len; i++) buf[i] = toupper((unsigned char)buf[i]); }
+  void toLowerCase() { for (unsigned int i = 0; i < len; i++) buf[i] = tolower((unsigned char)buf[i]); }
+  long toInt() const { return buf ? atol(buf) : 0; }
+  float toFloat() const { return buf ? (float)atof(buf) : 0; }
+
+private:
+  char *buf;
+  unsigned int len;
+  unsigned int cap;
+
+  void init() { buf = NULL; len = 0; cap = 0; }
+  bool grow(unsigned int size) {
+    if (buf && cap >= size) return true;
+    char *n = (char *)realloc(buf, size + 1);
+    if (!n) return false;
+    __atomic_add_fetch(&simStringAllocs, 1, __ATOMIC_RELAXED); // (malloc is thread safe, so is this, for "--bench cores")
+    if (!buf) n[0] = 0;
+    buf = n;
+    cap = size;
+    return true;
+  }
+  void copy(const char *s, unsigned int n) {
+    if (!grow(n)) return;
+    memmove(buf, s, n);
+    len = n;
+    buf[len] = 0;
+  }
+  void fromULong(unsigned long v, unsigned char base) {
+    char t[66];
+    int i = 64;
+    t[65] = 0;
+    if (base < 2) base = 10;
+    do { int d = v % base; t[i--] = d < 10 ? '0' + d : 'a' + d - 10; v /= base; } while (v && i >= 0);
+    copy(t + i + 1, 64 - i);
+  }
+  void fromLong(long v, unsigned char base) {
+    if (base == 10 && v < 0) { fromULong((unsigned long)(-v), 10); String m("-"); m.concat(*this); *this = m; }
+    else if (base != 10 && v < 0) fromULong((unsigned long)(uint32_t)v, base); // as the ESP32 core does
+    else fromULong((unsigned long)v, base);
+  }
+  void fromDouble(double v, unsigned char places) {
+    char t[64];
+    snprintf(t, sizeof(t), "%.*f", places, v);
+    copy(t, strlen(t));
+  }
+};
+
+inline String operator+(const String &a, const String &b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, const char *b) { String r(a); r.concat(b); return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, char b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, int b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, long b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, unsigned int b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, unsigned long b) { String r(a); r.concat(b); return r; }
+inline bool operator==(const char *a, const String &b) { return b.equals(a); }
+inline bool operator!=(const char *a, const String &b) { return !b.equals(a); }
+
+// the simulator wants to see every line that reaches a node's chat screen
+void simOnChat(const char *line);
+
+// ------------------------------------------------------------ Print/Stream
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char *s) { return s ? write((const uint8_t *)s, strlen(s)) : 0; }
+  size_t write(const char *s, size_t size) { return write((const uint8_t *)s, size); }
+
+  size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = DEC) { return print(String((long)v, (unsigned char)base)); }
+  size_t print(unsigned int v, int base = DEC) { return print(String((unsigned long)v, (unsigned char)base)); }
+  size_t print(long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+  size_t print(unsigned long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+  size_t print(double v, int places = 2) { return print(String(v, (unsigned char)places)); }
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template <typename T> size_t println(T v, int f) { size_t n = print(v, f); return n + println(); }
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  void setTimeout(unsigned long t) { timeout = t; }
+protected:
+  unsigned long timeout = 1000;
+};
+
+// Serial port of the current node. Output goes to stdout when the simulator
+// runs verbose, input can be fed by the simulator (gateway scenarios).
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud);
+  void end() {}
+  size_t setRxBufferSize(size_t size) { return size; }
+  size_t setTxBufferSize(size_t size);
+  int available();
+  int read();
+  int peek();
+  int availableForWrite();
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+  operator bool() const { return true; }
+};
+extern HardwareSerial Serial;
+
+// ESP32 chip info
+class EspClass {
+public:
+  uint64_t getEfuseMac();
+  uint32_t getFreeHeap();
+  void restart();
+};
+extern EspClass ESP;
+
+// FreeRTOS, the part the dual core split and the display flush task use. A task runs as a coroutine of its node on the
+// virtual clock (see simTaskCreate()), a tick is a millisecond like with the ESP32 core.
+typedef void *TaskHandle_t;
+typedef struct SimMutex *SemaphoreHandle_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void *), const char *name, uint32_t stack, void *arg, unsigned prio,
+                                   TaskHandle_t *handle, int core);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t wait);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m);
+
+#endif
@@ -0,0 +1,94 @@
+// Host stand-in for the arduino-LoRa library (Sandeep Mistry), same public
+// API as libs/arduino-LoRa-master.zip. Every call acts on the SX127x model of
+// the simulated node that is currently running (sim/radio.cpp), so the
+// sketch sees the same packet, IRQ and mode semantics it sees on the board:
+// parsePacket() arms RX_SINGLE, the chip drops back to standby after each
+// received frame or RX timeout, endPacket() blocks for the time on air, and
+// onReceive()/onTxDone() callbacks fire like a DIO0 interrupt.
+
+#ifndef LORA_H
+#define LORA_H
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#define LORA_DEFAULT_SPI           SPI
+#define LORA_DEFAULT_SPI_FREQUENCY 8E6
+#define LORA_DEFAULT_SS_PIN        10
+#define LORA_DEFAULT_RESET_PIN     9
+#define LORA_DEFAULT_DIO0_PIN      2
+
+#define PA_OUTPUT_RFO_PIN          0
+#define PA_OUTPUT_PA_BOOST_PIN     1
+
+class LoRaClass : public Stream {
+public:
+  LoRaClass() {}
+
+  int begin(long frequency);
+  void end();
+
+  int beginPacket(int implicitHeader = false);
+  int endPacket(bool async = false);
+
+  int parsePacket(int size = 0);
+  int packetRssi();
+  float packetSnr();
+  long packetFrequencyError();
+
+  int rssi();
+
+  // from Print
+  virtual size_t write(uint8_t byte);
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+  // from Stream
+  virtual int available();
+  virtual int read();
+  virtual int peek();
+  virtual void flush();
+
+  void onReceive(void(*callback)(int));
+  void onCadDone(void(*callback)(boolean));
+  void onTxDone(void(*callback)());
+
+  void receive(int size = 0);
+  void channelActivityDetection(void);
+
+  void idle();
+  void sleep();
+
+  void setTxPower(int level, int outputPin = PA_OUTPUT_PA_BOOST_PIN);
+  void setFrequency(long frequency);
+  void setSpreadingFactor(int sf);
+  void setSignalBandwidth(long sbw);
+  void setCodingRate4(int denominator);
+  void setPreambleLength(long length);
+  void setSyncWord(int sw);
+  void enableCrc();
+  void disableCrc();
+  void enableInvertIQ() {}
+  void disableInvertIQ() {}
+  void enableLowDataRateOptimize() {}
+  void disableLowDataRateOptimize() {}
+
+  void setOCP(uint8_t mA) { (void)mA; }
+  void setGain(uint8_t gain) { (void)gain; }
+
+  // deprecated
+  void crc() { enableCrc(); }
+  void noCrc() { disableCrc(); }
+
+  byte random();
+
+  void setPins(int ss = LORA_DEFAULT_SS_PIN, int reset = LORA_DEFAULT_RESET_PIN, int dio0 = LORA_DEFAULT_DIO0_PIN) { (void)ss; (void)reset; (void)dio0; }
+  void setSPI(SPIClass& spi) { (void)spi; }
+  void setSPIFrequency(uint32_t frequency) { (void)frequency; }
+
+  void dumpRegisters(Stream& out) { (void)out; }
+};
+
+extern LoRaClass LoRa;
+
+#endif
@@ -0,0 +1,24 @@
+// Host stand-in for the ESP32 SPI library (the radio is simulated one level up,
+// see LoRa.h).
+
+#ifndef XPLORA_HOST_SPI_H
+#define XPLORA_HOST_SPI_H
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+public:
+  SPISettings(uint32_t clock = 1000000, uint8_t bitOrder = MSBFIRST, uint8_t dataMode = SPI_MODE0) { (void)clock; (void)bitOrder; (void)dataMode; }
+};
+
+class SPIClass {
+public:
+  void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) { (void)sck; (void)miso; (void)mosi; (void)ss; }
+  void end() {}
+};
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,31 @@
+// Host stand-in for the ESP32 Wire (I2C) library. Every transmission costs the
+// simulated node the time the bytes take on the bus, so slow display updates
+// show up as lost radio time, and what goes to the display ends up in the
+// node's SimPanel (see hal.cpp).
+
+#ifndef XPLORA_HOST_WIRE_H
+#define XPLORA_HOST_WIRE_H
+
+#include <Arduino.h>
+
+class TwoWire {
+public:
+  TwoWire(int bus) : bus(bus) {}
+  bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { (void)sda; (void)scl; if (frequency) clock = frequency; return true; }
+  void setClock(uint32_t frequency) { clock = frequency; }
+  void beginTransmission(uint8_t address) { this->address = address; pending = 1; kept = 0; } // address byte
+  size_t write(uint8_t c) { if (kept < sizeof(data)) data[kept++] = c; pending++; return 1; }
+  size_t write(const uint8_t *buf, size_t n) { for (size_t i = 0; i < n; i++) write(buf[i]); return n; }
+  uint8_t endTransmission(bool stop = true);
+private:
+  int bus;
+  uint32_t clock = 100000;
+  unsigned long pending = 0;
+  uint8_t address = 0;
+  uint8_t data[128]; // the ESP32 driver's buffer
+  size_t kept = 0;
+};
+extern TwoWire Wire;
+extern TwoWire Wire1;
+
+#endif
@@ -0,0 +1,497 @@
+// SX127x/LoRa radio model behind the LoRa.h stand-in.
+//
+// Every transmission becomes a SimFrame that is handed to all nodes within
+// interference range. A receiver evaluates its frames lazily, in time order,
+// whenever its own code touches the radio (or an interrupt is due). Because
+// the scheduler always runs the node with the smallest clock, every frame
+// that could overlap has been registered by then. A frame is received when
+//  - it matches the receiver's frequency, SF, bandwidth and sync word and is
+//    above the sensitivity for that SF,
+//  - the receiver was in RX when the preamble started and stayed in RX until
+//    the frame ended, and
+//  - no overlapping frame on the same channel came within the capture
+//    threshold (simCaptureDb) of its power.
+// RX_SINGLE falls back to standby after each received frame and after
+// 100 symbols without a preamble, just like the chip (RegSymbTimeout reset
+// value), so a sketch that doesn't call parsePacket() often enough goes deaf.
+// CAD takes two symbols and reports activity when any frame with the
+// radio's SF and bandwidth is on air above the sensitivity at some point
+// during it; the SX127x correlates preamble and payload chirps alike.
+
+#include "hal/LoRa.h"
+#include "simnode.h"
+
+#include <limits.h>
+
+LoRaClass LoRa;
+std::vector<SimFrame> simFrames;
+double simCaptureDb = 6.0;
+
+static const double snrLimit[13] = {0, 0, 0, 0, 0, 0, -5.0, -7.5, -10.0, -12.5, -15.0, -17.5, -20.0};
+
+double radioNoiseFloor(long bw)
+{
+  return -174.0 + 10.0 * log10((double)bw) + 6.0; // 6 dB noise figure
+}
+
+double radioSensitivity(int sf, long bw)
+{
+  return radioNoiseFloor(bw) + snrLimit[sf];
+}
+
+// Semtech AN1200.13, with the low data rate optimization the library turns
+// on by itself for symbols longer than 16 ms
+double radioTimeOnAir(int sf, long bw, int cr, long preamble, bool crc, bool implicitHeader, int len)
+{
+  double tsym = (double)(1L << sf) / bw;
+  int de = tsym > 0.016 ? 1 : 0;
+  double tpreamble = (preamble + 4.25) * tsym;
+  double num = 8.0 * len - 4.0 * sf + 28 + (crc ? 16 : 0) - (implicitHeader ? 20 : 0);
+  double payloadSymbols = 8 + fmax(ceil(num / (4.0 * (sf - 2 * de))) * cr, 0);
+  return tpreamble + payloadSymbols * tsym;
+}
+
+static bool isRx(int mode)
+{
+  return mode == RADIO_RX_SINGLE || mode == RADIO_RX_CONT;
+}
+
+static int64_t symbolUs(const SimRadio &r)
+{
+  return (int64_t)((double)(1L << r.sf) * 1e6 / r.bw);
+}
+
+static void setMode(SimNode *n, int mode, int why = 0)
+{
+  SimRadio &r = n->radio;
+  if (isRx(r.mode) && !isRx(mode)) {
+    // whatever the radio was receiving is gone
+    for (size_t i = r.heardHead; i < r.heard.size(); i++) {
+      SimHeard &h = r.heard[i];
+      if (!h.started) break;
+      if (!h.done && h.listening) {
+        h.listening = false;
+        h.lossWhy = mode == RADIO_TX ? LOSS_HALFDUPLEX : why == 4 ? LOSS_COLLISION : LOSS_UNSERVICED;
+      }
+    }
+  }
+  r.mode = mode;
+  if (mode == RADIO_STANDBY || mode == RADIO_SLEEP) r.standbyWhy = why;
+  if (mode == RADIO_RX_SINGLE) {
+    r.armT = simNow;
+    r.preambleSeen = false;
+  }
+}
+
+static bool cadHears(const SimRadio &r, const SimHeard &h)
+{
+  const SimFrame &f = simFrames[h.frame];
+  return f.freq == r.freq && f.sf == r.sf && f.bw == r.bw && h.rssi >= radioSensitivity(f.sf, f.bw);
+}
+
+static void frameStart(SimNode *n, SimHeard &h)
+{
+  SimRadio &r = n->radio;
+  const SimFrame &f = simFrames[h.frame];
+  h.started = true;
+  if (r.mode == RADIO_CAD && cadHears(r, h)) r.cadDetected = true;
+  h.decodable = f.freq == r.freq && f.sf == r.sf && f.bw == r.bw && f.sync == r.sync &&
+                h.rssi >= radioSensitivity(f.sf, f.bw);
+  if (!h.decodable) return;
+  if (isRx(r.mode)) {
+    h.listening = true;
+    if (r.mode == RADIO_RX_SINGLE) r.preambleSeen = true;
+  } else {
+    h.lossWhy = r.mode == RADIO_TX ? LOSS_HALFDUPLEX : LOSS_UNSERVICED;
+  }
+}
+
+static void frameEnd(SimNode *n, size_t idx)
+{
+  SimRadio &r = n->radio;
+  SimHeard &h = r.heard[idx];
+  const SimFrame &f = simFrames[h.frame];
+  h.done = true;
+  if (!h.decodable) return;
+  if (!h.listening) {
+    n->stats.lost[h.lossWhy]++;
+    return;
+  }
+  for (size_t j = r.heardHead; j < r.heard.size(); j++) {
+    if (j == idx) continue;
+    const SimHeard &g = r.heard[j];
+    const SimFrame &gf = simFrames[g.frame];
+    if (gf.start >= f.end) break;
+    if (gf.end <= f.start) continue;
+    if (gf.freq != f.freq || gf.sf != f.sf || gf.bw != f.bw) continue;
+    if (g.rssi > h.rssi - simCaptureDb) {
+      n->stats.lost[LOSS_COLLISION]++;
+      h.listening = false;
+      if (r.mode == RADIO_RX_SINGLE) setMode(n, RADIO_STANDBY, 4);
+      return;
+    }
+  }
+  if (r.rxDone) n->stats.lost[LOSS_OVERRUN]++; // previous frame never picked up
+  memcpy(r.rxbuf, f.data, f.len);
+  r.rxlen = f.len;
+  r.rxIndex = 0;
+  r.rxDone = true;
+  r.rxRssi = h.rssi;
+  r.rxSnr = fmin(h.rssi - radioNoiseFloor(f.bw), 12.0);
+  n->stats.rxFrames++;
+  simOnRx(n, f);
+  if (r.mode == RADIO_RX_SINGLE) setMode(n, RADIO_STANDBY, 1);
+  else if (r.onReceive) r.irqs.push_back({f.end, 0, f.len});
+}
+
+// bring node n's radio up to time t
+void radioAdvance(SimNode *n, int64_t t)
+{
+  SimRadio &r = n->radio;
+  for (;;) {
+    int64_t tn = LLONG_MAX;
+    int kind = 0; // 1 frame end, 2 tx end, 3 rx timeout, 4 frame start, 5 cad done
+    size_t idx = 0;
+    for (size_t i = r.heardHead; i < r.heard.size(); i++) {
+      const SimHeard &h = r.heard[i];
+      const SimFrame &f = simFrames[h.frame];
+      if (!h.started) {
+        if (f.start < tn) { tn = f.start; kind = 4; idx = i; }
+        break; // frames are in start order
+      }
+      if (!h.done && f.end < tn) { tn = f.end; kind = 1; idx = i; }
+    }
+    if (r.mode == RADIO_TX && (r.txEnd < tn || (r.txEnd == tn && kind > 2))) { tn = r.txEnd; kind = 2; }
+    if (r.mode == RADIO_RX_SINGLE && !r.preambleSeen) {
+      int64_t to = r.armT + 100 * symbolUs(r);
+      if (to < tn || (to == tn && kind > 3)) { tn = to; kind = 3; }
+    }
+    if (r.mode == RADIO_CAD && r.cadEnd < tn) { tn = r.cadEnd; kind = 5; }
+    if (tn > t) break;
+    if (kind == 1) frameEnd(n, idx);
+    if (kind == 2) {
+      setMode(n, RADIO_STANDBY, 3);
+      if (r.asyncTx && r.onTxDone) r.irqs.push_back({tn, 1, 0});
+    }
+    if (kind == 3) setMode(n, RADIO_STANDBY, 2);
+    if (kind == 4) frameStart(n, r.heard[idx]);
+    if (kind == 5) {
+      setMode(n, RADIO_STANDBY);
+      n->stats.cads++;
+      if (r.cadDetected) n->stats.cadBusy++;
+      if (r.onCadDone) r.irqs.push_back({tn, 2, r.cadDetected});
+    }
+  }
+
+  // forget frames that can no longer matter
+  int64_t keep = t;
+  for (size_t i = r.heardHead; i < r.heard.size(); i++) {
+    const SimHeard &h = r.heard[i];
+    if (!h.done) { keep = std::min(keep, simFrames[h.frame].start); break; }
+  }
+  while (r.heardHead < r.heard.size() && r.heard[r.heardHead].done &&
+         simFrames[r.heard[r.heardHead].frame].end <= keep)
+    r.heardHead++;
+  if (r.heardHead > 1024) {
+    r.heard.erase(r.heard.begin(), r.heard.begin() + r.heardHead);
+    r.heardHead = 0;
+  }
+}
+
+void radioDeliverIrqs(SimNode *n)
+{
+  SimRadio &r = n->radio;
+  while (!r.irqs.empty() && r.irqs.front().t <= simNow) {
+    SimIrq irq = r.irqs.front();
+    r.irqs.erase(r.irqs.begin());
+    n->inIrq++;
+    if (irq.type == 0 && r.rxDone && r.onReceive) {
+      r.rxDone = false;
+      r.rxIndex = 0;
+      r.onReceive(r.rxlen);
+    }
+    if (irq.type == 1 && r.onTxDone) r.onTxDone();
+    if (irq.type == 2 && r.onCadDone) r.onCadDone(irq.arg != 0);
+    n->inIrq--;
+  }
+}
+
+static int findTag(const uint8_t *d, int len)
+{
+  for (int i = 0; i + 6 < len; i++) {
+    if (d[i] != '#') continue;
+    int v = 0, k;
+    for (k = 1; k <= 6 && d[i + k] >= '0' && d[i + k] <= '9'; k++) v = v * 10 + (d[i + k] - '0');
+    if (k == 7) return v;
+  }
+  return -1;
+}
+
+// ---------------------------------------------------------------- LoRaClass
+
+int LoRaClass::begin(long frequency)
+{
+  SimRadio &r = simCurrent->radio;
+  r.freq = frequency;
+  r.sf = 7;
+  r.bw = 125000;
+  r.cr = 5;
+  r.preamble = 8;
+  r.sync = 0x12;
+  r.crcOn = false;
+  r.txPower = 17;
+  setMode(simCurrent, RADIO_STANDBY);
+  return 1;
+}
+
+void LoRaClass::end()
+{
+  sleep();
+}
+
+int LoRaClass::beginPacket(int implicitHeader)
+{
+  SimNode *n = simCurrent;
+  radioAdvance(n, simNow);
+  if (n->radio.mode == RADIO_TX) return 0;
+  setMode(n, RADIO_STANDBY);
+  n->radio.implicitHeader = implicitHeader;
+  n->radio.txlen = 0;
+  return 1;
+}
+
+int LoRaClass::endPacket(bool async)
+{
+  SimNode *n = simCurrent;
+  SimRadio &r = n->radio;
+  radioAdvance(n, simNow);
+
+  SimFrame f;
+  f.src = n->id;
+  f.start = simNow;
+  double toa = radioTimeOnAir(r.sf, r.bw, r.cr, r.preamble, r.crcOn, r.implicitHeader, r.txlen);
+  f.end = simNow + (int64_t)(toa * 1e6);
+  f.freq = r.freq;
+  f.sf = r.sf;
+  f.bw = r.bw;
+  f.sync = r.sync;
+  f.len = r.txlen;
+  memcpy(f.data, r.txbuf, r.txlen);
+  f.tag = findTag(f.data, f.len);
+  int fid = (int)simFrames.size();
+  simFrames.push_back(f);
+
+  for (size_t i = 0; i < n->neighbors.size(); i++) {
+    SimNode *m = simNodes[n->neighbors[i]];
+    SimHeard h = {fid, (float)(r.txPower - n->neighborLoss[i]), false, false, false, false, 0};
+    m->radio.heard.push_back(h);
+    if (m->radio.onReceive && m->radio.mode == RADIO_RX_CONT) simWakeAt(m, f.end);
+  }
+
+  setMode(n, RADIO_TX);
+  r.txEnd = f.end;
+  r.asyncTx = async;
+  n->stats.txFrames++;
+  n->stats.airtime += toa;
+  simOnTx(n, f);
+  if (async) {
+    if (r.onTxDone) simWakeAt(n, f.end);
+  } else {
+    n->radioCall++;
+    simSleep(f.end - simNow);
+    n->radioCall--;
+    radioAdvance(n, simNow);
+  }
+  return 1;
+}
+
+int LoRaClass::parsePacket(int size)
+{
+  (void)size;
+  SimNode *n = simCurrent;
+  SimRadio &r = n->radio;
+  radioAdvance(n, simNow);
+  if (r.rxDone) {
+    r.rxDone = false;
+    r.rxIndex = 0;
+    setMode(n, RADIO_STANDBY);
+    return r.rxlen;
+  }
+  if (r.mode != RADIO_RX_SINGLE) setMode(n, RADIO_RX_SINGLE);
+  return 0;
+}
+
+int LoRaClass::packetRssi()
+{
+  return (int)lround(simCurrent->radio.rxRssi);
+}
+
+float LoRaClass::packetSnr()
+{
+  return simCurrent->radio.rxSnr;
+}
+
+long LoRaClass::packetFrequencyError()
+{
+  return 0;
+}
+
+// current RSSI of the channel: every frame on air at this node plus noise
+int LoRaClass::rssi()
+{
+  SimNode *n = simCurrent;
+  SimRadio &r = n->radio;
+  radioAdvance(n, simNow);
+  double mw = pow(10.0, radioNoiseFloor(r.bw) / 10.0);
+  for (size_t i = r.heardHead; i < r.heard.size(); i++) {
+    const SimFrame &f = simFrames[r.heard[i].frame];
+    if (f.start > simNow) break;
+    if (f.end > simNow && f.freq == r.freq) mw += pow(10.0, r.heard[i].rssi / 10.0);
+  }
+  return (int)lround(10.0 * log10(mw));
+}
+
+size_t LoRaClass::write(uint8_t byte)
+{
+  return write(&byte, 1);
+}
+
+size_t LoRaClass::write(const uint8_t *buffer, size_t size)
+{
+  SimRadio &r = simCurrent->radio;
+  if (r.txlen + size > 255) size = 255 - r.txlen;
+  memcpy(r.txbuf + r.txlen, buffer, size);
+  r.txlen += size;
+  return size;
+}
+
+int LoRaClass::available()
+{
+  SimRadio &r = simCurrent->radio;
+  return r.rxlen - r.rxIndex;
+}
+
+int LoRaClass::read()
+{
+  SimRadio &r = simCurrent->radio;
+  if (r.rxIndex >= r.rxlen) return -1;
+  return r.rxbuf[r.rxIndex++];
+}
+
+int LoRaClass::peek()
+{
+  SimRadio &r = simCurrent->radio;
+  if (r.rxIndex >= r.rxlen) return -1;
+  return r.rxbuf[r.rxIndex];
+}
+
+void LoRaClass::flush()
+{
+}
+
+void LoRaClass::onReceive(void (*callback)(int))
+{
+  simCurrent->radio.onReceive = callback;
+  simCurrent->irqTask = simTask; // the interrupt is attached to the core of the task that attached it
+}
+
+void LoRaClass::onCadDone(void (*callback)(boolean))
+{
+  simCurrent->radio.onCadDone = callback;
+  simCurrent->irqTask = simTask;
+}
+
+void LoRaClass::onTxDone(void (*callback)())
+{
+  simCurrent->radio.onTxDone = callback;
+  simCurrent->irqTask = simTask;
+}
+
+void LoRaClass::receive(int size)
+{
+  (void)size;
+  SimNode *n = simCurrent;
+  radioAdvance(n, simNow);
+  setMode(n, RADIO_RX_CONT);
+}
+
+void LoRaClass::channelActivityDetection()
+{
+  SimNode *n = simCurrent;
+  SimRadio &r = n->radio;
+  radioAdvance(n, simNow);
+  setMode(n, RADIO_CAD);
+  r.cadEnd = simNow + 2 * symbolUs(r);
+  r.cadDetected = false;
+  for (size_t i = r.heardHead; i < r.heard.size(); i++) {
+    const SimHeard &h = r.heard[i];
+    if (!h.started) break;
+    if (!h.done && cadHears(r, h)) r.cadDetected = true;
+  }
+  if (r.onCadDone) simWakeAt(n, r.cadEnd);
+}
+
+void LoRaClass::idle()
+{
+  SimNode *n = simCurrent;
+  radioAdvance(n, simNow);
+  setMode(n, RADIO_STANDBY);
+}
+
+void LoRaClass::sleep()
+{
+  SimNode *n = simCurrent;
+  radioAdvance(n, simNow);
+  setMode(n, RADIO_SLEEP);
+}
+
+void LoRaClass::setTxPower(int level, int outputPin)
+{
+  (void)outputPin;
+  simCurrent->radio.txPower = std::max(2, std::min(20, level));
+}
+
+void LoRaClass::setFrequency(long frequency)
+{
+  simCurrent->radio.freq = frequency;
+}
+
+void LoRaClass::setSpreadingFactor(int sf)
+{
+  simCurrent->radio.sf = std::max(6, std::min(12, sf));
+}
+
+void LoRaClass::setSignalBandwidth(long sbw)
+{
+  simCurrent->radio.bw = sbw;
+}
+
+void LoRaClass::setCodingRate4(int denominator)
+{
+  simCurrent->radio.cr = std::max(5, std::min(8, denominator));
+}
+
+void LoRaClass::setPreambleLength(long length)
+{
+  simCurrent->radio.preamble = length;
+}
+
+void LoRaClass::setSyncWord(int sw)
+{
+  simCurrent->radio.sync = sw;
+}
+
+void LoRaClass::enableCrc()
+{
+  simCurrent->radio.crcOn = true;
+}
+
+void LoRaClass::disableCrc()
+{
+  simCurrent->radio.crcOn = false;
+}
+
+byte LoRaClass::random()
+{
+  return (byte)simRand32(simCurrent->rng);
+}
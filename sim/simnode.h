@@ -0,0 +1,202 @@
+// Internals shared by the host simulator files: the virtual node, its
+// SX127x radio model and the discrete-event scheduler.
+
+#ifndef XPLORA_SIMNODE_H
+#define XPLORA_SIMNODE_H
+
+#include <stdint.h>
+#include <ucontext.h>
+#include <vector>
+#include <string>
+
+class String;
+
+// radio operating modes (the subset of the SX127x RegOpMode the library uses)
+enum { RADIO_SLEEP, RADIO_STANDBY, RADIO_TX, RADIO_RX_SINGLE, RADIO_RX_CONT, RADIO_CAD };
+
+// why a frame that reached a node in range did not make it into its FIFO
+enum { LOSS_COLLISION, LOSS_HALFDUPLEX, LOSS_UNSERVICED, LOSS_OVERRUN, LOSS_REASONS };
+
+struct SimFrame {
+  int src;
+  int64_t start, end; // us
+  long freq;
+  int sf;
+  long bw;
+  int sync;
+  int len;
+  uint8_t data[256];
+  int tag; // simulator message id found in the payload, -1 if none
+};
+
+// a frame as seen by one receiver
+struct SimHeard {
+  int frame;
+  float rssi;
+  bool started;   // start event processed
+  bool decodable; // right channel settings and above sensitivity
+  bool listening; // radio was in RX at the preamble and stayed there
+  bool done;      // end event processed
+  int lossWhy;
+};
+
+struct SimIrq {
+  int64_t t;
+  int type; // 0 rx done, 1 tx done, 2 cad done
+  int arg;
+};
+
+struct SimRadio {
+  int mode = RADIO_SLEEP;
+  int standbyWhy = 0; // 0 api, 1 after rx done, 2 rx timeout, 3 after tx
+  long freq = 0;
+  int sf = 7;
+  long bw = 125000;
+  int cr = 5; // 4/cr
+  long preamble = 8;
+  int sync = 0x12;
+  bool crcOn = false;
+  int txPower = 17;
+  bool implicitHeader = false;
+  bool asyncTx = false;
+
+  int64_t armT = 0;        // RX_SINGLE armed at
+  bool preambleSeen = false;
+  int64_t txEnd = 0;
+  int64_t cadEnd = 0;
+  bool cadDetected = false;
+
+  uint8_t txbuf[256];
+  int txlen = 0;
+
+  bool rxDone = false;
+  uint8_t rxbuf[256];
+  int rxlen = 0;
+  int rxIndex = 0;
+  float rxRssi = 0, rxSnr = 0;
+
+  std::vector<SimHeard> heard; // frames reaching this node, ordered by start
+  size_t heardHead = 0;        // first entry that may still matter
+
+  void (*onReceive)(int) = 0;
+  void (*onTxDone)() = 0;
+  void (*onCadDone)(bool) = 0;
+  std::vector<SimIrq> irqs;
+};
+
+struct SimStats {
+  unsigned long txFrames = 0;
+  double airtime = 0; // s
+  unsigned long rxFrames = 0;
+  unsigned long lost[LOSS_REASONS] = {0};
+  unsigned long i2cBytes = 0;
+  double i2cTime = 0; // s
+  unsigned long cads = 0, cadBusy = 0;
+  unsigned long flashBytes = 0, flashErases = 0;
+  double flashTime = 0; // s
+  double serialWait = 0; // s the sketch waited in Serial.write() for room in the UART buffers
+  unsigned long irqsLate = 0; // radio interrupts served more than 1 ms after the radio raised them
+  double irqLateMax = 0; // s
+  unsigned long panelFrames = 0, panelWrong = 0; // frames the sketch said were on the display, and
+                                                 // how many of them the panel RAM didn't show
+};
+
+// a node's flash (hal/esp_partition.h): a file, in simFlashDir if it's set (so the next run boots
+// with it), else a temporary one. Bytes past its end read as erased.
+struct SimFlash {
+  int fd = -1;
+  long cut = -1;     // fault injection: bytes still written before the power fails, -1 never
+  bool dead = false; // the power failed, nothing gets written any more
+  int64_t busyUntil = 0;       // the chip is busy, the flash cache is off: until then every task of the
+  struct SimNode *busyTask = 0; // node but this one waits, and so do the radio interrupts (see flashBusy())
+};
+
+// the SSD1306 at the other end of the node's i2c bus, as far as the sketch drives it: the display
+// RAM of 128 x 64 pixels in 8 pages, the column and page window and the pointer data bytes go to
+// (horizontal addressing), and the command it is reading the arguments of
+struct SimPanel {
+  uint8_t ram[1024] = {0};
+  int col0 = 0, col1 = 127, page0 = 0, page1 = 7;
+  int col = 0, page = 0;
+  int cmd = -1, args = 0, arg[6];
+  bool on = false;
+};
+
+struct SimNode {
+  int id;
+  double x, y; // m
+  uint64_t mac;
+  int64_t bootT;  // us
+  int64_t wake;   // us, heap key
+  int64_t irqWake;
+  int heapPos = -1;
+  bool booted = false;
+  int radioCall = 0; // >0 while inside a LoRa call, interrupts held back
+  int inIrq = 0;
+
+  ucontext_t ctx;
+  char *stack = 0;
+
+  void *lib = 0;
+  void (*setup)() = 0;
+  void (*loop)() = 0;
+  void (*send)(int, String) = 0;
+  void (*sendTo)(uint16_t, String) = 0;
+
+  uint64_t rng;
+  uint32_t arduinoRng; // state behind random()/randomSeed()
+
+  std::vector<int> neighbors; // node ids that hear this node at all
+  std::vector<float> neighborLoss; // path loss to each of them, dB
+
+  size_t nextInject = 0;
+  std::vector<int> injects; // message ids this node originates, by time
+
+  SimRadio radio;
+  SimStats stats;
+  SimFlash flash;
+  SimPanel panel;
+
+  std::string serialOut;
+  std::string serialIn;
+  bool serialRaw = false; // output kept byte by byte in serialOut, for a host to read (gateway)
+  int serialTxBuf = 0; // bytes of UART buffer setTxBufferSize() asked for, on top of the 128 byte FIFO
+  double serialTxPending = 0; // bytes written the UART hasn't sent yet
+  int64_t serialTxT = 0; // simNow when serialTxPending was last brought up to date
+
+  // A FreeRTOS task the sketch starts (the radio task of the dual core split) is a SimNode of its
+  // own in the scheduler, with its own coroutine and clock, everything else is its owner's.
+  SimNode *owner = 0;   // set in such a task
+  SimNode *irqTask = 0; // task the radio interrupts run in (the one that set the callbacks), 0 = the node
+  void (*taskFn)(void *) = 0;
+  void *taskArg = 0;
+  uint32_t notified = 0; // FreeRTOS task notification count
+};
+
+// simulator state the stand-ins need
+extern SimNode *simCurrent; // node running now
+extern SimNode *simTask;    // ... and which of its tasks, simCurrent itself or a task it started
+extern int64_t simNow; // us
+extern bool simVerbose;
+extern std::string simFlashDir;
+
+void simSleep(int64_t us);           // advance the current node, run due interrupts
+void simWakeAt(SimNode *n, int64_t t); // make sure a sleeping node wakes by t
+SimNode *simTaskCreate(void (*fn)(void *), void *arg); // starts a task of the current node
+void simWait(int64_t us);            // like simSleep(), but simWakeAt() ends it early (no interrupts)
+void simOnChat(const char *line);  // called by the sketch when a line reaches the chat
+void simOnTx(SimNode *n, const SimFrame &f);
+void simOnRx(SimNode *n, const SimFrame &f); // frame made it into n's FIFO
+uint32_t simRand32(uint64_t &state);
+
+// radio model (radio.cpp)
+void radioAdvance(SimNode *n, int64_t t);
+void radioDeliverIrqs(SimNode *n);
+double radioTimeOnAir(int sf, long bw, int cr, long preamble, bool crc, bool implicitHeader, int len);
+double radioSensitivity(int sf, long bw);
+double radioNoiseFloor(long bw);
+extern std::vector<SimFrame> simFrames;
+extern std::vector<SimNode *> simNodes;
+extern double simCaptureDb;
+
+#endif
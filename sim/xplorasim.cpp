@@ -0,0 +1,1008 @@
+// XPLORA host mesh simulator.
+//
+// Runs hundreds to thousands of virtual TTGO boards in one Linux process,
+// each executing the real sketch (src/xplora1src.cpp, compiled into
+// xplora_node.so against the stand-ins in sim/hal). Every node gets its own
+// private copy of the shared object, so the sketch's globals stay per node,
+// and its own coroutine, so setup()/loop() run unmodified on a virtual clock.
+// The scheduler always resumes the node with the smallest clock; radio
+// traffic between nodes goes through the SX127x model in radio.cpp.
+//
+// Traffic is injected by calling the sketch's myLoraSend() on the origin
+// node, the same function the chat screen uses when the user taps
+// "Speak" or "Yell". Each injected text carries a "#nnnnnn" tag, so the
+// simulator can follow it through rebroadcasts and into the chat screens.
+//
+//   sim/build/xplorasim --nodes 200 --area 3500 --yells 40
+//   sim/build/xplorasim --bench zip          (benchmarks, see bench.cpp)
+
+#include "hal/Arduino.h"
+#include "simnode.h"
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+SimNode *simCurrent = 0;
+SimNode *simTask = 0;
+int64_t simNow = 0;
+bool simVerbose = false;
+std::string simFlashDir;
+std::vector<SimNode *> simNodes;
+
+int simBench(const std::string &name, void *lib, const std::string &corpus);
+
+static ucontext_t schedCtx;
+static std::vector<SimNode *> heap;
+
+// ------------------------------------------------------------- scenario
+
+struct Scenario {
+  int nodes = 200;
+  double area = 3500;       // km^2, square
+  double duration = 600;    // s
+  int yells = 40;
+  int speaks = 0;
+  int directs = 0;
+  int pairs = 0; // direct messages go back and forth between this many node pairs, 0 = random ones
+  int dmLength = 0; // direct messages are padded with more chat lines to this many bytes
+  double beaconFraction = 0; // share of nodes with is_beaconsender=1
+  double legacyFraction = 0; // share of nodes sending legacy ASCII frames (pck_legacy=1)
+  bool gateway = false; // speaks and yells go in over the serial port of node 0, see gatewayRead()
+  int sf = 7;
+  int txPower = 17;
+  double pl0 = 120;         // path loss at 1 km, dB
+  double exponent = 2.7;    // path loss exponent
+  double shadowing = 0;     // sigma of per link log-normal shadowing, dB
+  double bootSpread = 10;   // s
+  double drain = 60;        // s without new messages at the end
+  uint64_t seed = 1;
+  std::string lib;
+  std::string bench;
+  std::string corpus;
+  std::vector<std::pair<std::string, int>> globals; // --set NAME=V, int sketch globals on every node
+};
+
+struct Message {
+  int id;
+  int origin;
+  int type; // 0 speak, 1 yell, 2 direct
+  int dest;  // direct messages: node it's for
+  int64_t due, sent;
+  std::string text;
+  std::vector<int64_t> seen; // first time each node showed it, -1 never
+  std::vector<uint16_t> tx;  // frames each node sent carrying it
+  int reachable;             // nodes that could get it (excluding the origin)
+  long redundant;            // receptions by nodes that already had it
+};
+
+static Scenario sc;
+static std::vector<Message> msgs;
+static unsigned long dupChatLines = 0;
+static unsigned long typeFrames[17]; // version 2 frames sent by type, [16] legacy ones
+static unsigned long sfFrames[13]; // frames sent by spreading factor
+static double sfAirtime[13];       // ... their time on air, s
+
+static const char *corpus[] = {
+  "hello world", "test...", "CQ CQ anyone on?", "Greetings from the hill",
+  "Whazzup??", "LoRa!", "meet at the bridge at 5", "battery low, going quiet",
+  "Hack the planet!", "The sky is the limit", "is the pass open today?",
+  "Hi!", "signal is good here", "XPLORA 1.0 test", "copy that",
+};
+
+// ------------------------------------------------------------------ random
+
+static uint64_t splitmix(uint64_t &s)
+{
+  uint64_t z = (s += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+uint32_t simRand32(uint64_t &state)
+{
+  return (uint32_t)(splitmix(state) >> 32);
+}
+
+static double uniform(uint64_t &s)
+{
+  return (splitmix(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian(uint64_t &s)
+{
+  double u = uniform(s), v = uniform(s);
+  return sqrt(-2.0 * log(u + 1e-300)) * cos(2 * M_PI * v);
+}
+
+// ------------------------------------------------------------- scheduler
+
+static bool before(SimNode *a, SimNode *b)
+{
+  return a->wake < b->wake || (a->wake == b->wake && a->id < b->id);
+}
+
+static void heapSwap(int i, int j)
+{
+  std::swap(heap[i], heap[j]);
+  heap[i]->heapPos = i;
+  heap[j]->heapPos = j;
+}
+
+static void siftUp(int i)
+{
+  while (i > 0 && before(heap[i], heap[(i - 1) / 2])) {
+    heapSwap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void siftDown(int i)
+{
+  int n = (int)heap.size();
+  for (;;) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    if (l < n && before(heap[l], heap[m])) m = l;
+    if (r < n && before(heap[r], heap[m])) m = r;
+    if (m == i) return;
+    heapSwap(i, m);
+    i = m;
+  }
+}
+
+static void heapPush(SimNode *n)
+{
+  n->heapPos = (int)heap.size();
+  heap.push_back(n);
+  siftUp(n->heapPos);
+}
+
+static SimNode *heapPop()
+{
+  SimNode *top = heap[0];
+  heapSwap(0, (int)heap.size() - 1);
+  heap.pop_back();
+  top->heapPos = -1;
+  if (!heap.empty()) siftDown(0);
+  return top;
+}
+
+void simWakeAt(SimNode *n, int64_t t)
+{
+  if (n->irqTask) n = n->irqTask;
+  if (t < simNow) t = simNow;
+  if (n->heapPos < 0) {
+    if (t < n->irqWake) n->irqWake = t;
+    return;
+  }
+  if (t < n->wake) {
+    n->wake = t;
+    siftUp(n->heapPos);
+  }
+}
+
+void simSleep(int64_t us)
+{
+  SimNode *n = simCurrent, *t = simTask;
+  int64_t until = simNow + us;
+  for (;;) {
+    bool irqsOk = t == (n->irqTask ? n->irqTask : n) && !n->radioCall && !n->inIrq;
+    int64_t w = until;
+    if (irqsOk) w = std::min(w, std::max(t->irqWake, n->flash.busyUntil)); // none while the flash cache is off
+    if (t != n->flash.busyTask && w < n->flash.busyUntil) w = n->flash.busyUntil; // nor other tasks
+    if (w < simNow) w = simNow;
+    t->wake = w;
+    swapcontext(&t->ctx, &schedCtx);
+    if (t != n->flash.busyTask && simNow < n->flash.busyUntil) continue;
+    if (irqsOk && simNow >= n->flash.busyUntil && (n->radio.onReceive || n->radio.onTxDone || n->radio.onCadDone)) {
+      t->irqWake = LLONG_MAX;
+      radioAdvance(n, simNow);
+      if (!n->radio.irqs.empty() && n->radio.irqs.front().t + 1000 < simNow) {
+        n->stats.irqsLate++;
+        n->stats.irqLateMax = std::max(n->stats.irqLateMax, (simNow - n->radio.irqs.front().t) / 1e6);
+      }
+      radioDeliverIrqs(n);
+    }
+    if (simNow >= until) break;
+  }
+}
+
+// for a task that waits for a notification: it's not the one the interrupts run in
+void simWait(int64_t us)
+{
+  SimNode *n = simCurrent;
+  simTask->wake = simNow + us;
+  swapcontext(&simTask->ctx, &schedCtx);
+  while (simTask != n->flash.busyTask && simNow < n->flash.busyUntil) { // the flash cache is off
+    simTask->wake = n->flash.busyUntil;
+    swapcontext(&simTask->ctx, &schedCtx);
+  }
+}
+
+static void nodeMain()
+{
+  SimNode *n = simCurrent;
+  n->setup();
+  n->booted = true;
+  for (;;) n->loop();
+}
+
+static void taskMain()
+{
+  simTask->taskFn(simTask->taskArg);
+  for (;;) simSleep(1000000000); // a FreeRTOS task must not return, park it if it does
+}
+
+static const size_t stackSize = 256 * 1024;
+
+static void makeStack(SimNode *n, void (*entry)())
+{
+  n->stack = (char *)mmap(0, stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  getcontext(&n->ctx);
+  n->ctx.uc_stack.ss_sp = n->stack;
+  n->ctx.uc_stack.ss_size = stackSize;
+  n->ctx.uc_link = 0;
+  makecontext(&n->ctx, entry, 0);
+}
+
+SimNode *simTaskCreate(void (*fn)(void *), void *arg)
+{
+  SimNode *n = simCurrent, *t = new SimNode();
+  t->id = n->id;
+  t->owner = n;
+  t->taskFn = fn;
+  t->taskArg = arg;
+  t->wake = simNow;
+  t->irqWake = LLONG_MAX;
+  makeStack(t, taskMain);
+  heapPush(t);
+  return t;
+}
+
+// --------------------------------------------------------------- traffic
+
+// With --gateway node 0 runs the way a board attached to a PC runs: in serial modem mode
+// (ser_kiss=1), all speaks and yells go in over its serial port as KISS text frames, no faster
+// than the status frames it sends back allow, and the frames it streams to the host are counted.
+static struct {
+  int free = 0;      // free transmit queue slots the last status told
+  unsigned got = 0;  // frames from us the last status counted
+  unsigned sent = 0; // frames we wrote to the serial port
+  unsigned long statuses = 0, streamed = 0, bad = 0, held = 0;
+  int lastHeld = -1;
+  std::string in; // frame being read, unescaped
+  bool inFrame = false, esc = false;
+} gw;
+
+static uint16_t crc16(uint16_t crc, const uint8_t *b, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)b[i] << 8;
+    for (int k = 0; k < 8; k++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static std::string kissFrame(int cmd, const std::string &data)
+{
+  std::string raw(1, (char)cmd), out(1, (char)0xC0);
+  raw += data;
+  uint16_t crc = crc16(0xFFFF, (const uint8_t *)raw.data(), raw.size());
+  raw += (char)(crc >> 8);
+  raw += (char)(crc & 255);
+  for (char c : raw) {
+    if ((uint8_t)c == 0xC0) out += "\xDB\xDC";
+    else if ((uint8_t)c == 0xDB) out += "\xDB\xDD";
+    else out += c;
+  }
+  return out + (char)0xC0;
+}
+
+// takes apart what the gateway node wrote to its serial port so far
+static void gatewayRead(SimNode *n)
+{
+  for (char ch : n->serialOut) {
+    uint8_t c = (uint8_t)ch;
+    if (c == 0xC0) {
+      const uint8_t *d = (const uint8_t *)gw.in.data();
+      size_t len = gw.in.size();
+      if (gw.inFrame && len >= 3) {
+        if (crc16(0xFFFF, d, len - 2) != (d[len - 2] << 8 | d[len - 1])) gw.bad++;
+        else if (d[0] == 0x00) gw.streamed++;
+        else if (d[0] == 0x0E && len >= 10) {
+          gw.statuses++;
+          gw.free = d[3];
+          gw.got = d[4] << 8 | d[5];
+        }
+      }
+      gw.in.clear();
+      gw.inFrame = true;
+      gw.esc = false;
+      continue;
+    }
+    if (!gw.inFrame) continue; // text from before modem mode
+    if (gw.esc) c = c == 0xDC ? 0xC0 : c == 0xDD ? 0xDB : c;
+    else if (c == 0xDB) { gw.esc = true; continue; }
+    gw.esc = false;
+    gw.in += (char)c;
+  }
+  n->serialOut.clear();
+}
+
+void simInjectDue(SimNode *n)
+{
+  static bool injecting = false;
+  if (!n->booted || n->radioCall || n->inIrq || injecting || simTask != n) return; // (the sketch's loop() only)
+  if (n->serialRaw) gatewayRead(n);
+  while (n->nextInject < n->injects.size()) {
+    Message &m = msgs[n->injects[n->nextInject]];
+    if (m.due > simNow) break;
+    if (n->serialRaw && m.type != 2) {
+      if (gw.free - (int)((gw.sent - gw.got) & 0xFFFF) <= 0) { // no room, wait for the next status
+        if (gw.lastHeld != m.id) gw.held++;
+        gw.lastHeld = m.id;
+        break;
+      }
+      n->nextInject++;
+      m.sent = simNow;
+      n->serialIn += kissFrame(0x01, std::string(1, (char)m.type) + m.text);
+      gw.sent++;
+      continue;
+    }
+    n->nextInject++;
+    m.sent = simNow;
+    injecting = true;
+    if (m.type == 2) n->sendTo(*(uint16_t *)dlsym(simNodes[m.dest]->lib, "my_addr"), String(m.text.c_str()));
+    else n->send(m.type, String(m.text.c_str()));
+    injecting = false;
+  }
+}
+
+static int findTag(const char *s)
+{
+  const char *p = strchr(s, '#');
+  while (p) {
+    int v = 0, k;
+    for (k = 1; k <= 6 && p[k] >= '0' && p[k] <= '9'; k++) v = v * 10 + (p[k] - '0');
+    if (k == 7) return v;
+    p = strchr(p + 1, '#');
+  }
+  return -1;
+}
+
+void simOnChat(const char *line)
+{
+  int tag = findTag(line);
+  if (tag < 0 || tag >= (int)msgs.size()) return;
+  Message &m = msgs[tag];
+  SimNode *n = simCurrent;
+  if (n->id == m.origin) return;
+  if (m.seen[n->id] < 0) m.seen[n->id] = simNow;
+  else dupChatLines++;
+}
+
+// the sketch's display timing hook (oled_onframe): a frame is on the display now, is it in the panel RAM?
+static std::vector<double> frameLatency; // ms
+static void simOnFrame(const uint8_t *frame, unsigned long latency)
+{
+  SimNode *n = simCurrent;
+  n->stats.panelFrames++;
+  if (memcmp(frame, n->panel.ram, sizeof(n->panel.ram)) != 0) n->stats.panelWrong++;
+  frameLatency.push_back(latency / 1e3);
+}
+
+void simOnTx(SimNode *n, const SimFrame &f)
+{
+  sfFrames[f.sf]++;
+  sfAirtime[f.sf] += (f.end - f.start) / 1e6;
+  if (f.len > 1 && f.data[0] == 0xB6) typeFrames[f.data[1] & 15]++;
+  else if (f.len > 3 && !memcmp(f.data, "XPL", 3)) typeFrames[16]++;
+  if (f.tag < 0 || f.tag >= (int)msgs.size()) return;
+  msgs[f.tag].tx[n->id]++;
+}
+
+void simOnRx(SimNode *n, const SimFrame &f)
+{
+  if (f.tag < 0 || f.tag >= (int)msgs.size()) return;
+  Message &m = msgs[f.tag];
+  if (n->id == m.origin || m.seen[n->id] >= 0) m.redundant++;
+}
+
+// a counter the sketch keeps in a global, 0 if this build of the sketch has no such thing
+template <typename T> static T nodeCounter(SimNode *n, const char *sym)
+{
+  T *p = (T *)dlsym(n->lib, sym);
+  return p ? *p : 0;
+}
+
+// ----------------------------------------------------------------- setup
+
+static double pathLoss(int a, int b)
+{
+  const SimNode *p = simNodes[a], *q = simNodes[b];
+  double d = std::max(hypot(p->x - q->x, p->y - q->y), 10.0);
+  double pl = sc.pl0 + 10 * sc.exponent * log10(d / 1000.0);
+  if (sc.shadowing > 0) {
+    uint64_t s = sc.seed * 0x100000001b3ull ^ ((uint64_t)std::min(a, b) << 32 | std::max(a, b));
+    pl += sc.shadowing * gaussian(s);
+  }
+  return pl;
+}
+
+// every node gets its own copy of the sketch, loaded from an anonymous file
+// so the dynamic loader doesn't recognize it as already loaded. The file
+// stays open: the loader also matches by path, and a closed descriptor's
+// /proc/self/fd/N would come back for the next node.
+static void *loadNodeLib(const std::vector<char> &image, int id)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "xplora_node_%d", id);
+  int fd = memfd_create(name, 0);
+  if (fd < 0 || write(fd, image.data(), image.size()) != (ssize_t)image.size()) {
+    perror("memfd");
+    exit(1);
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!lib) {
+    fprintf(stderr, "dlopen: %s\n", dlerror());
+    exit(1);
+  }
+  return lib;
+}
+
+static void *need(void *lib, const char *sym)
+{
+  void *p = dlsym(lib, sym);
+  if (!p) {
+    fprintf(stderr, "node library lacks %s\n", sym);
+    exit(1);
+  }
+  return p;
+}
+
+static void createNodes()
+{
+  uint64_t rng = sc.seed;
+  double side = sqrt(sc.area) * 1000.0;
+  for (int i = 0; i < sc.nodes; i++) {
+    SimNode *n = new SimNode();
+    n->id = i;
+    n->x = uniform(rng) * side;
+    n->y = uniform(rng) * side;
+    n->mac = splitmix(rng) & 0xFFFFFFFFFFFFull;
+    n->rng = splitmix(rng);
+    n->bootT = (int64_t)(uniform(rng) * sc.bootSpread * 1e6);
+    n->wake = n->bootT;
+    n->irqWake = LLONG_MAX;
+    simNodes.push_back(n);
+  }
+
+  // anything above the weakest sensitivity minus the capture margin may matter
+  double floor = radioSensitivity(12, 125000) - simCaptureDb;
+  for (int i = 0; i < sc.nodes; i++) {
+    for (int j = 0; j < sc.nodes; j++) {
+      if (i == j) continue;
+      double pl = pathLoss(i, j);
+      if (sc.txPower - pl < floor) continue;
+      simNodes[i]->neighbors.push_back(j);
+      simNodes[i]->neighborLoss.push_back((float)pl);
+    }
+  }
+
+  FILE *f = fopen(sc.lib.c_str(), "rb");
+  if (!f) {
+    perror(sc.lib.c_str());
+    exit(1);
+  }
+  std::vector<char> image;
+  char buf[65536];
+  size_t k;
+  while ((k = fread(buf, 1, sizeof(buf), f)) > 0) image.insert(image.end(), buf, buf + k);
+  fclose(f);
+
+  for (int i = 0; i < sc.nodes; i++) {
+    SimNode *n = simNodes[i];
+    n->lib = loadNodeLib(image, i);
+    n->setup = (void (*)())need(n->lib, "_Z5setupv");
+    n->loop = (void (*)())need(n->lib, "_Z4loopv");
+    n->send = (void (*)(int, String))need(n->lib, "_Z10myLoraSendi6String");
+    if (sc.directs) n->sendTo = (void (*)(uint16_t, String))need(n->lib, "_Z12myLoraSendTot6String");
+    *(int *)need(n->lib, "lora_sf") = sc.sf;
+    if (uniform(rng) < sc.beaconFraction) *(int *)need(n->lib, "is_beaconsender") = 1;
+    if (uniform(rng) < sc.legacyFraction) *(int *)need(n->lib, "pck_legacy") = 1;
+    if (sc.gateway && i == 0) {
+      *(int *)need(n->lib, "ser_kiss") = 1;
+      n->serialRaw = true;
+    }
+    for (const auto &g : sc.globals) *(int *)need(n->lib, g.first.c_str()) = g.second;
+    void **hook = (void **)dlsym(n->lib, "oled_onframe");
+    if (hook) *hook = (void *)simOnFrame;
+    makeStack(n, nodeMain);
+    heapPush(n);
+  }
+}
+
+// nodes reachable from each origin over links that work at the base rate
+static std::vector<int> components()
+{
+  std::vector<int> comp(sc.nodes, -1);
+  double sens = radioSensitivity(sc.sf, 125000);
+  int c = 0;
+  for (int s = 0; s < sc.nodes; s++) {
+    if (comp[s] >= 0) continue;
+    std::vector<int> todo(1, s);
+    comp[s] = c;
+    while (!todo.empty()) {
+      int a = todo.back();
+      todo.pop_back();
+      SimNode *n = simNodes[a];
+      for (size_t i = 0; i < n->neighbors.size(); i++) {
+        int b = n->neighbors[i];
+        if (comp[b] < 0 && sc.txPower - n->neighborLoss[i] >= sens) {
+          comp[b] = c;
+          todo.push_back(b);
+        }
+      }
+    }
+    c++;
+  }
+  return comp;
+}
+
+static void createTraffic(const std::vector<int> &comp)
+{
+  uint64_t rng = sc.seed ^ 0x5EED;
+  double sens = radioSensitivity(sc.sf, 125000);
+  std::vector<int> compSize(sc.nodes, 0);
+  for (int i = 0; i < sc.nodes; i++) compSize[comp[i]]++;
+  double start = sc.bootSpread + 10, stop = sc.duration - sc.drain;
+  int total = sc.yells + sc.speaks + sc.directs;
+  std::vector<int> order;
+  std::vector<std::pair<int, int>> pairs;
+  for (int i = 0; i < sc.pairs && sc.nodes > 1; i++) {
+    int a = (int)(uniform(rng) * sc.nodes), b = (int)(uniform(rng) * (sc.nodes - 1));
+    pairs.push_back({a, b >= a ? b + 1 : b});
+  }
+  for (int i = 0; i < total; i++) {
+    Message m;
+    m.id = i;
+    m.type = i < sc.yells ? 1 : i < sc.yells + sc.speaks ? 0 : 2;
+    m.origin = (int)(uniform(rng) * sc.nodes);
+    if (sc.gateway && m.type != 2) m.origin = 0;
+    m.dest = -1;
+    if (m.type == 2 && !pairs.empty()) {
+      const std::pair<int, int> &p = pairs[(size_t)(uniform(rng) * pairs.size())];
+      bool back = uniform(rng) < 0.5;
+      m.origin = back ? p.second : p.first;
+      m.dest = back ? p.first : p.second;
+    } else if (m.type == 2 && sc.nodes > 1) {
+      m.dest = (int)(uniform(rng) * (sc.nodes - 1));
+      if (m.dest >= m.origin) m.dest++;
+    }
+    m.due = (int64_t)((start + uniform(rng) * std::max(stop - start, 0.0)) * 1e6);
+    m.sent = -1;
+    m.redundant = 0;
+    char tag[16];
+    snprintf(tag, sizeof(tag), " #%06d", i);
+    m.text = corpus[splitmix(rng) % (sizeof(corpus) / sizeof(corpus[0]))];
+    while (m.type == 2 && (int)m.text.size() + 8 < sc.dmLength)
+      m.text += std::string(" ") + corpus[splitmix(rng) % (sizeof(corpus) / sizeof(corpus[0]))];
+    m.text += tag;
+    m.seen.assign(sc.nodes, -1);
+    m.tx.assign(sc.nodes, 0);
+    if (m.type == 1) {
+      m.reachable = compSize[comp[m.origin]] - 1;
+    } else if (m.type == 2) {
+      m.reachable = comp[m.dest] == comp[m.origin];
+    } else {
+      SimNode *o = simNodes[m.origin];
+      m.reachable = 0;
+      for (size_t k = 0; k < o->neighbors.size(); k++)
+        if (sc.txPower - o->neighborLoss[k] >= sens) m.reachable++;
+    }
+    msgs.push_back(m);
+  }
+  for (int i = 0; i < total; i++) order.push_back(i);
+  std::sort(order.begin(), order.end(), [](int a, int b) { return msgs[a].due < msgs[b].due; });
+  for (int i : order) simNodes[msgs[i].origin]->injects.push_back(i);
+}
+
+// ---------------------------------------------------------------- report
+
+static double pct(std::vector<double> &v, double p)
+{
+  if (v.empty()) return 0;
+  size_t i = (size_t)std::min((double)v.size() - 1, floor(p / 100.0 * v.size()));
+  return v[i];
+}
+
+static void report(const std::vector<int> &comp, double wall)
+{
+  double side = sqrt(sc.area);
+  std::vector<int> compSize(sc.nodes, 0);
+  int largest = 0;
+  double degree = 0, sens = radioSensitivity(sc.sf, 125000);
+  for (int i = 0; i < sc.nodes; i++) largest = std::max(largest, ++compSize[comp[i]]);
+  for (SimNode *n : simNodes)
+    for (float l : n->neighborLoss)
+      if (sc.txPower - l >= sens) degree++;
+  degree /= sc.nodes;
+
+  printf("XPLORA mesh simulator: %d nodes on %.1f x %.1f km, SF%d/125 kHz, %d dBm, %.0f s, seed %llu\n",
+         sc.nodes, side, side, sc.sf, sc.txPower, sc.duration, (unsigned long long)sc.seed);
+  printf("connectivity    mean degree %.1f, largest component %.1f%% of nodes\n", degree,
+         100.0 * largest / sc.nodes);
+
+  for (int type = 2; type >= 0; type--) {
+    long want = 0, reach = 0, got = 0, frames = 0, dup = 0, redundant = 0, n = 0;
+    std::vector<double> lat;
+    for (Message &m : msgs) {
+      if (m.type != type || m.sent < 0) continue;
+      n++;
+      want += type == 2 ? 1 : sc.nodes - 1;
+      reach += m.reachable;
+      redundant += m.redundant;
+      for (int i = 0; i < sc.nodes; i++) {
+        if (m.seen[i] >= 0) {
+          got++;
+          lat.push_back((m.seen[i] - m.sent) / 1000.0);
+        }
+        frames += m.tx[i];
+        if (m.tx[i] > 1) dup += m.tx[i] - 1;
+      }
+    }
+    if (!n) continue;
+    std::sort(lat.begin(), lat.end());
+    const char *name = type == 2 ? "direct" : type ? "yell" : "speak";
+    printf("%-6s x%-8ld delivered %.1f%% of reachable, %.1f%% of all %s\n", name, n, reach ? 100.0 * got / reach : 0.0,
+           100.0 * got / want, type == 2 ? "messages" : "nodes");
+    printf("                latency ms p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n", pct(lat, 50), pct(lat, 90),
+           pct(lat, 99), lat.empty() ? 0.0 : lat.back());
+    printf("                %.1f frames per message, %ld duplicate rebroadcasts, %.1f redundant receptions per message\n",
+           (double)frames / n, dup, (double)redundant / n);
+  }
+
+  SimStats t;
+  double nodeTime = 0;
+  for (SimNode *n : simNodes) {
+    t.txFrames += n->stats.txFrames;
+    t.airtime += n->stats.airtime;
+    t.rxFrames += n->stats.rxFrames;
+    for (int k = 0; k < LOSS_REASONS; k++) t.lost[k] += n->stats.lost[k];
+    t.i2cBytes += n->stats.i2cBytes;
+    t.i2cTime += n->stats.i2cTime;
+    t.cads += n->stats.cads;
+    t.cadBusy += n->stats.cadBusy;
+    t.flashBytes += n->stats.flashBytes;
+    t.flashErases += n->stats.flashErases;
+    t.flashTime += n->stats.flashTime;
+    t.irqsLate += n->stats.irqsLate;
+    t.irqLateMax = std::max(t.irqLateMax, n->stats.irqLateMax);
+    t.panelFrames += n->stats.panelFrames;
+    t.panelWrong += n->stats.panelWrong;
+    nodeTime += sc.duration - n->bootT / 1e6;
+  }
+  unsigned long jobs = 0, refused = 0, suppressed = 0, lateSum = 0, lateMax = 0;
+  int depth = 0;
+  for (SimNode *n : simNodes) {
+    jobs += nodeCounter<unsigned long>(n, "pck_job_sent");
+    refused += nodeCounter<unsigned long>(n, "pck_job_overflows");
+    suppressed += nodeCounter<unsigned long>(n, "pck_job_suppressed");
+    lateSum += nodeCounter<unsigned long>(n, "pck_job_late_sum");
+    lateMax = std::max(lateMax, nodeCounter<unsigned long>(n, "pck_job_late_max"));
+    depth = std::max(depth, nodeCounter<int>(n, "pck_job_maxdepth"));
+  }
+  unsigned long txRefused = 0, dcWaits = 0, dcWaitT = 0, dcMax = 0;
+  int queuedMax = 0;
+  for (SimNode *n : simNodes) {
+    txRefused += nodeCounter<unsigned long>(n, "tx_overflows");
+    dcWaits += nodeCounter<unsigned long>(n, "tx_dc_waits");
+    dcWaitT += nodeCounter<unsigned long>(n, "tx_dc_waitT");
+    dcMax = std::max(dcMax, nodeCounter<unsigned long>(n, "tx_dc_max"));
+    queuedMax = std::max(queuedMax, nodeCounter<int>(n, "tx_queued_bytes_max"));
+  }
+  printf("chat            %lu duplicate lines shown\n", dupChatLines);
+  printf("frames by type  speak %lu, yell %lu, direct %lu, route request %lu, route reply %lu, ack %lu, legacy %lu\n",
+         typeFrames[0], typeFrames[1], typeFrames[2], typeFrames[3], typeFrames[4], typeFrames[5], typeFrames[16]);
+  unsigned long rreq = 0, rrep = 0, fwd = 0, dropped = 0, givenUp = 0, flooded = 0;
+  for (SimNode *n : simNodes) {
+    rreq += nodeCounter<unsigned long>(n, "rt_rreq_sent");
+    rrep += nodeCounter<unsigned long>(n, "rt_rrep_sent");
+    fwd += nodeCounter<unsigned long>(n, "rt_forwarded");
+    dropped += nodeCounter<unsigned long>(n, "rt_dropped");
+    givenUp += nodeCounter<unsigned long>(n, "rt_given_up");
+    flooded += nodeCounter<unsigned long>(n, "rt_flooded");
+  }
+  if (rreq + fwd + dropped + flooded)
+    printf("routing         %lu route requests, %lu replies, %lu fragments flooded for want of a route, %lu frames "
+           "passed on, %lu dropped without route, %lu messages given up\n", rreq, rrep, flooded, fwd, dropped, givenUp);
+  unsigned long dmSent = 0, dmOk = 0, dmFailed = 0, dmFrags = 0, dmResent = 0, dmAcks = 0, dmCarried = 0, dmBad = 0;
+  for (SimNode *n : simNodes) {
+    dmSent += nodeCounter<unsigned long>(n, "dm_sent");
+    dmOk += nodeCounter<unsigned long>(n, "dm_delivered");
+    dmFailed += nodeCounter<unsigned long>(n, "dm_failed");
+    dmFrags += nodeCounter<unsigned long>(n, "dm_frags");
+    dmResent += nodeCounter<unsigned long>(n, "dm_resent");
+    dmAcks += nodeCounter<unsigned long>(n, "dm_acks");
+    dmCarried += nodeCounter<unsigned long>(n, "dm_acks_carried");
+    dmBad += nodeCounter<unsigned long>(n, "dm_undecoded");
+  }
+  if (dmSent)
+    printf("delivery        %lu of %lu direct messages acknowledged, %lu failed; %lu fragments sent (%lu again), "
+           "%lu ack frames, %lu acks carried along, %lu received that didn't decode\n", dmOk, dmSent, dmFailed, dmFrags,
+           dmResent, dmAcks, dmCarried, dmBad);
+  unsigned long rates = 0, fast = 0, windows = 0;
+  long saved = 0;
+  for (SimNode *n : simNodes) {
+    rates += nodeCounter<unsigned long>(n, "adr_rates");
+    fast += nodeCounter<unsigned long>(n, "adr_fast");
+    windows += nodeCounter<unsigned long>(n, "adr_windows");
+    saved += nodeCounter<long>(n, "adr_saved");
+  }
+  printf("spreading       frames (s on air) by SF");
+  for (int k = 6; k <= 12; k++)
+    if (sfFrames[k]) printf(" %d:%lu (%.1f)", k, sfFrames[k], sfAirtime[k]);
+  printf("\n");
+  if (rates + fast)
+    printf("adaptive rate   %lu frames sent faster than the base rate after %lu rate frames, %lu windows listened in, "
+           "%.1f s on air saved\n", fast, rates, windows, saved / 1000.0);
+  unsigned long lbtDeferred = 0, lbtForced = 0, lbtWaitT = 0, lbtLoud = 0;
+  for (SimNode *n : simNodes) {
+    lbtLoud += nodeCounter<unsigned long>(n, "lbt_loud");
+    lbtDeferred += nodeCounter<unsigned long>(n, "lbt_deferred");
+    lbtForced += nodeCounter<unsigned long>(n, "lbt_forced");
+    lbtWaitT += nodeCounter<unsigned long>(n, "lbt_waitT");
+  }
+  if (t.cads + lbtLoud)
+    printf("listen first    %lu CADs, %lu found the channel busy, %lu more busy by RSSI, %lu frames deferred, "
+           "%lu sent anyway, %.1f s spent listening and backing off\n", t.cads, t.cadBusy, lbtLoud, lbtDeferred,
+           lbtForced, lbtWaitT / 1000.0);
+  if (sc.gateway) {
+    double wait = 0;
+    for (const Message &m : msgs)
+      if (m.origin == 0 && m.type != 2 && m.sent >= 0) wait += (m.sent - m.due) / 1e3;
+    printf("gateway         %u messages in over serial, %lu waited for room (mean wait %.0f ms), %lu refused, "
+           "%lu bad; %lu frames streamed to the host, %lu status frames\n", gw.sent, gw.held,
+           gw.sent ? wait / gw.sent : 0.0, nodeCounter<unsigned long>(simNodes[0], "ser_refused"),
+           gw.bad + nodeCounter<unsigned long>(simNodes[0], "ser_bad"), gw.streamed, gw.statuses);
+    printf("                %lu frames for the host dropped, the serial port was busy; %.0f ms spent waiting for it\n",
+           nodeCounter<unsigned long>(simNodes[0], "ser_dropped"), simNodes[0]->stats.serialWait * 1e3);
+  }
+  unsigned long nbEntries = 0, nbEvicted = 0, nbGot = 0, nbLost = 0;
+  for (SimNode *n : simNodes) {
+    const int entries = 16 * 8; // nb_sets*nb_ways
+    unsigned long *T = (unsigned long *)dlsym(n->lib, "nb_T");
+    uint8_t *got = (uint8_t *)dlsym(n->lib, "nb_got");
+    uint8_t *lost = (uint8_t *)dlsym(n->lib, "nb_lost");
+    for (int k = 0; T && got && lost && k < entries; k++) {
+      if (!T[k]) continue;
+      nbEntries++;
+      nbGot += got[k];
+      nbLost += lost[k];
+    }
+    nbEvicted += nodeCounter<unsigned long>(n, "nb_evicted");
+  }
+  if (nbEntries)
+    printf("neighbours      %.1f per node in the table, %lu evicted while fresh, %.1f%% of their own frames "
+           "missed (estimated)\n", (double)nbEntries / simNodes.size(), nbEvicted,
+           nbGot + nbLost ? 100.0 * nbLost / (nbGot + nbLost) : 0.0);
+  unsigned long hops[16] = {0}, hopsAll = 0, hopsSum = 0, expired = 0;
+  int hopsTop = 0;
+  for (SimNode *n : simNodes) {
+    unsigned long *h = (unsigned long *)dlsym(n->lib, "pck_hops_heard");
+    for (int k = 0; h && k < 16; k++) hops[k] += h[k];
+    expired += nodeCounter<unsigned long>(n, "pck_ttl_expired");
+  }
+  for (int k = 0; k < 16; k++) {
+    hopsAll += hops[k];
+    hopsSum += k * hops[k];
+    if (hops[k]) hopsTop = k;
+  }
+  if (hopsAll) {
+    printf("hops            messages shown after hops");
+    for (int k = 0; k <= hopsTop; k++) printf(" %d:%.0f%%", k, 100.0 * hops[k] / hopsAll);
+    printf(", mean %.1f, %lu not re-broadcast for TTL\n", (double)hopsSum / hopsAll, expired);
+  }
+  printf("rebroadcasts    %lu sent, %lu suppressed, %lu refused, queue depth max %d, sent late by mean %.1f ms, max %lu ms\n",
+         jobs, suppressed, refused, depth, jobs ? (double)lateSum / jobs : 0.0, lateMax);
+  printf("tx queue        %d bytes queued max, %lu refused, %lu waits for duty cycle budget (mean %.0f ms), "
+         "most airtime in an hour %.1f s\n", queuedMax, txRefused, dcWaits, dcWaits ? (double)dcWaitT / dcWaits : 0.0,
+         dcMax / 1000.0);
+  printf("airtime         %lu frames, %.1f s on air, %.2f%% mean duty cycle per node\n", t.txFrames, t.airtime,
+         100.0 * t.airtime / nodeTime);
+  printf("radio           %lu frames received; lost: %lu collision, %lu half-duplex, %lu rx not armed, %lu overrun\n",
+         t.rxFrames, t.lost[LOSS_COLLISION], t.lost[LOSS_HALFDUPLEX], t.lost[LOSS_UNSERVICED], t.lost[LOSS_OVERRUN]);
+  unsigned long ringDropped = 0;
+  for (SimNode *n : simNodes) ringDropped += nodeCounter<unsigned long>(n, "rx_ring_overflows");
+  printf("                %lu radio interrupts served more than 1 ms late, at most %.1f ms; %lu frames not fetched "
+         "in time or dropped by a full rx ring\n", t.irqsLate, t.irqLateMax * 1e3, ringDropped);
+  const char *taskName[4] = {"radio", "input", "ui", "house"};
+  unsigned long taskRuns[4] = {0}, taskLateMax[4] = {0};
+  double taskUs[4] = {0}, taskLate[4] = {0};
+  unsigned long taskUsMax[4] = {0};
+  for (SimNode *n : simNodes) {
+    unsigned long *runs = (unsigned long *)dlsym(n->lib, "task_runs");
+    unsigned long *us = (unsigned long *)dlsym(n->lib, "task_us");
+    unsigned long *usMax = (unsigned long *)dlsym(n->lib, "task_us_max");
+    unsigned long *late = (unsigned long *)dlsym(n->lib, "task_late_sum");
+    unsigned long *lateMax = (unsigned long *)dlsym(n->lib, "task_late_max");
+    for (int k = 0; runs && us && usMax && late && lateMax && k < 4; k++) {
+      taskRuns[k] += runs[k];
+      taskUs[k] += us[k];
+      taskUsMax[k] = std::max(taskUsMax[k], usMax[k]);
+      taskLate[k] += late[k];
+      taskLateMax[k] = std::max(taskLateMax[k], lateMax[k]);
+    }
+  }
+  if (taskRuns[0]) {
+    printf("tasks           time used (longest run, started late by at most)");
+    for (int k = 0; k < 4; k++)
+      if (taskRuns[k])
+        printf("%s %s %.1f%% (%.1f ms, %lu ms)", k ? "," : ":", taskName[k], taskUs[k] / 1e4 / nodeTime,
+               taskUsMax[k] / 1e3, taskLateMax[k]);
+    printf("\n                radio task started late by mean %.2f ms\n", taskLate[0] / taskRuns[0]);
+  }
+  unsigned long logged = 0, rotations = 0, aheads = 0;
+  for (SimNode *n : simNodes) {
+    logged += nodeCounter<unsigned long>(n, "log_appends");
+    rotations += nodeCounter<unsigned long>(n, "log_rotations");
+    aheads += nodeCounter<unsigned long>(n, "log_aheads");
+  }
+  printf("chat log        %lu lines into flash, %.1f KB written, %lu sector erases, %.2f%% of node time waiting for it\n",
+         logged, t.flashBytes / 1024.0, t.flashErases, 100.0 * t.flashTime / nodeTime);
+  printf("                %lu sectors started, %lu of them erased ahead while the radio was idle\n", rotations, aheads);
+  unsigned long frames = 0, flushes = 0, sent = 0, frameUs = 0, frameUsMax = 0, drawn = 0, skipped = 0;
+  unsigned long stripHits = 0, stripMakes = 0;
+  for (SimNode *n : simNodes) {
+    stripHits += nodeCounter<unsigned long>(n, "strip_hits");
+    stripMakes += nodeCounter<unsigned long>(n, "strip_makes");
+    drawn += nodeCounter<unsigned long>(n, "ui_frames");
+    skipped += nodeCounter<unsigned long>(n, "ui_skips");
+    frames += nodeCounter<unsigned long>(n, "oled_frames");
+    flushes += nodeCounter<unsigned long>(n, "oled_flushes");
+    sent += nodeCounter<unsigned long>(n, "oled_sent");
+    frameUs += nodeCounter<unsigned long>(n, "oled_us");
+    frameUsMax = std::max(frameUsMax, nodeCounter<unsigned long>(n, "oled_us_max"));
+  }
+  printf("display         %.1f KB/s over I2C per node, %.1f%% of node time in display transfers\n",
+         t.i2cBytes / 1024.0 / nodeTime, 100.0 * t.i2cTime / nodeTime);
+  if (drawn + skipped)
+    printf("                ui task drew %.1f frames/s per node, skipped %.1f/s with nothing new to show\n",
+           drawn / nodeTime, skipped / nodeTime);
+  if (stripHits + stripMakes)
+    printf("                chat lines drawn from their strip %.1f%% of the time, %.2f rasterized per node and s\n",
+           100.0 * stripHits / (stripHits + stripMakes), stripMakes / nodeTime);
+  if (sent) {
+    printf("                %.1f frames/s per node, %.0f%% with changes: %.0f bytes and %.2f ms on the bus each\n",
+           frames / nodeTime, 100.0 * sent / frames, t.i2cBytes / (double)sent, t.i2cTime * 1e3 / sent);
+    printf("                the app waited %.2f ms per frame to hand it over (at most %.1f ms)\n", frameUs / 1e3 / frames,
+           frameUsMax / 1e3);
+  }
+  if (!frameLatency.empty()) {
+    std::sort(frameLatency.begin(), frameLatency.end());
+    printf("                on the display after p50 %.1f ms, p99 %.1f ms, max %.1f ms, %.1f%% overtaken by a newer frame\n",
+           pct(frameLatency, 50), pct(frameLatency, 99), frameLatency.back(), 100.0 * (frames - flushes) / frames);
+    printf("panel           %lu frames checked against the display RAM, %lu wrong\n", t.panelFrames, t.panelWrong);
+  }
+  printf("host            %.1f s wall clock, %.1f x real time\n", wall, sc.duration / wall);
+}
+
+// ------------------------------------------------------------------ main
+
+static void usage()
+{
+  printf("usage: xplorasim [options]\n"
+         "  --nodes N          virtual boards (200)\n"
+         "  --area KM2         square area in km^2 (3500)\n"
+         "  --duration S       simulated seconds (600)\n"
+         "  --yells N          yell messages injected at random nodes (40)\n"
+         "  --speaks N         speak messages (0)\n"
+         "  --directs N        direct messages from random nodes to random others (0)\n"
+         "  --pairs N          ... between N random node pairs instead, both ways (0)\n"
+         "  --dmlen N          pad direct messages with more chat lines to N bytes (0)\n"
+         "  --beacons F        fraction of nodes sending test beacons (0)\n"
+         "  --legacy F         fraction of nodes sending legacy ASCII frames (0)\n"
+         "  --gateway 1        speaks and yells all go in over the serial port of node 0 (KISS modem mode)\n"
+         "  --set NAME=V       set int global NAME of the sketch to V on every node, e.g. pck_suppress=0\n"
+         "  --sf SF            base spreading factor of the nodes, links are judged at it (7)\n"
+         "  --txpower DBM      transmit power (17)\n"
+         "  --pl0 DB           path loss at 1 km (120)\n"
+         "  --exponent N       path loss exponent (2.7)\n"
+         "  --shadowing DB     log-normal shadowing sigma (0)\n"
+         "  --capture DB       capture threshold (6)\n"
+         "  --seed N           scenario seed (1)\n"
+         "  --lib PATH         node library (xplora_node.so next to this binary)\n"
+         "  --flash DIR        keep the nodes' flash images in DIR, the next run boots with them (temporary)\n"
+         "  --bench NAME       run a benchmark instead of a scenario: zip, cores, chat, log, strips, keyb\n"
+         "  --corpus PATH      chat lines for the benchmarks (chatcorpus.txt)\n"
+         "  -v                 print the nodes' Serial output\n");
+}
+
+int main(int argc, char **argv)
+{
+  char self[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  self[len > 0 ? len : 0] = 0;
+  std::string dir(self);
+  sc.lib = dir.substr(0, dir.rfind('/') + 1) + "xplora_node.so";
+  dir = dir.substr(0, dir.rfind('/')); // sim/build
+  sc.corpus = dir.substr(0, dir.rfind('/') + 1) + "chatcorpus.txt";
+
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    const char *v = i + 1 < argc ? argv[i + 1] : "";
+    if (a == "-v") { simVerbose = true; continue; }
+    if (a == "-h" || a == "--help") { usage(); return 0; }
+    i++;
+    if (a == "--nodes") sc.nodes = atoi(v);
+    else if (a == "--area") sc.area = atof(v);
+    else if (a == "--duration") sc.duration = atof(v);
+    else if (a == "--yells") sc.yells = atoi(v);
+    else if (a == "--speaks") sc.speaks = atoi(v);
+    else if (a == "--directs") sc.directs = atoi(v);
+    else if (a == "--pairs") sc.pairs = atoi(v);
+    else if (a == "--dmlen") sc.dmLength = atoi(v);
+    else if (a == "--beacons") sc.beaconFraction = atof(v);
+    else if (a == "--legacy") sc.legacyFraction = atof(v);
+    else if (a == "--gateway") sc.gateway = atoi(v) != 0;
+    else if (a == "--sf") sc.sf = atoi(v);
+    else if (a == "--txpower") sc.txPower = atoi(v);
+    else if (a == "--pl0") sc.pl0 = atof(v);
+    else if (a == "--exponent") sc.exponent = atof(v);
+    else if (a == "--shadowing") sc.shadowing = atof(v);
+    else if (a == "--capture") simCaptureDb = atof(v);
+    else if (a == "--seed") sc.seed = strtoull(v, 0, 0);
+    else if (a == "--lib") sc.lib = v;
+    else if (a == "--flash") simFlashDir = v;
+    else if (a == "--bench") sc.bench = v;
+    else if (a == "--corpus") sc.corpus = v;
+    else if (a == "--set" && strchr(v, '=')) sc.globals.push_back({std::string(v, strchr(v, '=')), atoi(strchr(v, '=') + 1)});
+    else { usage(); return 1; }
+  }
+
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max; // one descriptor per node library
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  if (!sc.bench.empty()) {
+    void *lib = dlopen(sc.lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!lib) {
+      fprintf(stderr, "dlopen: %s\n", dlerror());
+      return 1;
+    }
+    return simBench(sc.bench, lib, sc.corpus);
+  }
+
+  createNodes();
+  std::vector<int> comp = components();
+  createTraffic(comp);
+
+  struct timeval t0, t1;
+  gettimeofday(&t0, 0);
+  int64_t end = (int64_t)(sc.duration * 1e6);
+  while (!heap.empty() && heap[0]->wake <= end) {
+    SimNode *n = heapPop();
+    simNow = n->wake;
+    simCurrent = n->owner ? n->owner : n;
+    simTask = n;
+    swapcontext(&schedCtx, &n->ctx);
+    simCurrent = simTask = 0;
+    heapPush(n);
+  }
+  gettimeofday(&t1, 0);
+  simNow = end;
+  report(comp, (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6);
+  fflush(stdout);
+  _exit(0); // the nodes' coroutines are still parked mid-loop, skip their destructors
+}
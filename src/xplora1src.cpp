@@ -142,6 +142,10 @@ the mentioned used libraries persist as well.
  #define LORA_PERIOD 868  
 // #define LORA_PERIOD 915     
 
+#define REPEATER 0 // 1: boot as headless repeater (no display, no touch pad), see setup()
+#define DUALCORE 1 // 1: the radio runs on core 0, the screen on core 1, see myRadioCore()
+#define OLED_ASYNC 1 // 1: a task of its own sends the frames to the display, see myOledCore()
+
 // end of stuff that must be configured correctly else you may end up in jail - no kidding.
 
 // end of init LORA ---------------------
@@ -196,13 +200,17 @@ the mentioned used libraries persist as well.
 // OR #include "SH1106SPi.h"
 
 
+const uint8_t oled_addr=0x3c; // myOledWindow() talks to it directly
+
 // Optionally include custom images (unused, but just so you see how it works)
 #include "images.h"
 #include "myimage.h"
+#include "zipdict.h" // dictionary for compressed chat text
+#include <esp_partition.h> // raw flash for the chat log
 
 
 // Initialize the OLED display using Arduino Wire:
-SSD1306Wire display(0x3c, SDA, SCL);   // ADDRESS, SDA, SCL  -  SDA and SCL usually populate automatically based on your board's pins_arduino.h e.g. https://github.com/esp8266/Arduino/blob/master/variants/nodemcu/pins_arduino.h
+SSD1306Wire display(oled_addr, SDA, SCL);   // ADDRESS, SDA, SCL  -  SDA and SCL usually populate automatically based on your board's pins_arduino.h e.g. https://github.com/esp8266/Arduino/blob/master/variants/nodemcu/pins_arduino.h
 // SSD1306Wire display(0x3c, D3, D5);  // ADDRESS, SDA, SCL  -  If not, they can be specified manually.
 // SSD1306Wire display(0x3c, SDA, SCL, GEOMETRY_128_32);  // ADDRESS, SDA, SCL, OLEDDISPLAY_GEOMETRY  -  Extra param required for 128x32 displays.
 // SH1106Wire display(0x3c, SDA, SCL);     // ADDRESS, SDA, SCL
@@ -272,8 +280,26 @@ const int baconn=10; // stuff for auto-sending frequent test-beacon messages
 String bacon[baconn+1];
 int baconTestT=0; //MilliSecs()+3000 // send 1st beacon n ms after booting
 
-const int chatn=100; // array that stores the last 100 LoRa Chat messages
-String chat[chatn+1]; 
+// Chat store, the last LoRa chat messages. Their text lies back to back in chat_arena, which is
+// written round and round like a tape: a line goes after the last one (at the start again if it
+// doesn't fit before the end), lines whose text got written over are gone. So a new line costs
+// no heap and moves nothing, and the RAM is fixed: with 30 letters a line (name and text) the
+// store keeps 128 lines, a hundred 1000 letter messages no longer take 100 KB of heap. Line
+// number k (see chat_lines) has slot k & (chat_slots-1) of the arrays, see myChatPut().
+const int chat_arenasize=4096; // bytes of text, each line with a 0 after it
+const int chat_slots=128; // lines at most, must be a power of 2
+char chat_arena[chat_arenasize];
+unsigned long chat_bytes=0; // written so far, the next line goes at chat_bytes % chat_arenasize
+unsigned long chat_lines=0; // lines added so far, the newest one is number chat_lines
+int chat_kept=0; // lines back from the newest one that are still there, see myChatGet()
+unsigned long chat_off[chat_slots]; // where its text is, in chat_bytes
+uint16_t chat_len[chat_slots];
+uint16_t chat_from[chat_slots]; // station that wrote it, my_addr for our own lines
+unsigned long chat_T[chat_slots]; // millis() it reached the screen
+int8_t chat_rssi[chat_slots]; // dBm we heard it with, 0 for our own lines and direct messages
+uint8_t chat_hops[chat_slots]; // re-broadcasts it came over
+uint16_t chat_seq[chat_slots]; // the sender's sequence number, 0 for notices
+String chat_show; // the line being drawn, reused so drawing allocates nothing
 String my_inp=""; // String that was entered by onscreen keyboard
  
 String keyboard[13]; // onscreen keyboard keys in 4 shift states (10x3 x4)
@@ -282,7 +308,7 @@ int myShift=0; // keyboard shift state 0 to 3
 String menu[13]; // main OS menu (this works solely with short/long clicks on button 4, the "LMB" button)
 int menushow=2;
 int menuscroll=0;
-int menuscrollmax=10;
+int menuscrollmax=11;
 int menu_click_event=0;
 int button1_state=0; //init weird
 int button1_lastT=0;
@@ -302,21 +328,818 @@ int hiscore=0; // for pong game
 int chatxo=0; // used in chat screen horizontal msg scrolling
 
 // lora globals
-const int pck_stacksize=100;
-int pck_stack[pck_stacksize]; // stack for packet IDs that were sent
-int pck_stackpointer=0;
-const int pck_jobsize=100;
-int    pck_jobT[pck_jobsize]; // stack for messages that must be re-broadcasted (yell-type)
-String pck_job [pck_jobsize];
-int pck_jobcount=0;
+// Packets are identified by their origin, a 16 bit short address made from the chip ID, and a
+// 12 bit sequence number the origin counts up for every packet it sends.
+uint16_t my_addr=0; // our own short address, set in setup()
+int my_seq=0; // sequence number of the last packet we sent, starts random in setup()
+const int seq_mask=0xFFF;
+
+// XPLORA frame format, version 2. Binary, numbers are big endian:
+//  byte 0      0xB4+version   magic byte, no legacy frame starts with it
+//  byte 1      flags<<4|type  type see pck_type_..., flags see pck_flag_...
+//  byte 2,3    origin         short address of the station that wrote the packet
+//  byte 4,5    ttl<<12|seq    TTL (0 = no limit) and sequence number, see pck_ttl
+//  byte 6      hops<<4|n      re-broadcasts so far, length of the sender name
+//  byte 7,8    from           only with pck_flag_from: the station that sent this copy (origin or relay)
+//  then        dest, next     only types 2-6: the final receiver, and the station that is to pass it on
+//  then        id, frag       only with pck_flag_frag: message id, fragment number<<4|number of the last one
+//  then        id, mask       only with pck_flag_ack: acknowledges fragments (bit mask, 2 bytes) of our message id
+//  then        n bytes        sender name
+//  then        m, m bytes     length of the payload (chat text), payload
+// That's 11 bytes plus the name before the text, the legacy ASCII header "XPL1" + 7 hex digit
+// packet ID + ">" + name + ":" took 13 plus the name.
+// Legacy frames are still understood and re-broadcasted as they are, their packet ID gives
+// origin (upper 4 hex digits) and sequence number (lower 3).
+// Version 1 had no "from" and only types 0 and 1, the name followed byte 6 right away. Stations
+// that still send it are understood and re-broadcasted as they are, but they can't read version
+// 2 frames (they drop them): in a network with such stations set pck_legacy.
+const byte xpl_magic=0xB4;
+const int xpl_version=2;
+const int pck_type_speak=0; // chat, not re-broadcasted
+const int pck_type_yell=1; // chat, re-broadcasted by everyone, see pck_ttl
+const int pck_type_direct=2; // chat for one station, passed on along a route, see myLoraSendTo()
+const int pck_type_rreq=3; // route request, re-broadcasted like a yell
+const int pck_type_rrep=4; // route reply, passed on along a route like a direct message
+const int pck_type_ack=5; // selective ACKs for direct messages, payload: id and 2 byte mask per message, see myDmRun()
+const int pck_type_rate=6; // listen faster for a while, payload: spreading factor and ms (2 bytes), see myAdrTxSf()
+const uint16_t addr_all=0xFFFF; // next hop of a frame that is no direct message, or not known yet
+const int pck_flag_zip=1; // payload is compressed text, see myZipEncode()
+const int pck_flag_from=2; // frame carries the address of the station that sent it, we always set it
+const int pck_flag_frag=4; // direct message fragment, to be acknowledged, see myLoraSendTo()
+const int pck_flag_ack=8; // frame carries an ACK for one of our direct messages
+const int pck_flags_known=pck_flag_zip|pck_flag_from|pck_flag_frag|pck_flag_ack; // flags this firmware understands, frames with others are relayed but not shown
+int pck_legacy=0; // 1: send legacy ASCII frames, for networks with stations on older firmware
+int pck_zip=1; // 1: send chat text compressed whenever that makes it shorter
+// Reach of our yells in hops: stations that receive a yell with TTL 1 don't re-broadcast it,
+// others re-broadcast it with the TTL one less. So pck_ttl=1 reaches just the stations in radio
+// range, 2 also theirs, and so on. 0 = no limit, the yell floods the whole network (and that's
+// what legacy frames do, having no TTL).
+int pck_ttl=0;
+unsigned long pck_ttl_expired=0; // new yells we didn't re-broadcast because their TTL was used up
+unsigned long pck_hops_heard[16]; // new messages shown in the chat, by the hops they took to get here
+
+// Chat text compression, in the style of smaz: a compressed byte below 254 stands for the string
+// at that index of zip_dict (zipdict.h), 254 is followed by one byte taken as it is, 255 by a
+// count n and n bytes taken as they are. Short chat messages shrink to about half. No heap is
+// used, the encoder looks up candidates by their first letter in the tables below.
+byte zip_len[254]; // length of each dictionary string
+byte zip_order[254]; // dictionary indexes grouped by first letter, longest strings first
+byte zip_start[257]; // zip_order[zip_start[c]] is the first string starting with letter c
+int zip_ready=0; // tables above built?
+
+// a frame taken apart by myFrameParse(), the pointers point into the frame itself
+struct XplFrame {
+ int legacy; // 1: old ASCII frame
+ int type;
+ int flags;
+ uint16_t origin;
+ int seq;
+ int ttl;
+ int hops;
+ uint16_t from; // 0 if the frame doesn't tell
+ uint16_t dest; // addr_all if it's no direct message or route reply/request
+ uint16_t next;
+ int msgid; // only with pck_flag_frag
+ int frag;
+ int fraglast;
+ int ackid; // only with pck_flag_ack
+ unsigned int ackmask;
+ const byte *name;
+ int namelen;
+ const byte *payload;
+ int len;
+};
+
+// Duplicate detection: for every origin we heard lately we keep the highest sequence number
+// and a 32 bit window, bit n set means "sequence top-n seen". Origins live in a small hash table
+// of dd_sets buckets with dd_ways entries each, a full bucket drops its least recently heard
+// origin. So checking a packet costs one bucket lookup, and an origin's packets are remembered
+// until it sent 32 more of them or went quiet for long, not just for the last 100 packets.
+// A packet further behind than the window is taken as old and dropped, unless the origin was
+// quiet for dd_restartT: then it's taken as the origin starting over after a reboot.
+// (128 origins in 11 bytes each, 1408 bytes, the old stack took 400 bytes for 100 packet IDs)
+const int dd_sets=16; // power of 2
+const int dd_ways=8;
+const uint16_t dd_restartT=30; // s
+uint16_t dd_origin[dd_sets*dd_ways];
+uint16_t dd_top[dd_sets*dd_ways]; // highest sequence number seen from this origin
+uint32_t dd_window[dd_sets*dd_ways]; // 0 = unused entry
+uint8_t dd_age[dd_sets*dd_ways]; // checks of other origins in the bucket since this one was heard, stops at 255
+uint16_t dd_topT[dd_sets*dd_ways]; // seconds (millis()/1000, wraps) dd_top moved on last
+
+// Routing of direct messages. For every station we know a route to we keep the neighbour to hand
+// its frames to and the hops it's away. Routes are learned from every frame we hear: its "from"
+// is a neighbour, its origin hops+1 away over that neighbour. So stations that chat get routes to
+// each other without asking. Missing routes are searched with a route request, re-broadcasted
+// like a yell, and the station asked for answers with a route reply along the way the request
+// came. Routes live in a hash table like the duplicate detection one, a full bucket drops its
+// stalest route, and routes not heard of for rt_maxage are forgotten.
+const int rt_sets=16; // power of 2
+const int rt_ways=4;
+uint16_t rt_dest[rt_sets*rt_ways];
+uint16_t rt_next[rt_sets*rt_ways]; // neighbour to hand frames for rt_dest to
+byte rt_hops[rt_sets*rt_ways]; // 0 = unused entry
+unsigned long rt_T[rt_sets*rt_ways]; // millis() when last confirmed
+char rt_name[rt_sets*rt_ways][4]; // station name (first 3 letters), if we heard it
+const unsigned long rt_maxage=600000; // ms
+const unsigned long rt_fresh=30000; // ms, a route this old is replaced by any other one we hear of
+const int rt_ttl=15; // hop limit of direct messages and route replies
+// direct messages waiting for a route, and route replies waiting for the request flood to calm down
+const int rt_waitn=6;
+byte rt_wait_buf[rt_waitn][255];
+int rt_wait_len[rt_waitn]; // 0 = unused
+uint16_t rt_wait_dest[rt_waitn];
+unsigned long rt_wait_sendT[rt_waitn]; // millis() when it may go out, once there is a route
+unsigned long rt_wait_T[rt_waitn]; // millis() when to ask for a route again (or give up)
+int rt_wait_tries[rt_waitn]; // route requests sent so far
+const int rt_tries=3; // route requests before we give up, the first goes rt_ttl_first hops only
+const int rt_ttl_first=4;
+const unsigned long rt_reply_delay=2500; // ms, route requests are still being re-broadcasted around us that long
+// With rt_flood 1 a direct message to a station we know no route to is flooded itself, next hop
+// addr_all, re-broadcasted like a yell: it reaches as many stations as a yell does, and the ACK
+// that comes back along the way it took brings the route. It costs more airtime than asking
+// with a route request first, the whole message goes over the mesh (see README).
+int rt_flood=0;
+// counters
+unsigned long rt_rreq_sent=0;
+unsigned long rt_rrep_sent=0;
+unsigned long rt_forwarded=0; // direct messages and route replies we passed on
+unsigned long rt_dropped=0; // ... we had to drop because we knew no route (or their TTL was up)
+unsigned long rt_given_up=0; // own direct messages no route was found for
+unsigned long rt_flooded=0; // own direct message fragments flooded for want of a route
+
+// Reliable direct messages: the text (compressed if that makes it shorter) is cut into fragments
+// of dm_fragsize bytes, each one a direct message frame with pck_flag_frag. The receiver puts
+// them together and answers with a selective ACK, a bit mask of all the fragments of the message
+// it has, dm_ack_delay after the last one came in. If a direct message of its own goes our way
+// meanwhile, the ACK rides along in it (pck_flag_ack) instead. We send the fragments still
+// missing again when the ACK tells, or after a timeout computed from their time on air, see
+// myDmTimeout(), doubled every round without progress. dm_tries such rounds at most.
+// Over more than one hop the fragments of a round go out paced, see myDmGap(): the next one
+// would otherwise hit the relays while they pass on the last one.
+const int dm_fragsize=200; // bytes of text per fragment
+const int dm_max=1000; // bytes of (compressed) text per message, longer ones are cut. 16 fragments at most
+const int dm_window=4; // fragments put on air per round
+const int dm_tries=4;
+const unsigned long dm_ack_delay=300; // ms
+const unsigned long dm_slack=1000; // ms added to every timeout, for queues along the way
+const unsigned long dm_route_wait=50000; // ms the first round may take if the route must be looked for, see myRouteRun()
+int dm_id=0; // id of the last message we sent
+// messages we send
+const int dm_txn=4;
+byte dm_tx_buf[dm_txn][dm_max];
+int dm_tx_len[dm_txn]; // 0 = unused
+uint16_t dm_tx_dest[dm_txn];
+int dm_tx_id[dm_txn];
+int dm_tx_flags[dm_txn]; // pck_flag_zip if buf holds compressed text
+unsigned int dm_tx_sent[dm_txn]; // fragments sent at least once, bit mask
+unsigned int dm_tx_acked[dm_txn]; // fragments the receiver has
+int dm_tx_tries[dm_txn]; // rounds without progress
+unsigned long dm_tx_T[dm_txn]; // millis() when the round times out
+unsigned int dm_tx_todo[dm_txn]; // fragments of this round still to go out, bit mask
+unsigned long dm_tx_nextT[dm_txn]; // millis() when the next of them may
+String dm_tx_line[dm_txn]; // our chat line, without the delivery state
+unsigned long dm_tx_lineno[dm_txn]; // its number, see chat_lines
+// messages we receive
+const int dm_rxn=4;
+byte dm_rx_buf[dm_rxn][dm_max];
+uint16_t dm_rx_origin[dm_rxn];
+int dm_rx_id[dm_rxn];
+int dm_rx_last[dm_rxn]; // number of the last fragment
+int dm_rx_lastlen[dm_rxn]; // bytes in it
+int dm_rx_flags[dm_rxn];
+unsigned int dm_rx_got[dm_rxn]; // fragments we have, bit mask, 0 = unused
+int dm_rx_done[dm_rxn]; // 1: complete and shown, 2: complete but it doesn't decode, never ACKed
+int dm_rx_ack[dm_rxn]; // 1: we owe its sender an ACK
+unsigned long dm_rx_ackT[dm_rxn]; // millis() when it's due
+unsigned long dm_rx_T[dm_rxn]; // millis() of the last fragment, the stalest slot is reused
+// counters
+unsigned long dm_sent=0; // messages
+unsigned long dm_delivered=0; // ... acknowledged completely
+unsigned long dm_failed=0;
+unsigned long dm_frags=0; // fragment frames sent
+unsigned long dm_resent=0; // ... of them sent again
+unsigned long dm_acks=0; // ACK frames sent
+unsigned long dm_acks_carried=0; // ACKs that rode along in a direct message instead
+unsigned long dm_undecoded=0; // messages received complete that didn't decode
+
+// Re-broadcast schedule (yell-type packets): a binary min-heap of jobs ordered by the moment
+// they are due, so adding a job or taking the next due one costs O(log n) and checking whether
+// anything is due is a look at pck_heapT[0]. The packet bytes are copied into a fixed pool,
+// one slot per job. When all slots are taken a new job is refused and counted, a pending one
+// is never overwritten.
+const int pck_jobsize=32; // jobs that can be pending at the same time
+byte pck_pool[pck_jobsize][255]; // packet bytes of the jobs (255 = biggest LoRa frame)
+int pck_pool_len[pck_jobsize];
+int pck_pool_free[pck_jobsize]; // stack of unused pool slots
+int pck_pool_freecount=0;
+unsigned long pck_heapT[pck_jobsize]; // heap: millis() when due, smallest first
+int pck_heapslot[pck_jobsize]; // heap: pool slot of that job
+uint16_t pck_pool_origin[pck_jobsize]; // packet of the job, see myJobHeard()
+int pck_pool_seq[pck_jobsize];
+int pck_pool_heard[pck_jobsize]; // copies of it overheard since the job was scheduled
+int pck_jobcount=0; // jobs in the heap, that's the queue depth
+// counters
+int pck_job_maxdepth=0; // deepest the queue ever was
+unsigned long pck_job_overflows=0; // jobs refused because the pool was full
+unsigned long pck_job_sent=0; // jobs done
+unsigned long pck_job_late_sum=0; // ms the jobs were sent after they were due, summed up (jitter)
+unsigned long pck_job_late_max=0; // ms, latest one
+unsigned long pck_job_suppressed=0; // jobs cancelled because enough neighbours re-broadcasted the packet already
+
+// Re-broadcast suppression: if we overhear pck_suppress more copies of a packet while its
+// re-broadcast is still pending, our neighbours have it covered and the job is cancelled
+// (0 = always re-broadcast). With pck_rssi_delay=1 the delay depends on how strong we heard the
+// packet: weak means far from the last sender, so we have the most new ground to cover and go
+// first, close stations wait and are likely to be suppressed.
+int pck_suppress=2;
+int pck_rssi_delay=0;
+const int pck_rssi_far=-125; // dBm, about the sensitivity at SF7, gets the shortest delay
+const int pck_rssi_near=-65; // and this or stronger the longest
 
 const int lastsent_max=10;
 String lastsent[lastsent_max];
 
 int is_beaconsender=0; // 0 or 1, auto-send frequent beacon  messages for test and debugging purposes
 
+// receive ring, filled by myLoraFetch() with the frame the LoRa interrupt (myLoraOnReceive)
+// told about, emptied by myLoraPoll()
+const int rx_ringsize=8; // frames, must be a power of 2
+const int rx_framemax=255; // biggest LoRa frame
+byte rx_ring_buf[rx_ringsize][rx_framemax];
+int rx_ring_len[rx_ringsize];
+int rx_ring_rssi[rx_ringsize]; // dBm
+float rx_ring_snr[rx_ringsize]; // dB
+unsigned long rx_ring_T[rx_ringsize]; // millis() when received
+volatile unsigned int rx_ring_head=0;
+volatile unsigned int rx_ring_tail=0;
+volatile unsigned long rx_ring_overflows=0; // frames dropped because the ring was full, or the next one came before we fetched it
+volatile int rx_pending=0; // length of a received frame still in the radio's FIFO, set by myLoraOnReceive()
+unsigned long rx_ring_overflows_shown=0;
+volatile unsigned long rx_lastT=0; // millis() when the last frame came in, even if the ring was full
+
+// radio settings we send with (the library defaults), the time on air is computed from them
+int lora_sf=7;
+long lora_bw=125E3;
+int lora_cr=5; // coding rate 4/5
+long lora_preamble=8;
+int lora_crc=0;
+
+// Transmit queue: everything we send goes through myTxAdd(), one small ring per priority, own
+// chat messages first, then re-broadcasts, then test beacons. myTxRun() puts the next frame on
+// air with endPacket(true) and returns right away, so the UI doesn't freeze for the time on air,
+// the onTxDone interrupt (myLoraOnTxDone) tells us when the radio is done.
+// The interrupt callbacks (myLoraOnReceive(), myLoraOnTxDone(), myLoraOnCadDone()) only set a
+// flag and wake the radio task, which does all the talking to the radio. What's left in the
+// interrupt is the LoRa library's own handler reading and clearing the IRQ flags.
+const int tx_prio_own=0;
+const int tx_prio_relay=1;
+const int tx_prio_beacon=2;
+const int tx_prios=3;
+const int tx_qsize=8; // frames per priority, must be a power of 2
+byte tx_q_buf[tx_prios][tx_qsize][255];
+int tx_q_len[tx_prios][tx_qsize];
+unsigned int tx_q_head[tx_prios]; // myTxAdd() moves the head, myTxRun() the tail
+unsigned int tx_q_tail[tx_prios];
+volatile int tx_done=0; // set by the onTxDone interrupt
+int tx_busy=0; // a frame is on air
+unsigned long tx_startT=0; // millis() when it went out
+unsigned long tx_toa=0; // its time on air, ms
+int tx_waiting=0; // the next frame waits for duty cycle budget
+unsigned long tx_waitT=0; // millis() when tx_dc_waitT was last brought up to date
+const unsigned long tx_turnaround=20; // ms to keep quiet after a frame came in, its sender needs that to get back to receive
+// counters
+unsigned long tx_frames=0; // frames sent
+unsigned long tx_airtime=0; // ms on air, all frames sent
+int tx_queued_bytes=0; // bytes waiting in the queue right now
+int tx_queued_bytes_max=0;
+unsigned long tx_overflows=0; // frames refused because their ring was full
+unsigned long tx_dc_waits=0; // frames that had to wait for duty cycle budget
+unsigned long tx_dc_waitT=0; // ms they waited (so far), summed up
+unsigned long tx_dc_max=0; // most ms on air within one window so far
+
+// Duty cycle: the regulations allow a sub-band to be used only for some permille of the time
+// (ETSI EN 300 220 for 868 MHz, 1% on our 866 MHz BAND). We keep the airtime of the last hour
+// for every sub-band in dc_slots buckets of a minute each, a frame is only sent if it still fits
+// into what's left of the hour. Frequencies outside all sub-bands (915) have no limit.
+const int dc_bands=7;
+const long dc_band_lo[dc_bands]={433050000, 863000000, 865000000, 868000000, 868700000, 869400000, 869700000};
+const long dc_band_hi[dc_bands]={434790000, 865000000, 868000000, 868600000, 869200000, 869650000, 870000000};
+const int dc_band_permille[dc_bands]={100, 1, 10, 10, 1, 100, 10};
+const int dc_slots=60; // buckets in the window
+const unsigned long dc_slotT=60000; // ms per bucket, window = dc_slots*dc_slotT = one hour
+uint16_t dc_used[dc_bands][dc_slots]; // ms on air per bucket
+unsigned long dc_sum[dc_bands]; // ms on air in the window
+unsigned long dc_slot_now=0; // millis()/dc_slotT of the newest bucket
+int dc_band=-1; // sub-band of BAND, set in setup(), -1 = no limit
+
+// Neighbour table: every station we hear directly (the "from" of a frame, or the origin of one
+// that wasn't re-broadcasted) gets an entry with moving averages of the RSSI and SNR we hear it
+// with, the frames we got from it, and an estimate of how many of its own frames we miss, from
+// the gaps in their sequence numbers. Those counts are halved when they reach nb_lossn, so the
+// estimate follows the link. Entries live in a hash table like the route one, a full bucket
+// drops its stalest neighbour, and neighbours not heard for nb_maxage are forgotten. The
+// adaptive data rate picks its spreading factors from here.
+const int nb_sets=16; // power of 2
+const int nb_ways=8;
+uint16_t nb_addr[nb_sets*nb_ways];
+unsigned long nb_T[nb_sets*nb_ways]; // millis() when last heard, 0 = unused entry
+int nb_rssi[nb_sets*nb_ways]; // dBm*4, moving average over about 4 frames
+int nb_snr[nb_sets*nb_ways]; // dB*4, the same
+unsigned long nb_frames[nb_sets*nb_ways]; // frames heard from it, re-broadcasts included
+uint16_t nb_seq[nb_sets*nb_ways]; // sequence number of its newest own frame we heard
+byte nb_got[nb_sets*nb_ways]; // own frames of it we heard lately
+byte nb_lost[nb_sets*nb_ways]; // ... and missed
+const int nb_lossn=64; // nb_got+nb_lost halved at this many
+const unsigned long nb_maxage=600000; // ms
+// counters
+unsigned long nb_evicted=0; // neighbours dropped for a new one though we still heard them
+
+// Adaptive data rate: everything meant for all (yells, speaks, route requests) goes out at
+// lora_sf, the base rate every station listens on. Frames for one neighbour (direct messages,
+// route replies and ACKs, handed on hop by hop) go at the fastest spreading factor its link
+// allows: a spreading factor is good for it if that SNR (see the neighbour table) is adr_margin above the least that spreading
+// factor demodulates. Our neighbour listens at the base rate though, so first a rate frame
+// (type 6, at the base rate) tells it to listen at the faster one for a while, long enough for
+// the frames we have queued for it. That's only done where it saves airtime. A neighbour that
+// doesn't answer gets a slower rate next time, see myAdrResult().
+int adr=1; // 0: everything at the base rate
+byte adr_fail[nb_sets*nb_ways]; // spreading factors to add for trouble on the link, by neighbour table entry
+const int adr_snr_min[13]={0, 0, 0, 0, 0, 0, 0, -30, -40, -50, -60, -70, -80}; // dB*4 to demodulate SF7..SF12 (SX1276 datasheet)
+const int adr_margin=40; // dB*4
+const unsigned long adr_switch=30; // ms our neighbour may take to switch after the rate frame
+const unsigned long adr_slack=100; // ms its window is longer than our frames take
+volatile int rx_sf=7; // spreading factor we listen at, lora_sf but during a window
+unsigned long rx_fastT=0; // millis() when the window ends
+volatile int tx_sf=7; // ... the frame on air goes at
+int tx_rate=0; // 1: it's a rate frame, the frame it announces waits adr_switch after it
+unsigned long tx_holdT=0; // millis() before which nothing goes out
+uint16_t tx_fast_next=addr_all; // neighbour listening faster for us right now
+int tx_fast_sf=0; // ... at this spreading factor
+unsigned long tx_fast_endT=0; // millis() when its window ends
+// counters
+unsigned long adr_rates=0; // rate frames sent
+unsigned long adr_fast=0; // frames sent faster than the base rate
+long adr_saved=0; // ms on air that saved, rate frames deducted
+unsigned long adr_windows=0; // windows we listened faster in
+
+// Listen before talk: before a frame goes out at the base rate, the radio runs a channel
+// activity detection (CAD, about 2 symbols) at that rate. If it hears a LoRa preamble or payload
+// another station is sending, so a frame now would collide at the receivers of both, we go back
+// to receiving and try again after a random backoff of 1..2^n slots, n growing with every busy
+// CAD up to lbt_be_max. After lbt_tries busy CADs in a row the frame goes out anyway, so a
+// station that keeps sending can't lock us out. Frames for a neighbour listening faster for us
+// skip it, that air is ours for the window we asked for, see myAdrTxSf(). With lbt_rssi or more
+// on the channel a frame is coming in already: the radio would have to leave receive for the CAD
+// and lose it, so that's taken as busy without one.
+int lbt=1; // 0: send without listening first
+const int lbt_be_max=6; // backoff is at most 2^lbt_be_max slots
+const int lbt_tries=8;
+const unsigned long lbt_slot=16; // symbols (16 ms at SF7), two preambles
+int lbt_rssi=-110; // dBm, with this much on the channel we don't even run the CAD, see myLbtClear()
+int lbt_state=0; // 1: CAD running, 2: the RSSI found the channel busy, no CAD needed
+int lbt_sf=7; // ... at this spreading factor
+int lbt_busyrow=0; // busy CADs in a row for the frame at the head of the queue
+unsigned long lbt_T=0; // millis() when the CAD started, or when the backoff ends
+unsigned long lbt_startT=0; // millis() when the first CAD for the frame started
+volatile int lbt_cad_done=0; // set by the CAD done interrupt
+volatile int lbt_cad_busy=0; // ... and what it found
+// counters
+unsigned long lbt_cads=0; // CADs run
+unsigned long lbt_busy=0; // ... that found the channel busy, or would have, see lbt_loud
+unsigned long lbt_loud=0; // CADs not run because the RSSI told already that something is on air
+unsigned long lbt_deferred=0; // frames that had to wait for the channel at least once
+unsigned long lbt_forced=0; // frames sent though the channel stayed busy
+unsigned long lbt_waitT=0; // ms frames took from their first CAD until they went out, summed up
+
+// Serial modem mode, for boards attached to a PC as gateway. Frames go over Serial in KISS
+// framing: FEND (0xC0), a command byte, the data, FEND. FEND and FESC (0xDB) inside a frame are
+// sent as FESC TFEND (0xDC) and FESC TFESC (0xDD). The last 2 bytes of the data are a CRC-16
+// (CCITT, starting at 0xFFFF, big endian) over the command byte and the rest of the data, frames
+// with a wrong one are dropped. Node to host:
+//  0x00 frame received: RSSI (dBm), SNR (dB*4), both signed bytes, millis() (4 bytes), the frame
+//  0x0E status: our address (2 bytes), free slots in the transmit queue (1), frames to send we
+//       got from the host so far (2, counting up and wrapping) and refused so far (2)
+// Host to node:
+//  0x00 frame to send as it is. An XPLORA frame is remembered as sent, so we don't re-broadcast it
+//  0x01 chat text to send like the chat screen does: type (0 speak, 1 yell), the text
+//  0x0E status request
+// Flow control: the host may send as many frames as the last status had free slots, less those
+// it sent that the status didn't count yet. We send a new status whenever the free slots change.
+// Frames to send go into the transmit queue with the priority of our own chat messages. The first
+// good frame from the host switches modem mode on (or set ser_kiss=1), then every frame we
+// receive is streamed to the host and the text messages on Serial stop. It all runs in
+// myLoraPoll(), so the host is served whatever screen is up, and byte buffers only are used.
+// Writing never waits for the UART (a whole frame escaped takes up to 47 ms at 115200 baud, the
+// radio task would stall that long): a frame for the host that doesn't fit into what's left of
+// its buffer is dropped and counted, a status is sent again on the next pass.
+int ser_kiss=0; // 1: modem mode
+const byte kiss_fend=0xC0;
+const byte kiss_fesc=0xDB;
+const byte kiss_tfend=0xDC;
+const byte kiss_tfesc=0xDD;
+const int kiss_cmd_frame=0x00;
+const int kiss_cmd_text=0x01;
+const int kiss_cmd_status=0x0E;
+const int ser_rxbufsize=4096; // bytes the UART holds for us, we don't read it while the screen is drawn
+const int ser_txbufsize=2048; // bytes it takes to send for us, about 4 whole frames
+byte ser_in[1+255+2]; // frame from the host, unescaped: command, data, CRC
+int ser_inlen=0; // -1: too long, dropped up to the next FEND
+int ser_inesc=0; // 1: the last byte was FESC
+int ser_free=-1; // free slots the last status told, -1 = no status sent yet
+// counters
+unsigned long ser_streamed=0; // received frames streamed to the host
+unsigned long ser_dropped=0; // ... dropped, the UART still had too much to send
+unsigned long ser_got=0; // frames to send the host gave us
+unsigned long ser_refused=0; // ... we refused, the transmit queue was full
+unsigned long ser_bad=0; // frames from the host with a wrong CRC, too short or too long
+
+// Tasks: loop() is a small cooperative scheduler. A task runs every task_period[] ms (0 = never),
+// or at once when its task_event[] is set (the radio interrupts set it for the radio task). loop()
+// runs the due task with the lowest number and returns, so the radio never waits longer than the
+// longest single run of another task. So no task may wait for anything: the apps are state
+// machines, one call of myUi() draws one frame at most, and delays became points in time to check for.
+// Every run is timed: task_us[] and task_us_max[], and how late it started in task_late_max[].
+const int task_radio=0; // myLoraPoll(): receive ring, re-broadcasts, routes, transmit queue
+const int task_input=1; // myUpdateMouse(), reads the touch pads
+const int task_ui=2; // myUi(), one frame of the app on screen
+const int task_house=3; // myHouse(), chat lines from the radio task, beacons, the LED
+const int tasks=4;
+unsigned long task_period[tasks]={1, 30, 30, 10}; // ms, input and ui follow the app on screen, see myApp()
+unsigned long task_T[tasks]; // millis() it's due next
+volatile int task_event[tasks]; // 1: run it as soon as possible
+// counters
+unsigned long task_runs[tasks];
+unsigned long task_us[tasks]; // microseconds spent in it, summed up
+unsigned long task_us_max[tasks]; // longest single run
+unsigned long task_late_sum[tasks]; // ms it started after it was due, summed up
+unsigned long task_late_max[tasks];
+
+// Apps: one at a time is on screen, myUi() calls its step function. They number like the main menu
+// entries that start them, the others from 20 on. myApp() changes screens; the keyboard is a screen of
+// its own, myKeybOpen() opens it and it returns to keyb_back with keyb_done=1 and the text in my_inp.
+const int app_menu=0;
+const int app_games=1;
+const int app_chat=2;
+const int app_p2p=5;
+const int app_nb=6;
+const int app_keyb=20;
+const int app_pong=21;
+const int app_doom=22;
+int app=app_menu;
+unsigned long app_holdT=0; // clicks are ignored until then, so one tap isn't taken twice, see myClick()
+int keyb_back=app_chat;
+int keyb_done=0;
+int keyb_lastsent=0; // LAS button: entry of lastsent[] it copies next
+int chat_scrollmode=0; // chat screen, 1: mouse over the top or bottom line scrolls
+int chat_row=0; // line under the mouse
+int chat_scroll=0; // lines scrolled back
+unsigned long chat_scrollT=0; // next scroll step
+int chat_scrollrun=0; // steps scrolled without a break
+int chat_keyb_type=0; // the keyboard is open for a speak (0) or a yell (1)
+int p2p_scroll=0;
+uint16_t p2p_dest=0; // the keyboard is open for a direct message to this station
+int nb_scroll=0;
+float pong_ballx=0;
+float pong_bally=0;
+float pong_ballxs=4;
+float pong_ballys=4;
+int pong_playerx=32;
+int pong_score=0;
+float doom_mxs=0; // turning speed
+int led_blinks=0; // blinks still to show, see blinkLED()
+int led_on=0;
+unsigned long led_T=0; // millis() to switch the LED next
+
+// Keyboard screen: the keys of the four shift layers and the button bar don't change, so
+// myKeybInit() draws each layer once at boot, into keyb_frame. A frame of the keyboard is a copy
+// of the layer of myShift, then the line typed so far, the box around the key under the mouse and
+// the mouse; no String is made for a key. So any app can have a line typed cheaply, with
+// myKeybOpen() and keyb_done. keyb_layers=0 draws the keys one by one again, to compare.
+int keyb_layers=1;
+uint8_t keyb_frame[4][128*64/8]; // the screen of each shift layer, myShift/3
+
+// Dual core split: with dualcore=1 setup() starts myRadioCore(), a FreeRTOS task on core 0 that
+// runs the radio task, while loop() keeps input, ui and housekeeping on core 1. The mesh (rings,
+// queues, tables) belongs to the radio task, the chat store and screensaverT to core 1. They
+// talk through two queues without a lock, each with one writer and one reader:
+// ui_q takes chat lines to the screen (myChatAdd(), myChatSet(), read by myUiRun()), snd_q takes
+// messages to send the other way (myLoraSend(), myLoraSendTo(), read by mySendRun()). The screens
+// that list routes or neighbours hold mesh_lock while they read those tables, the radio task holds
+// it while it runs. With dualcore=0 the radio task runs in loop(), through the same queues.
+int dualcore=DUALCORE;
+const int ui_qsize=8; // chat lines, must be a power of 2
+const int ui_linemax=dm_max+40; // a whole direct message, with name and delivery state
+char ui_q_line[ui_qsize][ui_linemax+1];
+unsigned long ui_q_lineno[ui_qsize]; // 0: a new line, else the number of the line it replaces
+uint16_t ui_q_from[ui_qsize]; // new lines: what the chat store keeps about them, see chat_from
+int8_t ui_q_rssi[ui_qsize];
+uint8_t ui_q_hops[ui_qsize];
+uint16_t ui_q_seq[ui_qsize];
+unsigned int ui_q_head=0; // moved by the radio task only
+unsigned int ui_q_tail=0; // moved by core 1 only
+unsigned long ui_q_lines=0; // new lines sent so far, the radio task's copy of chat_lines
+const int snd_qsize=4; // messages, must be a power of 2
+int snd_q_prio[snd_qsize];
+int snd_q_type[snd_qsize]; // pck_type_speak, _yell or _direct
+uint16_t snd_q_dest[snd_qsize]; // direct messages: station it's for
+char snd_q_text[snd_qsize][dm_max+1];
+unsigned int snd_q_head=0; // moved by core 1 only
+unsigned int snd_q_tail=0; // moved by the radio task only
+SemaphoreHandle_t mesh_lock;
+// counters
+unsigned long ui_q_overflows=0; // chat lines dropped, the screen didn't keep up
+unsigned long snd_q_overflows=0; // messages refused, the radio task didn't keep up
+
+// Chat log: every chat line also goes into flash, so the chat survives a reboot and scrolls back
+// further than the chat store keeps, see myLogAppend(). It uses the first log_sectors sectors of
+// the "spiffs" partition of the default partition scheme, as raw flash: each sector starts with a
+// header (magic, sequence number, number of its first line, erase count, CRC), then records
+// (length, CRC, sender, RSSI, hops, sequence number, text) back to back. When the sector we write
+// is full the next one is erased and written on, round and round, so all wear evenly and the
+// oldest lines go first. At boot myLogInit() finds the newest sector and the end of the log by
+// the headers and the record CRCs. A record cut short by a power loss gets the top bit of its
+// length cleared (flash bits can go to 0 without an erase), so it's skipped from then on. In RAM
+// are only the headers, and the record offsets of the two sectors myLogGet() read from last.
+// While the flash is busy the ESP32 turns its cache off: the other core stops, and interrupts
+// whose handlers aren't in IRAM wait, the LoRa DIO0 one among them. An erase takes about 45 ms,
+// so the next sector is erased ahead (its oldest lines go a bit early): myLogErase() asks the
+// radio task, which does it when nothing is on the channel and it has nothing to send soon, see
+// myLogEraseRun(). A frame that starts then is still coming in when the erase is done, its
+// interrupt isn't held up. myLogRotate() only erases itself if that didn't come in time. Records
+// are written a flash page (256 bytes, about 0.7 ms) at a time.
+const int log_sectorsize=4096;
+const int log_pagesize=256;
+const unsigned long log_eraseT=50; // ms, no re-broadcast may be due sooner when the radio task erases
+const int log_sectors=64; // 256 KB, about 6000 lines
+const int log_pgmax=256; // records per sector at most
+const int log_hdrsize=16;
+const uint32_t log_magic=0x31474C58; // "XLG1"
+const esp_partition_t *log_part=0; // 0: no chat log, the chat is in RAM only
+uint32_t log_seq[log_sectors]; // its place in the log, 0: not in it
+unsigned long log_first[log_sectors]; // number of its first line, see chat_lines
+uint16_t log_count[log_sectors]; // lines in it
+uint16_t log_erases[log_sectors]; // wear
+int log_head=0; // the sector we write to
+int log_pos=0; // where in it the next record goes
+int log_erased=-1; // the sector after log_head once it's erased ahead, else -1
+volatile int log_erase_req=-1; // sector the radio task is asked to erase ahead
+volatile int log_erase_done=-1; // ... set to it by the radio task when it's done, -2 if the flash failed
+const uint16_t log_live=0x8000; // in the length of a record, cleared if it was cut short
+int log_pg[2]={-1,-1}; // sectors whose record offsets are in log_pg_off[], see myLogPaged()
+uint16_t log_pg_off[2][log_pgmax];
+int log_pg_old=0; // the one to page out next
+byte log_buf[1+4+6+ui_linemax+4]; // one record after a flag byte, myLogGet() leaves its text with a 0 after it here
+uint16_t log_rd_from; // ... and what the record says about it, see chat_from
+int log_rd_rssi;
+int log_rd_hops;
+uint16_t log_rd_seq;
+// counters
+unsigned long log_appends=0; // lines written
+unsigned long log_rotations=0; // sectors started to go on
+unsigned long log_aheads=0; // ... of them erased ahead
+unsigned long log_pageins=0; // record offsets of a sector read in
+unsigned long log_torn=0; // records found cut short at boot
+unsigned long log_fails=0; // flash errors, the log is off after one
+
+// Display: the library's display.display() sends one rectangle around everything that changed
+// since the last frame, so the blinking mouse in one corner and a new chat line in the other send
+// most of the screen. myOledFlush() compares the frame with what the display shows (the library
+// keeps that in display.buffer_back) page by page, 8 rows each, and sends each run of changed
+// columns as a window of its own: the SSD1306 column and page address commands in one
+// transaction, then the bytes. Runs less than oled_gap columns apart go as one window, another
+// window costs about as much bus time as that. A run that comes that close to both edges is sent
+// as the whole line, and such pages one below the other go as one window, so a new screen still
+// costs no more than with the library. oled_diff=0 uses display.display() again, to compare.
+// With oled_async=1 the frames go out from a task of their own, myOledCore(), started at the end
+// of setup(): myOledSend() copies the frame into oled_tx and returns, the app draws the next one
+// into display.buffer while the i2c driver waits for the bus, which leaves the CPU to the other
+// tasks. If the flush task is still busy, the frame waits in display.buffer, and loop() hands it
+// over once the task is done (unless a newer one overtakes it). oled_tx_full changes hands the
+// way the queues between the cores do. oled_onframe is a timing hook for every frame on the display.
+int oled_diff=1;
+int oled_async=OLED_ASYNC;
+const int oled_gap=15; // columns
+uint8_t oled_tx[128*64/8]; // the frame myOledCore() is sending
+unsigned long oled_txT=0; // micros() it was drawn
+unsigned int oled_tx_full=0; // 1: oled_tx is the flush task's, set by core 1, cleared by the task
+TaskHandle_t oled_task=0; // the flush task, 0: myOledSend() sends the frames itself
+int oled_waiting=0; // a frame in display.buffer waits for the flush task
+unsigned long oled_waitT=0; // micros() it was drawn
+void (*oled_onframe)(const uint8_t *frame, unsigned long latency)=0; // called with every frame on the display, and micros() since it was drawn
+// counters
+unsigned long oled_frames=0; // myOledSend() calls
+unsigned long oled_waits=0; // ... that found the flush task busy
+unsigned long oled_us=0; // time the app spent in myOledSend(), on the bus without the flush task
+unsigned long oled_us_max=0;
+unsigned long oled_flushes=0; // frames put on the display, the others were overtaken by newer ones
+unsigned long oled_sent=0; // ... that had anything to send
+unsigned long oled_windows=0;
+unsigned long oled_lat_us=0; // from drawn to on the display, summed up
+unsigned long oled_lat_max=0;
+
+// Frame governor: the ui task comes round at the frame rate of the app on screen, but myUi() only
+// draws a frame when something the app shows has changed since the last one. myApp() sets
+// ui_sources, what the app depends on, and whatever changes sets its bit in ui_dirty:
+// myUpdateMouse() when the mouse moves or a pad is touched, myUiRun() for chat lines, the app
+// itself while it scrolls, myUi() for the blinking mouse, the starfield and the seconds. A screen
+// with nothing new costs a few compares per tick. The most frames a second an app gets is
+// task_period[task_ui], see myApp().
+const int ui_inv_input=1; // the mouse moved, or a pad is (or was just) touched
+const int ui_inv_line=2; // a chat line came in or changed
+const int ui_inv_scroll=4; // the app scrolls on by itself, see myLoraChat()
+const int ui_inv_blink=8; // the mouse blinks, every 128 ms, see myDrawMouse()
+const int ui_inv_stars=16; // the starfield moves, ui_starsT after the frame period
+const int ui_inv_saver=32; // ... the app shows the starfield instead once the screensaver is on
+const int ui_inv_second=64; // times in seconds on screen
+const int ui_inv_frame=128; // the app moves on every frame (games)
+const int ui_inv_all=255;
+const unsigned long ui_starsT=30; // ms, the stars move at their own pace
+int ui_sources=ui_inv_input|ui_inv_stars; // the menu's, see myApp()
+int ui_dirty=ui_inv_all;
+int ui_blink=0; // blink state of the mouse last drawn
+unsigned long ui_starT=0; // millis() the stars move next
+unsigned long ui_second=0; // millis()/1000 last drawn
+int ui_mousex=0; // realmousex, realmousey the last time myUpdateMouse() looked
+int ui_mousey=0;
+int ui_touched=0; // the click pad was touched then
+// counters
+unsigned long ui_frames=0; // frames drawn
+unsigned long ui_skips=0; // ui task runs with nothing new to show
+
+// Chat line strips: myLoraChat() doesn't draw its lines glyph by glyph on every frame. Each line
+// is rasterized once, by myStripMake(), into a strip: a 16 bit word per column of the line, its
+// rows 0 to 15, the pixels drawString() would set with the chat font (ArialMT_Plain_10, 13 rows).
+// The width of the line in pixels comes with it, the sideways scrolling of the hovered line needs
+// it. Drawing a line is then one shifted OR per column into the display buffer, which holds the
+// screen as columns of 8 rows too, see myStripBlit(). The strips lie back to back in strip_pool;
+// when a new one doesn't fit, the least recently drawn ones go and the others are moved together.
+// Lines from the chat log are read from flash only when their strip is made. A line whose text
+// changes (the delivery state of a direct message) is made again. chat_strips=0 draws with
+// drawString() again, to compare.
+int chat_strips=1;
+const int strip_poolsize=4096; // columns, 8 KB, about 50 lines as wide as the screen
+const int strip_max=32; // strips at most
+uint16_t strip_pool[strip_poolsize];
+int strip_end=0; // columns of strip_pool in use, from the start
+unsigned long strip_line[strip_max]; // chat line number, see chat_lines, 0: no strip
+uint16_t strip_off[strip_max]; // its first column in strip_pool
+uint16_t strip_w[strip_max]; // columns, the width of the line
+unsigned long strip_used[strip_max]; // strip_clock when last drawn
+unsigned long strip_clock=0;
+// counters
+unsigned long strip_hits=0; // lines drawn from their strip
+unsigned long strip_makes=0; // lines rasterized
+unsigned long strip_drops=0; // strips dropped for room
+unsigned long strip_packs=0; // times strip_pool was moved together
+
+// Headless repeater, for relays on a mast: no display, no touch pad, no games. setup() skips the
+// splash screen and the touch calibration, seeds the random numbers from the radio instead of the
+// touch noise, and switches the input and ui tasks off: nothing runs but the radio, which every
+// rep_reportT writes a line of relay counters on Serial. The display is never switched on. REPEATER
+// sets it at build time, the host simulator sets repeater=1 per node.
+int repeater=REPEATER;
+const unsigned long rep_reportT=60000; // ms
+unsigned long rep_T=0; // millis() of the last report
+
+// function prototypes (the Arduino IDE would generate these for a .ino, we list them so this
+// file also compiles as plain C++, e.g. for the host simulator in sim/)
+void myKeybTextInput();
+void myShadedRect(int x, int y, int w, int h);
+void myDrawMouse();
+int myHexToInt(String h);
+int myHexDigit(byte c);
+int myFrameParse(const byte *b, int len, XplFrame *f);
+int myFrameBuild(byte *b, int type, int flags, uint16_t origin, int seq, int ttl, uint16_t dest, uint16_t next, const byte *ext, const String &name, const byte *payload, int len);
+int myTextFrame(byte *b, int type, int ttl, uint16_t dest, uint16_t next, const String &txt);
+void myZipInit();
+int myZipEncode(const byte *in, int len, byte *out, int outmax);
+int myZipDecode(const byte *in, int len, byte *out, int outmax);
+int myDupCheck(uint16_t origin, int seq);
+void myLoraChat();
+void myLoraSend(int pck_type, String txt);
+void myLoraQueue(int prio, int pck_type, String txt);
+void myLoraSendTo(uint16_t dest, String txt);
+void myLoraP2P();
+void myRouteHeard(const XplFrame *f);
+void myRouteLearn(uint16_t dest, uint16_t next, int hops, const byte *name, int namelen);
+int myRouteFind(uint16_t dest);
+int myRouteWait(uint16_t dest, const byte *frame, int len, unsigned long sendT, int tries);
+String myRouteName(uint16_t dest);
+void myRouteForward(byte *b, int len, const XplFrame *f);
+void myRouteRequest(uint16_t dest, int ttl);
+void myRouteReply(const XplFrame *f);
+void myRouteRun();
+void myDmRound(int s);
+void myDmNext(int s);
+unsigned long myDmGap(int hops, int len);
+int myDmFrag(int s, int k, uint16_t next, byte *b);
+unsigned long myDmTimeout(int hops, unsigned long toa);
+void myDmAcked(uint16_t from, int id, unsigned int mask);
+void myDmReceive(const XplFrame *f);
+void myDmRun();
+void myChatSet(unsigned long lineno, String line);
+unsigned long myChatAdd(String line);
+unsigned long myChatHeard(String line, const XplFrame *f, int rssi);
+unsigned long myUiPost(unsigned long lineno, const String &line, uint16_t from, int rssi, int hops, uint16_t seq);
+void myChatPut(const char *line, uint16_t from, int rssi, int hops, uint16_t seq);
+void myChatReplace(unsigned long lineno, const char *line);
+unsigned long myChatWrite(const char *line, int len);
+void myChatKeep();
+const char *myChatGet(int back);
+int myChatBack();
+int myStripLine(int back);
+int myStripMake(unsigned long lineno, const char *line);
+int myStripRaster(const char *line, uint16_t *strip);
+void myStripPack();
+void myStripBlit(int k, int x, int y);
+void myLogInit();
+int myLogSector(int s);
+int myLogPage(int s, int check);
+int myLogPaged(int s);
+int myLogRecord(int s, int pos, int check);
+int myLogAppend(const char *line, uint16_t from, int rssi, int hops, uint16_t seq);
+void myLogRotate();
+void myLogErase();
+void myLogEraseRun();
+unsigned long myLogOldest();
+const char *myLogGet(unsigned long lineno);
+void myUiRun();
+int mySendPost(int prio, int type, uint16_t dest, const String &txt);
+void mySendRun();
+void myDmSend(uint16_t dest, String txt);
+void myRadioCore(void *arg);
+void myLoraAttach();
+void blinkLED();
+void myLEDon();
+void myLEDoff();
+void myLoraOnReceive(int packetSize);
+void myLoraFetch();
+void myLoraPoll();
+int myJobAdd(unsigned long T, uint16_t origin, int seq, const byte *data, int len);
+int myJobHeard(uint16_t origin, int seq);
+void myJobRemove(int i);
+unsigned long myJobDelay(int rssi);
+void myJobRun();
+void myLoraOnTxDone();
+int myTxAdd(int prio, const byte *data, int len);
+void myTxRun();
+void myNbHeard(const XplFrame *f, int rssi, float snr);
+int myNbFind(uint16_t addr);
+int myNbLoss(int e);
+void myNbDump();
+void myLoraNeighbours();
+unsigned long myLoraAirtime(int len);
+unsigned long myLoraAirtimeAt(int len, int sf);
+int myAdrSf(uint16_t addr);
+int myAdrTxSf(const byte *b, int len, byte *rate, int *ratelen, int *ratesf);
+void myAdrListen(int sf, unsigned long window);
+void myAdrRun();
+void myAdrResult(uint16_t addr, int ok);
+void myAdrSent(const byte *rate, int len, unsigned long toa);
+void myLoraOnCadDone(boolean busy);
+int myLbtClear(int sf);
+uint16_t myCrc16(uint16_t crc, const byte *b, int len);
+int myKissSend(int cmd, const byte *head, int headlen, const byte *data, int len);
+void myKissStatus();
+void myKissFrame(const byte *b, int len);
+void myKissRun();
+void myDutyAdvance();
+void myRepeaterReport();
+void myTaskRun(int t);
+void myHouse();
+void myUi();
+void myOledSend();
+int myOledHand(unsigned long drawnT);
+void myOledCore(void *arg);
+void myOledFlush(const uint8_t *b, unsigned long drawnT);
+int myOledRun(const uint8_t *b, int p, int x, int *x0, int *x1);
+void myOledWindow(const uint8_t *b, int p0, int p1, int x0, int x1);
+void myMenu();
+void myApp(int a);
+int myClick();
+void myHold(int t);
+void myKeybInit();
+void myKeybDraw(int shift);
+void myKeybOpen();
+void myKeybClose(int cancel);
+void myScreensaver();
+void myUpdateMouse();
+int GETmenu_click_event();
+void drawPattern(float x,float y,float w,float h,float p, float p2);
+void myGames();
+void myGamePong();
+void myGamePongStart();
+void myGameDoom();
+void sliding();
+void raycast();
+float mysin(float a);
+float mycos(float a);
+
 // SSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSSS Setup
 void setup() {
+ Serial.setRxBufferSize(ser_rxbufsize); // must come before begin()
+ Serial.setTxBufferSize(ser_txbufsize);
  Serial.begin(115200);
  Serial.println();
  Serial.println();
@@ -334,6 +1157,13 @@ void setup() {
  // 0x12.
  // See also https://blog.classycode.com/lora-sync-word-compatibility-between-sx127x-and-sx126x-460324d1787a
   LoRa.setSyncWord(0x12);           // in orig sample: 0xF3, 0x34= lorawan, 12=private, ranges from 0-0xFF, default 0x34, see API docs
+  LoRa.setSpreadingFactor(lora_sf);  // the airtime of our frames is computed from these, see myLoraAirtime()
+  rx_sf=lora_sf;                     // the base rate, frames for one neighbour may go faster, see myAdrTxSf()
+  tx_sf=lora_sf;
+  LoRa.setSignalBandwidth(lora_bw);
+  LoRa.setCodingRate4(lora_cr);
+  LoRa.setPreambleLength(lora_preamble);
+  if(lora_crc==1) LoRa.enableCrc();
   Serial.println("LoRa init succeeded.");
  // eo init lora ------------
   
@@ -345,6 +1175,8 @@ void setup() {
  username =(char)(65+(((chipId >> 16) & 255)/10));
  username+=(char)(65+(((chipId >> 8 ) & 255)/10));
  username+=(char)(65+(((chipId      ) & 255)/10));
+ my_addr=(chipId ^ (chipId >> 8)) & 0xFFFF; // short address for packet IDs, see myDupCheck()
+ for(i=0;i<dc_bands;i++) if((BAND>=dc_band_lo[i]) && (BAND<dc_band_hi[i])) dc_band=i; // duty cycle sub-band we send in
 
  // the following sets the main menu entry that will be started after booting.
  menuscroll=2;//1 games, 2 chat; // all other menu entries are placeholders for now.
@@ -363,23 +1195,6 @@ void setup() {
  bacon[9]="Hi!"; //String(chipId);
  bacon[10]="LoRa!";
 
- keyboard[0]="QWERTYUIOP";
- keyboard[1]="ASDFGHJKL?";
- keyboard[2]="ZXCV BNM!.";
-  
- keyboard[3]="qwertyuiop";
- keyboard[4]="asdfghjkl,";
- keyboard[5]="zxcv bnm;:";
-  
- keyboard[6]="1234567890";
- keyboard[7]=".+-/*=()<>";
- keyboard[8]="@#%& $\\{}_";
-  
- keyboard[9]= "~^'¦[]üöä£";
- keyboard[10]="ç§°|¢¬éèà" + (char)34;
- keyboard[11]="©®™»«±¥¶ßµ";
- keyboard[12]="";
-
 // main menu entries
  menu[0]="Files";
  menu[1]="Games"; // active
@@ -387,11 +1202,12 @@ void setup() {
  menu[3]="Notepad";
  menu[4]="BASIC";
  menu[5]="LoRa P2P";
- menu[6]="Tunes";
- menu[7]="Paint";
- menu[8]="Calculator";
- menu[9]="Configuration";
- menu[10]="Deep Sleep";
+ menu[6]="Neighbours";
+ menu[7]="Tunes";
+ menu[8]="Paint";
+ menu[9]="Calculator";
+ menu[10]="Configuration";
+ menu[11]="Deep Sleep";
 
 // for input repeating lines, can also be used as canned messages
 lastsent[0]="Here will be...";
@@ -453,8 +1269,33 @@ for(j=0;j<16;j++){// For j=0 To 15
 // return ascii;
 // }
 
- // I wasn't even sure whether int arrays are nulled when declared, so just to be sure...
- for(i=0;i<pck_jobsize;i++){pck_jobT[i]=0;}
+ // all re-broadcast pool slots are free
+ for(i=0;i<pck_jobsize;i++){pck_pool_free[i]=i;}
+ pck_pool_freecount=pck_jobsize;
+
+ if(repeater==0) myLogInit(); // the chat history, before the radio task numbers chat lines as well
+
+ if(repeater==1) // no display, no touch pad: the radio's wideband RSSI noise seeds the random numbers
+ {                // (read here, before the radio task owns the SPI bus)
+  unsigned long seed=chipId;
+  for(i=0;i<4;i++) seed=(seed << 8) ^ LoRa.random();
+  randomSeed(seed);
+  my_seq=random(seq_mask+1); // so our first packets after a reboot don't look like old ones
+ }
+
+ // the radio goes on now, on a core of its own, or in loop()
+ mesh_lock=xSemaphoreCreateMutex();
+ if(dualcore==1) xTaskCreatePinnedToCore(myRadioCore, "radio", 16384, 0, 2, 0, 0);
+ else myLoraAttach();
+
+ if(repeater==1)
+ {
+  rep_T=millis();
+  task_period[task_input]=0; // nothing runs but the radio and the report
+  task_period[task_ui]=0;
+  Serial.println("Headless repeater "+username+", relay counters every "+String(rep_reportT/1000)+" s");
+  return;
+ }
 
   //-------------------------------------------------------------------------------------
 
@@ -465,6 +1306,7 @@ for(j=0;j<16;j++){// For j=0 To 15
 
   display.flipScreenVertically();
 //  display.setFont(ArialMT_Plain_10);
+  myKeybInit(); // the keyboard screen's layers
 
 // XPLORA boot intro... show off...
   display.setFont(ArialMT_Plain_24);
@@ -492,14 +1334,14 @@ for(j=0;j<16;j++){// For j=0 To 15
   display.setFont(ArialMT_Plain_10);
   // display.setColor(BLACK);
   display.drawString(111,32,"V.1.0");
-  display.display();
+  myOledSend();
   display.setColor(BLACK);
 
  // completely unneccessary progressbar, so the user can read the logo
   for(i=0;i<101;i+=10){
    display.drawProgressBar(4, 24, 120, 8, i);
    delay(50);
-   display.display();
+   myOledSend();
   }
   delay(500);
   display.setTextAlignment(TEXT_ALIGN_LEFT);
@@ -557,13 +1399,17 @@ for(j=0;j<16;j++){// For j=0 To 15
     if(approx1>lastapprox1) myrandomness+=random((approx1-lastapprox1)*random(5,15));
   }
   randomSeed(myrandomness);
+  my_seq=random(seq_mask+1); // so our first packets after a reboot don't look like old ones
   approx1=0;
   lastapprox1=0;
   // say hi to the user, telling him his mac-addres-based username that should be unique on every board (well, there are 12500 variations)
   display.clear();
   display.drawString(36,28, "Welcome "+username);
-  display.display();
+  myOledSend();
   delay(1000);
+  baconTestT=millis()+30000+random(0,10000); // first test beacon, if is_beaconsender is 1
+  if((oled_async==1) && (oled_diff==1)) xTaskCreatePinnedToCore(myOledCore, "display", 4096, 0, 2, &oled_task, 1); // Wire is the task's from now on
+  myApp(app_menu); // which opens the chat, see menu_click_event above
 }
 //--------------------------------------------------------------------------- end of setup()
 
@@ -600,11 +1446,286 @@ for(j=0;j<16;j++){// For j=0 To 15
 // LLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLL Loop
 // LLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLLL Loop
 
-// main OS menu...
+// the OS: runs the most urgent task that is due (see the Tasks section), or sleeps a millisecond
 void loop() {
+ unsigned long ms=millis();
+ int t;
+ if((oled_waiting==1) && (myOledHand(oled_waitT)==1)) oled_waiting=0; // the flush task is done with the last frame
+ for(t=(dualcore==1) ? task_input : task_radio;t<tasks;t++) // lowest number first
+ {
+  if((task_event[t]==1) || ((task_period[t]!=0) && ((long)(ms-task_T[t])>=0)))
+  {
+   myTaskRun(t);
+   return;
+  }
+ }
+ delay(1); // nothing due, the interrupts still come in
+}
+
+
+// runs task t once, times it and schedules its next run
+void myTaskRun(int t)
+{
+ unsigned long ms=millis();
+ unsigned long us;
+ if((task_runs[t]>0) && (task_period[t]!=0) && ((long)(ms-task_T[t])>0)) // (not the first run, right after setup())
+ {
+  task_late_sum[t]+=ms-task_T[t];
+  if(ms-task_T[t]>task_late_max[t]) task_late_max[t]=ms-task_T[t];
+ }
+ task_event[t]=0;
+ task_T[t]=ms;
+ us=micros();
+ if(t==task_radio)
+ {
+  xSemaphoreTake(mesh_lock, portMAX_DELAY); // the screens don't read the tables while we change them
+  myLoraPoll();
+  xSemaphoreGive(mesh_lock);
+ }
+ if(t==task_input) myUpdateMouse();
+ if(t==task_ui) myUi();
+ if(t==task_house) myHouse();
+ us=micros()-us;
+ task_T[t]+=millis()-ms+task_period[t]; // counted from the end of this run, like the delay after a frame used to be
+ task_runs[t]++;
+ task_us[t]+=us;
+ if(us>task_us_max[t]) task_us_max[t]=us;
+}
+
+
+// the radio task on core 0 (dualcore=1): it takes the radio interrupts to this core, then runs
+// myLoraPoll() every millisecond, and at once after an interrupt
+void myRadioCore(void *arg)
+{
+ myLoraAttach();
+ for(;;)
+ {
+  if((task_event[task_radio]==1) || ((long)(millis()-task_T[task_radio])>=0)) myTaskRun(task_radio);
+  else vTaskDelay(1);
+ }
+}
+
+
+// hands the radio interrupts to the LoRa library and starts receiving
+void myLoraAttach()
+{
+ LoRa.onReceive(myLoraOnReceive);  // received frames come in by interrupt, see myLoraOnReceive()
+ LoRa.onTxDone(myLoraOnTxDone);    // and the end of our own ones, see myTxRun()
+ LoRa.onCadDone(myLoraOnCadDone);  // and whether the channel is free before we send, see myLbtClear()
+ LoRa.receive();                   // continuous receive mode
+}
+
+
+// one frame of the app on screen, if anything it shows has changed, see the frame governor
+void myUi()
+{
+ unsigned long ms=millis();
+ int sources=ui_sources;
+ if((sources & ui_inv_saver) && ((long)(ms-screensaverT)>=0)) sources=ui_inv_stars|ui_inv_input|ui_inv_line; // only the stars show
+ if((sources & ui_inv_blink) && ((int)((ms>>7) & 1)!=ui_blink)) {ui_blink=(ms>>7) & 1; ui_dirty|=ui_inv_blink;}
+ if((sources & ui_inv_stars) && ((long)(ms-ui_starT)>=0)) {ui_starT=ms+task_period[task_ui]+ui_starsT; ui_dirty|=ui_inv_stars;}
+ if((sources & ui_inv_second) && (ms/1000!=ui_second)) {ui_second=ms/1000; ui_dirty|=ui_inv_second;}
+ if(((ui_dirty & sources)==0) && ((sources & ui_inv_frame)==0))
+ {
+  ui_skips++;
+  return;
+ }
+ ui_dirty=0; // the app may set it again, to come back next tick
+ ui_frames++;
+ if(app==app_menu) myMenu();
+ else if(app==app_games) myGames();
+ else if(app==app_chat) myLoraChat();
+ else if(app==app_p2p) myLoraP2P();
+ else if(app==app_nb) myLoraNeighbours();
+ else if(app==app_keyb) myKeybTextInput();
+ else if(app==app_pong) myGamePong();
+ else if(app==app_doom) myGameDoom();
+}
+
+
+// puts the frame just drawn on the display: hands it to the flush task, or sends it itself
+void myOledSend()
+{
+ unsigned long t=micros();
+ oled_frames++;
+ if(oled_task==0) myOledFlush(display.buffer,t);
+ else if(myOledHand(t)==0) // the last one is still going out, this one goes next
+ {
+  oled_waits++;
+  oled_waiting=1;
+  oled_waitT=t;
+ }
+ else oled_waiting=0; // (a waiting one is overtaken)
+ t=micros()-t;
+ oled_us+=t;
+ if(t>oled_us_max) oled_us_max=t;
+}
+
+
+// core 1: gives the flush task the frame in display.buffer, drawn at drawnT. Returns 0 if it is
+// still busy with the last one.
+int myOledHand(unsigned long drawnT)
+{
+ if(__atomic_load_n(&oled_tx_full,__ATOMIC_ACQUIRE)!=0) return 0;
+ memcpy(oled_tx,display.buffer,sizeof(oled_tx));
+ oled_txT=drawnT;
+ __atomic_store_n(&oled_tx_full,1,__ATOMIC_RELEASE); // the task's now, after it's written
+ xTaskNotifyGive(oled_task);
+ return 1;
+}
+
+
+// the display flush task on core 1 (oled_async=1): sends each frame myOledHand() gives it
+void myOledCore(void *arg)
+{
+ for(;;)
+ {
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  if(__atomic_load_n(&oled_tx_full,__ATOMIC_ACQUIRE)==0) continue;
+  myOledFlush(oled_tx,oled_txT);
+  __atomic_store_n(&oled_tx_full,0,__ATOMIC_RELEASE); // free for the next frame
+ }
+}
+
+
+// sends what frame b, drawn at drawnT, has that the display doesn't show yet, see oled_diff
+void myOledFlush(const uint8_t *b, unsigned long drawnT)
+{
+ unsigned long t;
+ int p,p1,x,x0,x1,y0,y1,sent=0;
+ int pages=display.height()/8;
+ if(oled_diff==0)
+ {
+  if(memcmp(b,display.buffer_back,display.width()*pages)!=0) sent=1;
+  display.display(); // (b is display.buffer, there is no flush task with oled_diff=0)
+ }
+ else for(p=0;p<pages;p=p1+1)
+ {
+  p1=p;
+  x=0;
+  while(myOledRun(b,p,x,&x0,&x1))
+  {
+   if(x1-x0==display.width()-1) while((p1+1<pages) && myOledRun(b,p1+1,0,&y0,&y1) && (y1-y0==x1-x0)) p1++; // whole lines
+   myOledWindow(b,p,p1,x0,x1);
+   sent=1;
+   x=x1+1;
+  }
+ }
+ oled_flushes++;
+ if(sent) oled_sent++;
+ t=micros()-drawnT;
+ oled_lat_us+=t;
+ if(t>oled_lat_max) oled_lat_max=t;
+ if(oled_onframe!=0) oled_onframe(b,t);
+}
+
+
+// finds the next run of columns in page p, from column x on, that frame b changes, 0 if there is none
+int myOledRun(const uint8_t *b, int p, int x, int *x0, int *x1)
+{
+ int w=display.width();
+ int gap=0;
+ const uint8_t *old=display.buffer_back+p*w;
+ b+=p*w;
+ while((x<w) && (b[x]==old[x])) x++;
+ if(x>=w) return 0;
+ *x0=x;
+ *x1=x;
+ for(x++;(x<w) && (gap<oled_gap);x++) // the run ends after oled_gap columns without a change
+ {
+  if(b[x]!=old[x]) {*x1=x; gap=0;}
+  else gap++;
+ }
+ if((*x0<oled_gap) && (*x1>=w-oled_gap)) {*x0=0; *x1=w-1;} // the whole line
+ return 1;
+}
+
+
+// sends columns x0 to x1 of pages p0 to p1 (rows 8*p0 to 8*p1+7) of frame b to the display
+void myOledWindow(const uint8_t *b, int p0, int p1, int x0, int x1)
+{
+ int p,x,k=0;
+ int w=display.width();
+ Wire.beginTransmission(oled_addr);
+ Wire.write(0x00); // commands follow
+ Wire.write(COLUMNADDR); Wire.write(x0); Wire.write(x1);
+ Wire.write(PAGEADDR); Wire.write(p0); Wire.write(p1);
+ Wire.endTransmission();
+ for(p=p0;p<=p1;p++) for(x=x0;x<=x1;x++) // the display fills the window line by line
+ {
+  if(k==0) {Wire.beginTransmission(oled_addr); Wire.write(0x40);} // data follows
+  Wire.write(b[p*w+x]);
+  display.buffer_back[p*w+x]=b[p*w+x];
+  k++;
+  if(k==I2C_MAX_TRANSFER_BYTE-1) {Wire.endTransmission(); k=0;}
+ }
+ if(k>0) Wire.endTransmission();
+ oled_windows++;
+}
+
+
+// puts app a on screen, at the frame rate it wants, redrawn on what it shows, see the frame governor
+void myApp(int a)
+{
+ unsigned long period=30;
+ int sources=ui_inv_input|ui_inv_blink;
+ if((a==app_menu) || (a==app_games) || (a==app_pong) || (a==app_keyb)) period=10;
+ if(a==app_doom) period=15;
+ if(a==app_menu) sources=ui_inv_input|ui_inv_stars; // the stars are always on, no mouse
+ if(a==app_chat) sources|=ui_inv_line|ui_inv_scroll|ui_inv_saver;
+ if((a==app_p2p) || (a==app_nb)) sources|=ui_inv_second;
+ if((a==app_pong) || (a==app_doom)) sources=ui_inv_frame;
+ app=a;
+ task_period[task_input]=period;
+ task_period[task_ui]=period;
+ ui_sources=sources;
+ ui_dirty=ui_inv_all;
+}
+
+
+// 1 if the "leftclick" pad is touched, and the last click was handled long enough ago
+int myClick()
+{
+ if((long)(millis()-app_holdT)<0) return 0;
+ return (approx4<touch_baselevel4-150) ? 1 : 0;
+}
+
+
+// ignores clicks for the next t ms (where the apps used to wait for the finger to go away)
+void myHold(int t)
+{
+ app_holdT=millis()+t;
+}
+
+
+// housekeeping: chat lines from the radio task, test beacons, the LED
+void myHouse()
+{
+ unsigned long ms=millis();
+ myUiRun(); // chat lines from the radio task
+ if(log_part!=0) myLogErase(); // the next sector of the chat log, ahead
+ if((repeater==0) && ((long)(ms-baconTestT)>=0)) //  ; auto-send LORA bacon messages
+ {
+  baconTestT=ms+30000+random(0,10000); // send beacon every 30 to 40 secs (if is_beaconsender is 1)
+  if(is_beaconsender==1)
+  {
+   mySendPost(tx_prio_beacon,0,0,bacon[random(0,baconn)]); // beacons are of type 0, "speak", and go out after everything else
+   screensaverT=ms+screensaverAfter; // prevent screensaver ...
+  }
+ }
+ if((led_blinks>0) && ((long)(ms-led_T)>=0)) // 100 ms on, 50 ms off
+ {
+  if(led_on==0) {myLEDon(); led_on=1; led_T=ms+100;}
+  else {myLEDoff(); led_on=0; led_T=ms+50; led_blinks--;}
+ }
+}
+
+
+// main OS menu...
+void myMenu()
+{
  int i=0; 
  long int ms=millis();
- myUpdateMouse();
  if(menu_click_event==0){menu_click_event=GETmenu_click_event();} // allows autostart of chat via setup()
  if(menu_click_event==1) // short click scroll menu items
  {
@@ -615,8 +1736,11 @@ void loop() {
  if(menu_click_event==2) // long click, start a specific app
  {
   screensaverT=ms+screensaverAfter;
-  if(menuscroll==1) {myGames();} // games submenu
-  if(menuscroll==2) {myLoraChat();} // chat control screen
+  menu_click_event=0;
+  if(menuscroll==1) {myApp(app_games); return;} // games submenu
+  if(menuscroll==2) {chatxo=0; chat_scrollmode=0; myApp(app_chat); return;} // chat control screen
+  if(menuscroll==5) {p2p_scroll=0; myApp(app_p2p); return;} // direct messages
+  if(menuscroll==6) {nb_scroll=0; myNbDump(); myApp(app_nb); return;} // who we hear, and how well
   // here one can easily add his own apps, try use myGames() as a template.
  }
  
@@ -635,8 +1759,7 @@ void loop() {
   // myScreensaver(); // used here if main menu should not show background stars animation
  } // from else screensavermode?
  myScreensaver();// used here so main menu has background stars animation anyway.
- display.display();
- mydelay(10);
+ myOledSend();
  menu_click_event=0;
 }
 
@@ -651,170 +1774,177 @@ void loop() {
 
 
 
+// sets the keys of the onscreen keyboard and draws its layers into keyb_frame, leaves the display cleared
+void myKeybInit()
+{
+ keyboard[0]="QWERTYUIOP";
+ keyboard[1]="ASDFGHJKL?";
+ keyboard[2]="ZXCV BNM!.";
+
+ keyboard[3]="qwertyuiop";
+ keyboard[4]="asdfghjkl,";
+ keyboard[5]="zxcv bnm;:";
+
+ keyboard[6]="1234567890";
+ keyboard[7]=".+-/*=()<>";
+ keyboard[8]="@#%& $\\{}_";
+
+ keyboard[9]= "~^'¦[]üöä£";
+ keyboard[10]=String("ç§°|¢¬éèà") + (char)34; // (a bare char* plus a char would be pointer arithmetic)
+ keyboard[11]="©®™»«±¥¶ßµ";
+ keyboard[12]="";
+
+ for(int i=0;i<4;i++)
+ {
+  display.clear();
+  myKeybDraw(i*3);
+  memcpy(keyb_frame[i], display.buffer, sizeof(keyb_frame[i]));
+ }
+ display.clear();
+}
+
+
+// draws the keys of shift state shift (0, 3, 6, 9) and the button bar of the keyboard screen
+void myKeybDraw(int shift)
+{
+ int i;
+ int j;
+ display.setFont(ArialMT_Plain_10);
+ display.setTextAlignment(TEXT_ALIGN_CENTER);
+ for(i=0;i<3;i++){
+  for(j=0;j<keyboard[0].length();j++){ 
+   display.drawString(9+j*12, 47-(((2-i)*12)), keyboard[i+shift].substring(j,j+1 ) );
+  }
+ }
+ //display.drawString(16,0,"UP   DWN    OK   BCKS");
+ display.drawString(2, 0,"X"); // button labels
+ display.drawString(16+7, 0,"LAS"); 
+ display.drawString(16+37,0,"SHF");
+ display.drawString(16+66,0,"OK");
+ display.drawString(16+97,0,"BCKS");
+ display.setTextAlignment(TEXT_ALIGN_LEFT);
+
+ // buttons on keyboard screen
+ myShadedRect( 0,0, 7,12);
+ myShadedRect( 8,0,29,12);
+ myShadedRect(38,0,29,12);
+ myShadedRect(68,0,29,12);
+ myShadedRect(98,0,29,12);
+ /*
+ display.drawRect( 0,0, 7,12);
+ display.drawRect( 8,0,29,12);
+ display.drawRect(38,0,29,12);
+ display.drawRect(68,0,29,12);
+ display.drawRect(98,0,29,12);
+ */
+}
+
+
+// opens the keyboard screen for the app on screen, which gets keyb_done=1 when it's back
+void myKeybOpen()
+{
+ my_inp="";
+ keyb_back=app;
+ keyb_done=0;
+ mousex=64;
+ mousey=32;
+ myHold(300);
+ myApp(app_keyb);
+}
+
+
+// leaves the keyboard screen. Any newly typed text is added to LAS, the last typed messages, even
+// when it is cancelled.
+void myKeybClose(int cancel)
+{
+ int i=0;
+ int found_tmp=0; // check whether this message is new, and if so, add it to LAS last typed messages array
+ for(i=0;i<lastsent_max;i++){
+  if(lastsent[i]==my_inp){ found_tmp=1; }
+ }
+ if((found_tmp==0) && (my_inp!=""))
+ {
+  // move old messages, lose the last, to copy the new one to the first
+  for(i=lastsent_max;i>0;i--){ lastsent[i]=lastsent[i-1]; }
+  lastsent[0]=my_inp;
+ }
+ if(cancel==1) my_inp=""; // prevent sending anything after returning to chat screen
+ keyb_done=1;
+ myHold(300);
+ myApp(keyb_back);
+}
+
+
 void myKeybTextInput(){
  // -------------------------------------------------------------------                myKeybTextInput()
 
- my_inp="";
- int inp_exit=0;
- int ms=0;
- int mhit2=0;
- int mhit=0;
- String mychar="";
- int mx=0;
- int my=0;
+ int mhit=myClick();
+ int mx=realmousex;
+ int my=realmousey;
  int chx=0;
  int chy=0;
- int i=0;
- int j=0;
- int butt1state=0;
- int butt2state=0;
- int butt3state=0;
- int butt4state=0;
- int butt1T=0;
- int butt2T=0;
- int butt3T=0;
- int butt4T=0;
- int lastsent_pointer=0; // to parse last 10 sent messages and copy them to input for repeating a message
- int found_tmp=0; // used by LAS last typed message handler
-
- while(inp_exit==0){
-  myUpdateMouse();
-  ms=millis();//   ms=MilliSecs()
-  mhit=0;
-  if(approx4<(touch_baselevel4-150)){mhit=1;} // detect "mouseclick" on pad 4
-  mychar="";
-  mx=realmousex;
-  my=realmousey;
-  if((my>=22)&&(my<=63)){//   hovering over keyboard?
-   if((mx>=0)&&(mx<=127)){//    
-    chx=fmin( 9,fmax(0,floor((mx-4)/12)));// determine key under mouse
-    chy=fmin(2,max(0, (my-22)/12));//     
-    mychar=keyboard[chy+myShift].substring(chx,chx+1);
-    if(mhit==1){//     If clicked
-     my_inp=my_inp+mychar; // add to input string
-     mhit=0;
-     mydelay(200);
-    }//     EndIf
-   }//    EndIf
-  }//   EndIf
- 
-  display.clear();
 
-  // draw screen keyboard...
-  display.setTextAlignment(TEXT_ALIGN_CENTER);
+ if((my>=22)&&(my<=63)){//   hovering over keyboard?
+  if((mx>=0)&&(mx<=127)){//    
+   chx=fmin( 9,fmax(0,floor((mx-4)/12)));// determine key under mouse
+   chy=fmin(2,max(0, (my-22)/12));//     
+   if(mhit==1){//     If clicked
+    my_inp+=keyboard[chy+myShift].charAt(chx); // add to input string
+    mhit=0;
+    myHold(200);
+   }//     EndIf
+  }//    EndIf
+ }//   EndIf
 
-  for(i=0;i<3;i++){
-   for(j=0;j<keyboard[0].length();j++){ 
-    display.drawString(9+j*12, 47-(((2-i)*12)), keyboard[i+myShift].substring(j,j+1 ) );
+ //   ; manage button effects and exec button actions
+ if(mhit==1){// button 4 "clicked"?
+  if(my<12){// mouse over top row of buttons?
+   if((mx>=0)&&(mx<8)){//  ------------------------------   // CANCEL / X
+    myKeybClose(1);
+    return;
    }
-  }
-  display.setTextAlignment(TEXT_ALIGN_LEFT);
-  display.drawString(128-display.getStringWidth(my_inp),13,my_inp); // actual line entered so far
-  //display.drawString(16,0,"UP   DWN    OK   BCKS");
-  display.setTextAlignment(TEXT_ALIGN_CENTER);
-  display.drawString(2, 0,"X"); // button labels
-  display.drawString(16+7, 0,"LAS"); 
-  display.drawString(16+37,0,"SHF");
-  display.drawString(16+66,0,"OK");
-  display.drawString(16+97,0,"BCKS");
-  // 
-  display.setTextAlignment(TEXT_ALIGN_LEFT);
-  
-  //   ; manage button effects and exec button actions
-  if(mhit==1){// button 4 "clicked"?
-   if(my<12){// mouse over top row of buttons?
-    if((mx>=0)&&(mx<8)){//  ------------------------------   // CANCEL / X
-     inp_exit=1;
-     // Cancel sending message, yet still allow user to store a newly typed message in LAS:
-     // check whether this message is new, and if so, add it to LAS last typed messages array
-     found_tmp=0;
-     for(i=0;i<lastsent_max;i++){
-      if(lastsent[i]==my_inp){ found_tmp=1; }
-     }
-     if((found_tmp==0) && (my_inp!=""))
-     {
-      // move old messages, lose the last, to copy the new one to the first
-      for(i=lastsent_max;i>0;i--){ lastsent[i]=lastsent[i-1]; }
-      lastsent[0]=my_inp;
-     }
-     mydelay(200);     
-     my_inp=""; // prevent sending anything after returning to chat screen
-    }
-    if((mx>=8)&&(mx<38)){//  ------------------------------   // LAS last messages sent
-      // copies one of the last 10 typed messages to the text input field of the keyboard screen
-     butt1T=ms+200;
-     butt1state=1;
-     my_inp=lastsent[lastsent_pointer];
-     lastsent_pointer++;
-     if(lastsent_pointer>=lastsent_max){lastsent_pointer=0;}
-     mydelay(300);
-    }//     EndIf
-    if((mx>=38)&&(mx<68)){//  --------------------------   // SHF shift for the 4 shift states
-     butt2T=ms+200;
-     butt2state=1;
-     myShift=myShift+3;
-     mydelay(300);
-     if(myShift >9){
-      myShift=0;
-     }//      EndIf
-    }//     EndIf
-    if((mx>=68)&&(mx<96)){//   ----------------------------- // send / ok
-     butt3T=ms+200;
-     butt3state=1;
-     inp_exit=1;
-     // check whether this message is new, and if so, add it to LAS last sent messages array
-     found_tmp=0;
-     for(i=0;i<lastsent_max;i++){
-      if(lastsent[i]==my_inp){ found_tmp=1; }
-     }
-     if((found_tmp==0) && (my_inp!=""))
-     {
-      // move old messages, lose the last, to copy the new one to the first
-      for(i=lastsent_max;i>0;i--){ lastsent[i]=lastsent[i-1]; }
-      lastsent[0]=my_inp;
-     }
-     mydelay(200);     
-    }//     EndIf ok-button clicked
-    if((mx>=98)&&(mx<128)){// ---------------------------------- // backspace
-     butt4T=ms+200;
-     butt4state=1;
-     if(my_inp!=""){
-      if(my_inp.length()==1){
-       my_inp="";
-      }else{
-       my_inp=my_inp.substring(0,my_inp.length()-1);
-      }//       EndIf
-     }//      EndIf
-     mydelay(300);
-    }//     EndIf bckspace clicked
-   }//    EndIf
-  }//   EndIf
-  // 
-  if(my>22){display.drawRect(chx*12+3,23+chy*12,13,13);} // mouseover: rectangle over letter of keyboard
-  if(ms>butt1T){butt1state=0;}
-  if(ms>butt2T){butt2state=0;}
-  if(ms>butt3T){butt3state=0;}
-  if(ms>butt4T){butt4state=0;}
-
-  // buttons on keyboard screen
-  myShadedRect( 0,0, 7,12);
-  myShadedRect( 8,0,29,12);
-  myShadedRect(38,0,29,12);
-  myShadedRect(68,0,29,12);
-  myShadedRect(98,0,29,12);
-  /*
-  display.drawRect( 0,0, 7,12);
-  display.drawRect( 8,0,29,12);
-  display.drawRect(38,0,29,12);
-  display.drawRect(68,0,29,12);
-  display.drawRect(98,0,29,12);
-  */
-  myDrawMouse();
-  display.display();
-  mydelay(10);
-  // 
- }//  Wend
- mydelay(100);
+   if((mx>=8)&&(mx<38)){//  ------------------------------   // LAS last messages sent
+     // copies one of the last 10 typed messages to the text input field of the keyboard screen
+    my_inp=lastsent[keyb_lastsent];
+    keyb_lastsent++;
+    if(keyb_lastsent>=lastsent_max){keyb_lastsent=0;}
+    myHold(300);
+   }//     EndIf
+   if((mx>=38)&&(mx<68)){//  --------------------------   // SHF shift for the 4 shift states
+    myShift=myShift+3;
+    myHold(300);
+    if(myShift >9){
+     myShift=0;
+    }//      EndIf
+   }//     EndIf
+   if((mx>=68)&&(mx<96)){//   ----------------------------- // send / ok
+    myKeybClose(0);
+    return;
+   }//     EndIf ok-button clicked
+   if((mx>=98)&&(mx<128)){// ---------------------------------- // backspace
+    if(my_inp!=""){
+     if(my_inp.length()==1){
+      my_inp="";
+     }else{
+      my_inp=my_inp.substring(0,my_inp.length()-1);
+     }//       EndIf
+    }//      EndIf
+    myHold(300);
+   }//     EndIf bckspace clicked
+  }//    EndIf
+ }//   EndIf
+
+ // draw screen keyboard...
+ if(keyb_layers==1) memcpy(display.buffer, keyb_frame[myShift/3], sizeof(keyb_frame[0])); // drawn once, see myKeybInit()
+ else{
+  display.clear();
+  myKeybDraw(myShift);
+ }
+ display.drawString(128-display.getStringWidth(my_inp),13,my_inp); // actual line entered so far
+ if(my>22){display.drawRect(chx*12+3,23+chy*12,13,13);} // mouseover: rectangle over letter of keyboard
+
+ myDrawMouse();
+ myOledSend();
 }// End Function
 
 
@@ -847,386 +1977,2727 @@ void myDrawMouse()
 
 int myHexToInt(String h) // for up to 7 hex digits
 {
-  if(h=="") return 0;
   int i;
   int val=0;
   int val2=0;
   for(i=0;i<h.length();i++)
   {
-    String hex1=h.substring(i,i+1);
-    val=0;
-    // yeah I know this is very unelegant. But hey, it works.
-    if(hex1=="0") val=0;
-    if(hex1=="1") val=1;
-    if(hex1=="2") val=2;
-    if(hex1=="3") val=3;
-    if(hex1=="4") val=4;
-    if(hex1=="5") val=5;
-    if(hex1=="6") val=6;
-    if(hex1=="7") val=7;
-    if(hex1=="8") val=8;
-    if(hex1=="9") val=9;
-    if(hex1=="a" || hex1=="A") val=10;
-    if(hex1=="b" || hex1=="B") val=11;
-    if(hex1=="c" || hex1=="C") val=12;
-    if(hex1=="d" || hex1=="D") val=13;
-    if(hex1=="e" || hex1=="E") val=14;
-    if(hex1=="f" || hex1=="F") val=15;
+    val=myHexDigit(h.charAt(i));
+    if(val<0) val=0;
     val2=val2*16 + val;
   }
   return val2;
 }
 
+int myHexDigit(byte c) // value of one hex digit, -1 if it isn't one
+{
+  if((c>='0')&&(c<='9')) return c-'0';
+  if((c>='a')&&(c<='f')) return c-'a'+10;
+  if((c>='A')&&(c<='F')) return c-'A'+10;
+  return -1;
+}
+
+
+
 
+// Tells whether packet seq of origin was seen already (1) or is new (0), and remembers it.
+// Sequence numbers count modulo seq_mask+1, one that is more than 32 behind the newest we know
+// is a late copy of an old packet (1), or, if the origin was quiet for dd_restartT, the origin
+// started over (reboot): then it's taken as new and the window restarts there.
+int myDupCheck(uint16_t origin, int seq)
+{
+ int set=(((uint32_t)origin * 40503) >> 8) & (dd_sets-1); // cheap hash, the low bits of an address alone are poor
+ int e=-1;
+ int oldest=-1;
+ int i;
+ int d;
+ uint16_t now=millis()/1000;
+ for(i=set*dd_ways;i<(set+1)*dd_ways;i++)
+ {
+  if(dd_window[i]==0){ if((oldest<0) || (dd_window[oldest]!=0)) oldest=i; continue; } // free entries go first
+  if(dd_origin[i]==origin) e=i;
+  else if(dd_age[i]<255) dd_age[i]++;
+  if((oldest<0) || ((dd_window[oldest]!=0) && (dd_age[i]>dd_age[oldest]))) oldest=i;
+ }
+ if(e<0) // origin not known (anymore), take the free or least recently heard entry of the bucket
+ {
+  e=oldest;
+  dd_origin[e]=origin;
+  dd_top[e]=seq;
+  dd_window[e]=1;
+  dd_age[e]=0;
+  dd_topT[e]=now;
+  return 0;
+ }
+ dd_age[e]=0;
+ d=(seq-dd_top[e]) & seq_mask;
+ if(d==0) return 1;
+ if(d<=seq_mask/2) // newer than anything so far, slide the window
+ {
+  if(d<32) dd_window[e]=(dd_window[e] << d) | 1;
+  else dd_window[e]=1;
+  dd_top[e]=seq;
+  dd_topT[e]=now;
+  return 0;
+ }
+ d=(dd_top[e]-seq) & seq_mask; // that much older than the newest
+ if(d>=32) // way behind
+ {
+  if((uint16_t)(now-dd_topT[e])<dd_restartT) return 1; // a late copy
+  dd_top[e]=seq; // the origin started over
+  dd_window[e]=1;
+  dd_topT[e]=now;
+  return 0;
+ }
+ if(dd_window[e] & ((uint32_t)1 << d)) return 1;
+ dd_window[e]|=((uint32_t)1 << d);
+ return 0;
+}
 
 
 void myLoraChat() // ---------------------------------------------------------------- myLoraChat()
 {
- int packet_id=0;
- String pckid_string= "";
- String msg="";
- int chat_scrollmode=0;
- int chat_exit=0;
- int ms=0;
+ int ms=millis();
  int i=0;
- int mx=0;
- int my=0;
- chatxo=0;
- int mhit=0;
- int myrow=0;
+ int mx=realmousex;
+ int my=realmousey;
+ int mhit=myClick();
  int old_myrow=0;
- int scroll_offset=0;
- int bacon_rand;
- baconTestT=millis()+30000+random(0,10000); // send beacon every 30 to 40 secs (if is_beaconsender is 1)
-
- while(chat_exit==0){
-  myUpdateMouse();
-  mhit=0;
-  if(approx4<touch_baselevel4-150){mhit=1;}
-  mx=realmousex;
-  my=realmousey;
-  ms=millis();
-  if(ms>baconTestT){//  ; auto-send LORA bacon messages
-   baconTestT=ms+30000+random(0,10000); // schedule next beacon
-
-  if(is_beaconsender==1){
-  // send random bacon lora........................
-      // generate unique packet ID
-      packet_id=random(0xFFFFFFF);
-      pckid_string= String(packet_id, HEX); // turn into 7 byte hex string
-      while(pckid_string.length()<7) {pckid_string="0"+pckid_string;} // add leading zeros if neccessary
-      pck_stack[pck_stackpointer]=packet_id; // remember this ID in "sent packets" stack
-      pck_stackpointer++;
-      if(pck_stackpointer>=pck_stacksize){ pck_stackpointer=0;} // we just "carrouel" through this stack, kind of "first in, last driven over, or something"
-      bacon_rand=random(0,baconn);
-      msg="XPL0"+pckid_string+">"+username+":"+bacon[bacon_rand]; // assembling a proper XPLORA data packet (of type 0, "speak")
-      LoRa.beginPacket();
-      LoRa.print(msg);
-      LoRa.endPacket();
-
-      for(i=0;i<chatn;i++){//      add line to local chat array
-       chat[i]=chat[i+1];
-      }
-      chat[chatn]=username+">"+bacon[bacon_rand];
-      screensaverT=ms+screensaverAfter; // prevent screensaver ...
-   }// EndIf beaconsender?
-  }//   EndIf time for beacon?
- 
-  if(mhit==1){//     ; buttons check
-   screensaverT=ms+screensaverAfter; // prevent screensaver ...
-  
-   if(my>55){//   mouse over bottom buttons row?
-    if((mx>0)&&(mx<=30)){//                         button 1, speak
-     mydelay(300);
-     mousex=64;
-     mousey=32;
-
-     myKeybTextInput();
-     screensaverT=millis()+screensaverAfter;
-     if(my_inp!=""){//
-      for(i=0;i<chatn;i++){//
-       chat[i]=chat[i+1];//
-      }//      Next
-      chat[chatn]=username+">"+my_inp;//
-     
-      //-----------------------------------  send user input!
-      packet_id=random(0xFFFFFFF); // create uniqie packet id
-      pckid_string= String(packet_id, HEX);
-      while(pckid_string.length()<7) {pckid_string="0"+pckid_string;}
-      pck_stack[pck_stackpointer]=packet_id;
-      pck_stackpointer++;
-      if(pck_stackpointer>=pck_stacksize){ pck_stackpointer=0;}
-
-      // int to hex:
-      // int n = 255;
-      // String hexString = String(n, HEX); 
-      // hex to int:
-      // int myHexToInt(String h)
-     
-      msg="XPL0"+pckid_string+">"+username+":"+my_inp;
-      LoRa.beginPacket();
-      LoRa.print(msg);
-      LoRa.endPacket();
-      blinkLED();
-      mydelay(50);
-      blinkLED();
-      //-----------
-      chatxo=0;
-      chat_scrollmode=0;
-     }//     EndIf
-     mousex=64;
-     mousey=52;
-    }//    EndIf
-    if((mx>32)&&(mx<=62)){//                   button 2, yell
-     //
-     // this identical like the previous button, except for "XPL1" rather than "XPL0" in the packet header.
-     mydelay(300);
-     mousex=64;
-     mousey=32;
-
-     myKeybTextInput();
-     // glowLED();
-     screensaverT=millis()+screensaverAfter;
-     if(my_inp!=""){//
-      for(i=0;i<chatn;i++){//
-       chat[i]=chat[i+1];//
-      }//      Next
-      chat[chatn]=username+">"+my_inp;//
-     
-      //-----------------------------------  send YELL user input! (notice "XPL1" in header)
-      packet_id=random(0xFFFFFFF);
-      pckid_string= String(packet_id, HEX);
-      while(pckid_string.length()<7) {pckid_string="0"+pckid_string;}
-      //const int pck_stacksize=100;
-      pck_stack[pck_stackpointer]=packet_id;
-      pck_stackpointer++;
-      if(pck_stackpointer>=pck_stacksize){ pck_stackpointer=0;}
-     
-      msg="XPL1"+pckid_string+">"+username+":"+my_inp;
-      LoRa.beginPacket();
-      LoRa.print(msg);
-      LoRa.endPacket();
-      blinkLED();
-      mydelay(50);
-      blinkLED();
-      //-----------
-      chatxo=0;
-      chat_scrollmode=0;
-     }//     EndIf
-     mousex=64;
-     mousey=52;
-    }//    EndIf
-    if((mx>64)&&(mx<=94)){//                       button 3, scroll toggle
-     chat_scrollmode=(chat_scrollmode+1) & 1; // toggle scrollmode, mouse over top or bottom line scrolls
-     mydelay(200);
-     screensaverT=ms+screensaverAfter;
-    }//    EndIf
-    if((mx>96)&&(mx<=128)){//                       button 4, exit chat screen, return to main OS menu
-     chat_exit=1;
-     screensaverT=ms+screensaverAfter;
-    }//    EndIf 
-   }//   EndIf
-  }//  EndIf
+
+ if(keyb_done==1){ // back from the keyboard
+  keyb_done=0;
+  screensaverT=ms+screensaverAfter;
+  if(my_inp!=""){//
+   myLoraSend(chat_keyb_type,my_inp); //-----------------------------------  send user input! (speak or yell, "XPL0"/"XPL1" in legacy headers)
+   blinkLED();
+   blinkLED();
+   //-----------
+   chatxo=0;
+   chat_scrollmode=0;
+  }//     EndIf
+  mousex=64;
+  mousey=52;
+ }
+
+ if(mhit==1){//     ; buttons check
+  screensaverT=ms+screensaverAfter; // prevent screensaver ...
  
-  display.clear();
-  // List last chat messages...
-  // handle chat history scrolling: when scroll is toggled on, user
-  // can scroll through the last 100 chat messages
-  old_myrow=myrow;
-  myrow=(min(5,max(0,my/9)) ); // determine chat row under mouse
-  // 
-  if(chat_scrollmode==1){//
-   if(myrow==0){//               scroll up
-    scroll_offset=scroll_offset+1;
-    if(scroll_offset>chatn-6){// scroll down
-     scroll_offset=chatn-6;
+  if(my>55){//   mouse over bottom buttons row?
+   if((mx>0)&&(mx<=30)){//                         button 1, speak
+    chat_keyb_type=0;
+    myKeybOpen();
+    return;
+   }//    EndIf
+   if((mx>32)&&(mx<=62)){//                   button 2, yell
+    // this identical like the previous button, except for "XPL1" rather than "XPL0" in the packet header.
+    chat_keyb_type=1;
+    myKeybOpen();
+    return;
+   }//    EndIf
+   if((mx>64)&&(mx<=94)){//                       button 3, scroll toggle
+    chat_scrollmode=(chat_scrollmode+1) & 1; // toggle scrollmode, mouse over top or bottom line scrolls
+    myHold(200);
+   }//    EndIf
+   if((mx>96)&&(mx<=128)){//                       button 4, exit chat screen, return to main OS menu
+    myHold(200);
+    myApp(app_menu);
+    return;
+   }//    EndIf 
+  }//   EndIf
+ }//  EndIf
+
+ display.clear();
+ // List last chat messages...
+ // handle chat history scrolling: when scroll is toggled on, user
+ // can scroll through the chat store and the chat log (myChatBack() lines), a line every 150 ms
+ old_myrow=chat_row;
+ chat_row=(min(5,max(0,my/9)) ); // determine chat row under mouse
+ // 
+ if(chat_scrollmode==1){//
+  if((chat_row!=0)&&(my<=55)){chat_scrollrun=0;}// not scrolling
+  if((long)(ms-chat_scrollT)>=0){
+   chat_scrollrun++; // after 3 s a page a step, through the chat log
+   if(chat_row==0){//               scroll up
+    chat_scroll=chat_scroll+((chat_scrollrun>20) ? 6 : 1);
+    if(chat_scroll>max(0,myChatBack()-6)){// scroll down
+     chat_scroll=max(0,myChatBack()-6);
     }else{
-     for(i=0;i<15;i++){myUpdateMouse();mydelay(10);}
+     chat_scrollT=ms+150;
     }//   EndIf
    }//  EndIf
    if(my>55){// 
-    scroll_offset=scroll_offset-1;
-    if(scroll_offset<0){
-     scroll_offset=0;
+    chat_scroll=chat_scroll-((chat_scrollrun>20) ? 6 : 1);
+    if(chat_scroll<0){
+     chat_scroll=0;
     }else{
-     for(i=0;i<15;i++){myUpdateMouse();mydelay(10);}
+     chat_scrollT=ms+150;
     }//   EndIf
    }//  EndIf
-  }else{// chat_scrollmode is not 1
-   scroll_offset=0;
-  }// EndIf
- 
-  if(old_myrow!=myrow){chatxo=0;}//  register change of line under mouse (in case of incoming message)
-  //   ; allow horizontal scrolling of long (longer than screen width) textlines (if mouseover)
-  for(i=chatn;i>=chatn-5;i--){//
-   int real_chatxo=0;
-   if((5-(chatn-i))==myrow){//
-    int striwi=display.getStringWidth(chat[i-scroll_offset]);//
-    if(striwi>128){//
-     chatxo=chatxo+1;
-     if(chatxo> striwi+4){chatxo= -128;}//
-    }else{
-     chatxo=0;
-    }//     EndIf
-    real_chatxo=chatxo;
-   }//    EndIf
-   // draw actual chat screen text lines
-   if(screensaverT>ms){  display.drawString(-real_chatxo, 45-(((chatn-i))*9), chat[i-scroll_offset]  );}
-  }//   Next
-
+  }
+ }else{// chat_scrollmode is not 1
+  chat_scroll=0;
+ }// EndIf
+
+ if(old_myrow!=chat_row){chatxo=0;}//  register change of line under mouse (in case of incoming message)
+ if((chat_scrollmode==1)&&((chat_row==0)||(my>55))){ui_dirty|=ui_inv_scroll;}// come back to scroll on
+ //   ; allow horizontal scrolling of long (longer than screen width) textlines (if mouseover)
+ for(i=0;i<=5;i++){// lines back from the newest one shown, bottom up
+  int real_chatxo=0;
+  int strip=(chat_strips==1) ? myStripLine(i+chat_scroll) : -1; // see the chat line strips
+  if(strip<0) chat_show=myChatGet(i+chat_scroll);
+  if((5-i)==chat_row){//
+   int striwi=(strip>=0) ? strip_w[strip] : display.getStringWidth(chat_show);//
+   if(striwi>128){//
+    chatxo=chatxo+1;
+    ui_dirty|=ui_inv_scroll; // and on the next frame
+    if(chatxo> striwi+4){chatxo= -128;}//
+   }else{
+    chatxo=0;
+   }//     EndIf
+   real_chatxo=chatxo;
+  }//    EndIf
+  // draw actual chat screen text lines
+  if(screensaverT>ms){
+   if(strip>=0) myStripBlit(strip, -real_chatxo, 45-i*9);
+   else display.drawString(-real_chatxo, 45-i*9, chat_show  );
+  }
+ }//   Next
 
-  //   ; buttons gfx
-  if(screensaverT>ms){ 
-   for(i=0;i<=3;i++){//
-    display.fillRect(i*32,57,30,9);
-   }//   Next
-   display.setColor(BLACK);
 
-   if(chat_scrollmode==1){//
-    display.drawRect(65,57,28,8);//
-   }//   EndIf
-   display.drawString(0, 54, "Speak   Yell   Scroll   EXIT" );
-   display.setColor(WHITE);
+ //   ; buttons gfx
+ if(screensaverT>ms){ 
+  for(i=0;i<=3;i++){//
+   display.fillRect(i*32,57,30,9);
+  }//   Next
+  display.setColor(BLACK);
 
-   myDrawMouse();
-  } // endif non screen saver?
-  else {myScreensaver();}
-  display.display();//
-  mydelay(30);
+  if(chat_scrollmode==1){//
+   display.drawRect(65,57,28,8);//
+  }//   EndIf
+  display.drawString(0, 54, "Speak   Yell   Scroll   EXIT" );
+  display.setColor(WHITE);
 
- }//  Wend
- mydelay(200);
+  myDrawMouse();
+ } // endif non screen saver?
+ else {myScreensaver();}
+ myOledSend();//
 } // end function
 
 
 
 
-void blinkLED(){
-  digitalWrite(LED_BUILTIN, HIGH);
-  mydelay(100);
-  digitalWrite(LED_BUILTIN, LOW);
-  }
-
-
-void glowLED(){ // using some pseudo-PWM to dim the LED, but it doesn't get very dim
-  int i=0;
-  for(i=0;i<13;i++)
-  {
-  digitalWrite(LED_BUILTIN, HIGH);
-  mydelay(1);
-  digitalWrite(LED_BUILTIN, LOW);
-  mydelay(7);
+void myLoraP2P() // ------------------------------------------------------------------ myLoraP2P()
+{
+ // lists the stations we know a route to, clicking one sends it a direct message. The
+ // messages themselves show up in the chat screen, received ones marked with a "*".
+ int i;
+ int n;
+ int e;
+ int mx=realmousex;
+ int my=realmousey;
+ int mhit=myClick();
+ int myrow=0;
+ int list[rt_sets*rt_ways];
+ int rows;
+ String row_name[6];
+ int row_hops[6];
+ if(keyb_done==1){ // back from the keyboard
+  keyb_done=0;
+  screensaverT=millis()+screensaverAfter;
+  if(my_inp!=""){
+   myLoraSendTo(p2p_dest,my_inp); //-----------------------------------  send direct message!
+   blinkLED();
   }
-}
+  mousex=64;
+  mousey=52;
+ }
+ xSemaphoreTake(mesh_lock, portMAX_DELAY); // the route table is the radio task's, we copy the rows and draw without it
+ n=0;
+ for(i=0;i<rt_sets*rt_ways;i++)
+ {
+  if((rt_hops[i]!=0) && (myRouteFind(rt_dest[i])==i)) {list[n]=i; n++;}
+ }
+ if(p2p_scroll>max(0,n-6)) p2p_scroll=max(0,n-6);
+ myrow=(min(5,max(0,my/9)) ); // station row under mouse
+ if(mhit==1){
+  screensaverT=millis()+screensaverAfter;
+  if(my>55){//   mouse over bottom buttons row?
+   if((mx>0)&&(mx<=30)&&(p2p_scroll>0)){p2p_scroll--;} // up
+   if((mx>32)&&(mx<=62)&&(p2p_scroll<n-6)){p2p_scroll++;} // down
+   myHold(200);
+   if((mx>96)&&(mx<=128)){xSemaphoreGive(mesh_lock); myApp(app_menu); return;} // exit
+  }else if(p2p_scroll+myrow<n){ // clicked a station
+   p2p_dest=rt_dest[list[p2p_scroll+myrow]];
+   xSemaphoreGive(mesh_lock);
+   myKeybOpen();
+   return;
+  }
+ }
+ for(rows=0;(rows<6)&&(p2p_scroll+rows<n);rows++){
+  e=list[p2p_scroll+rows];
+  row_name[rows]=myRouteName(rt_dest[e]);
+  row_hops[rows]=rt_hops[e];
+ }
+ xSemaphoreGive(mesh_lock);
+
+ display.clear();
+ if(n==0){display.drawString(0, 18, "No stations heard yet...");}
+ for(i=0;i<rows;i++){
+  display.drawString(2, i*9, row_name[i]);
+  display.drawString(40, i*9, String(row_hops[i])+((row_hops[i]==1) ? " hop" : " hops"));
+  if((i==myrow)&&(my<=55)){display.drawRect(0, i*9+1, 128, 9);}
+ }
+ for(i=0;i<=3;i++){
+  if(i!=2){display.fillRect(i*32,57,30,9);}
+ }
+ display.setColor(BLACK);
+ display.drawString(0, 54, "Up      Down");
+ display.drawString(104, 54, "EXIT");
+ display.setColor(WHITE);
+ myDrawMouse();
+ myOledSend();
+}
+
+
+void myLoraNeighbours() // ------------------------------------------------------------ myLoraNeighbours()
+{
+ // lists the stations we hear directly: RSSI and SNR we hear them with (moving averages), how
+ // many of their own frames we miss, and how long ago we heard them. Written to Serial as well.
+ int i;
+ int n;
+ int e;
+ int loss;
+ int mx=realmousex;
+ int my=realmousey;
+ int list[nb_sets*nb_ways];
+ int rows;
+ String row_name[5];
+ int row_rssi[5];
+ int row_snr[5];
+ int row_loss[5];
+ unsigned long row_T[5];
+ unsigned long ms;
+ xSemaphoreTake(mesh_lock, portMAX_DELAY); // the neighbour table is the radio task's, we copy the rows and draw without it
+ n=0;
+ for(i=0;i<nb_sets*nb_ways;i++)
+ {
+  if((nb_T[i]!=0) && (myNbFind(nb_addr[i])==i)) {list[n]=i; n++;}
+ }
+ if(nb_scroll>max(0,n-5)) nb_scroll=max(0,n-5);
+ if((myClick()==1)&&(my>55)){ //   mouse over bottom buttons row?
+  screensaverT=millis()+screensaverAfter;
+  if((mx>0)&&(mx<=30)&&(nb_scroll>0)){nb_scroll--;} // up
+  if((mx>32)&&(mx<=62)&&(nb_scroll<n-5)){nb_scroll++;} // down
+  myHold(200);
+  if((mx>96)&&(mx<=128)){xSemaphoreGive(mesh_lock); myApp(app_menu); return;} // exit
+ }
+ for(rows=0;(rows<5)&&(nb_scroll+rows<n);rows++){
+  e=list[nb_scroll+rows];
+  row_name[rows]=myRouteName(nb_addr[e]);
+  row_rssi[rows]=nb_rssi[e];
+  row_snr[rows]=nb_snr[e];
+  row_loss[rows]=myNbLoss(e);
+  row_T[rows]=nb_T[e];
+ }
+ xSemaphoreGive(mesh_lock);
+
+ ms=millis();
+ display.clear();
+ display.drawString(26, 0, "dBm");
+ display.drawString(52, 0, "SNR");
+ display.drawString(80, 0, "loss");
+ display.drawString(104, 0, "ago");
+ if(n==0){display.drawString(0, 18, "No stations heard yet...");}
+ for(i=0;i<rows;i++){
+  loss=row_loss[i];
+  display.drawString(2, 9+i*9, row_name[i]);
+  display.drawString(26, 9+i*9, String(row_rssi[i]/4));
+  display.drawString(52, 9+i*9, String(row_snr[i]/4.0f,1));
+  display.drawString(80, 9+i*9, (loss<0) ? String("-") : String(loss)+"%");
+  display.drawString(104, 9+i*9, String((ms-row_T[i])/1000)+"s");
+ }
+ for(i=0;i<=3;i++){
+  if(i!=2){display.fillRect(i*32,57,30,9);}
+ }
+ display.setColor(BLACK);
+ display.drawString(0, 54, "Up      Down");
+ display.drawString(104, 54, "EXIT");
+ display.setColor(WHITE);
+ myDrawMouse();
+ myOledSend();
+}
+
+
+// sends a chat message as XPLORA packet of type 0 ("speak") or 1 ("yell") and adds it to the local chat.
+// Used by the chat screen buttons and the host simulator, the radio task does the sending.
+void myLoraSend(int pck_type, String txt)
+{
+ mySendPost(tx_prio_own, pck_type, 0, txt);
+}
+
+
+// sends chat text txt as direct message to station dest, see myDmSend(). Used by the P2P screen
+// and the host simulator.
+void myLoraSendTo(uint16_t dest, String txt)
+{
+ mySendPost(tx_prio_own, pck_type_direct, dest, txt);
+}
+
+
+// core 1: hands a message to the radio task, which sends it in mySendRun(). Returns 0 if the
+// queue was full, the message is dropped then.
+int mySendPost(int prio, int type, uint16_t dest, const String &txt)
+{
+ unsigned int h=snd_q_head;
+ int slot=h & (snd_qsize-1);
+ int n=min((int)txt.length(),dm_max);
+ if(h-__atomic_load_n(&snd_q_tail,__ATOMIC_ACQUIRE)>=(unsigned int)snd_qsize)
+ {
+  snd_q_overflows++;
+  return 0;
+ }
+ snd_q_prio[slot]=prio;
+ snd_q_type[slot]=type;
+ snd_q_dest[slot]=dest;
+ memcpy(snd_q_text[slot],txt.c_str(),n);
+ snd_q_text[slot][n]=0;
+ __atomic_store_n(&snd_q_head,h+1,__ATOMIC_RELEASE); // publish it, after the slot is written
+ return 1;
+}
+
+
+// radio task: sends the messages core 1 handed over with mySendPost()
+void mySendRun()
+{
+ unsigned int t=snd_q_tail;
+ int slot;
+ while(t!=__atomic_load_n(&snd_q_head,__ATOMIC_ACQUIRE))
+ {
+  slot=t & (snd_qsize-1);
+  if(snd_q_type[slot]==pck_type_direct) myDmSend(snd_q_dest[slot], String(snd_q_text[slot]));
+  else myLoraQueue(snd_q_prio[slot], snd_q_type[slot], String(snd_q_text[slot]));
+  t++;
+  __atomic_store_n(&snd_q_tail,t,__ATOMIC_RELEASE); // the slot is free again
+ }
+}
+
+
+// builds the packet for myLoraSend() and puts it into the transmit queue with priority prio
+void myLoraQueue(int prio, int pck_type, String txt)
+{
+ byte frame[255];
+ int n;
+ my_seq=(my_seq+1) & seq_mask;
+ myDupCheck(my_addr,my_seq); // remember it, so we don't re-broadcast our own packet
+
+ if(pck_legacy==1)
+ {
+  int packet_id=(my_addr << 12) | my_seq; // unique packet ID: our address and sequence number
+  String pckid_string= String(packet_id, HEX); // turn into 7 byte hex string
+  while(pckid_string.length()<7) {pckid_string="0"+pckid_string;} // add leading zeros if neccessary
+  String pck="XPL"+String(pck_type)+pckid_string+">"+username+":"+txt; // assembling a legacy XPLORA data packet
+  n=min((int)pck.length(),255);
+  memcpy(frame,pck.c_str(),n);
+ }
+ else n=myTextFrame(frame, pck_type, (pck_type==pck_type_yell) ? pck_ttl : 1, addr_all, addr_all, txt); // a speak isn't re-broadcasted at all
+ myTxAdd(prio, frame, n);
+ myChatAdd(username+">"+txt);
+}
+
+
+// writes a version 2 frame of our own carrying chat text txt, compressed if that makes it
+// shorter, into b. Returns its length.
+int myTextFrame(byte *b, int type, int ttl, uint16_t dest, uint16_t next, const String &txt)
+{
+ byte ztxt[255];
+ int zn=0;
+ if(pck_zip==1) zn=myZipEncode((const byte *)txt.c_str(), txt.length(), ztxt, sizeof(ztxt));
+ if((zn>0) && (zn<txt.length())) return myFrameBuild(b, type, pck_flag_zip|pck_flag_from, my_addr, my_seq, ttl, dest, next, 0, username, ztxt, zn);
+ return myFrameBuild(b, type, pck_flag_from, my_addr, my_seq, ttl, dest, next, 0, username, (const byte *)txt.c_str(), txt.length());
+}
+
+
+// sends chat text txt as direct message to station dest. If we know no route to it the message
+// waits until myRouteRun() found one.
+void myDmSend(uint16_t dest, String txt)
+{
+ int s;
+ int zn=0;
+ int n=txt.length();
+ for(s=0;(s<dm_txn) && (dm_tx_len[s]!=0);s++);
+ if(s==dm_txn)
+ {
+  myChatAdd("too many messages on their way");
+  return;
+ }
+ if(pck_zip==1) zn=myZipEncode((const byte *)txt.c_str(), n, dm_tx_buf[s], dm_max);
+ if((zn>0) && (zn<n)) dm_tx_flags[s]=pck_flag_zip;
+ else
+ {
+  zn=min(n,dm_max); // too long ones are cut
+  memcpy(dm_tx_buf[s],txt.c_str(),zn);
+  dm_tx_flags[s]=0;
+ }
+ dm_id=(dm_id+1) & 255;
+ dm_tx_len[s]=zn;
+ dm_tx_dest[s]=dest;
+ dm_tx_id[s]=dm_id;
+ dm_tx_sent[s]=0;
+ dm_tx_acked[s]=0;
+ dm_tx_tries[s]=0;
+ dm_tx_line[s]=txt;
+ dm_tx_lineno[s]=myChatAdd(username+">"+myRouteName(dest)+"(..):"+txt); // the delivery state goes into the brackets
+ dm_sent++;
+ myDmRound(s);
+}
+
+
+// starts a round: the fragments of message slot s the receiver is missing, dm_window at most,
+// go out one by one through myDmNext(), and the round times out after the last one plus
+// myDmTimeout(). Without a route the first one is flooded (rt_flood), or waits for one in
+// myRouteRun().
+void myDmRound(int s)
+{
+ byte frame[255];
+ int n;
+ int k;
+ int count=0;
+ int last=(dm_tx_len[s]-1)/dm_fragsize;
+ unsigned long toa=0;
+ int r=myRouteFind(dm_tx_dest[s]);
+ dm_tx_todo[s]=0;
+ for(k=0;(k<=last) && (count<dm_window);k++)
+ {
+  if(dm_tx_acked[s] & (1 << k)) continue;
+  if((r<0) && (rt_flood==1)) // the ACK will bring the route, the other fragments follow along it
+  {
+   n=myDmFrag(s, k, addr_all, frame);
+   myTxAdd(tx_prio_own, frame, n);
+   rt_flooded++;
+   dm_tx_T[s]=millis()+dm_route_wait;
+   return;
+  }
+  if(r<0)
+  {
+   n=myDmFrag(s, k, addr_all, frame);
+   myRouteWait(dm_tx_dest[s], frame, n, millis(), 0);
+   dm_tx_T[s]=millis()+dm_route_wait;
+   return;
+  }
+  dm_tx_todo[s]|=1 << k;
+  toa+=myLoraAirtime(min(dm_tx_len[s]-k*dm_fragsize, dm_fragsize)+40);
+  count++;
+ }
+ dm_tx_nextT[s]=millis();
+ dm_tx_T[s]=millis()+(count-1)*myDmGap(rt_hops[r], 255)+(myDmTimeout(rt_hops[r], toa) << dm_tx_tries[s]);
+ myDmNext(s);
+}
+
+
+// puts the next fragment of the round of message slot s on air, if it's time for it
+void myDmNext(int s)
+{
+ byte frame[255];
+ int n;
+ int k;
+ int r;
+ if((dm_tx_todo[s]==0) || ((long)(millis()-dm_tx_nextT[s])<0)) return;
+ for(k=0;(dm_tx_todo[s] & (1 << k))==0;k++);
+ dm_tx_todo[s]&=~(1 << k);
+ r=myRouteFind(dm_tx_dest[s]);
+ if(r<0) // the route is gone, the timeout takes care of it
+ {
+  dm_tx_todo[s]=0;
+  return;
+ }
+ n=myDmFrag(s, k, rt_next[r], frame);
+ myTxAdd(tx_prio_own, frame, n);
+ dm_tx_nextT[s]=millis()+myDmGap(rt_hops[r], n);
+}
+
+
+// ms between fragments of len bytes to a station hops away: a neighbour takes them back to back,
+// further away a fragment must have cleared the first relays (they hear each other up to two
+// hops along the route) before the next one follows
+unsigned long myDmGap(int hops, int len)
+{
+ if(hops<=1) return 0;
+ return min(hops,3)*(myLoraAirtime(len)/1000+tx_turnaround);
+}
+
+
+// builds fragment k of message slot s into b, with an ACK we owe its receiver if there is one.
+// Returns the frame length.
+int myDmFrag(int s, int k, uint16_t next, byte *b)
+{
+ byte ext[5];
+ int flags=pck_flag_from | pck_flag_frag | dm_tx_flags[s];
+ int last=(dm_tx_len[s]-1)/dm_fragsize;
+ int i;
+ ext[0]=dm_tx_id[s];
+ ext[1]=(k << 4) | last;
+ for(i=0;i<dm_rxn;i++)
+ {
+  if((dm_rx_ack[i]==1) && (dm_rx_origin[i]==dm_tx_dest[s])) // ride along
+  {
+   flags|=pck_flag_ack;
+   ext[2]=dm_rx_id[i];
+   ext[3]=dm_rx_got[i] >> 8;
+   ext[4]=dm_rx_got[i] & 255;
+   dm_rx_ack[i]=0;
+   dm_acks_carried++;
+   break;
+  }
+ }
+ dm_frags++;
+ if(dm_tx_sent[s] & (1 << k)) dm_resent++;
+ dm_tx_sent[s]|=1 << k;
+ my_seq=(my_seq+1) & seq_mask;
+ myDupCheck(my_addr,my_seq);
+ return myFrameBuild(b, pck_type_direct, flags, my_addr, my_seq, rt_ttl, dm_tx_dest[s], next, ext, username, dm_tx_buf[s]+k*dm_fragsize, min(dm_tx_len[s]-k*dm_fragsize, dm_fragsize));
+}
+
+
+// ms to wait for the ACK of frames taking toa us on air, to a station hops away: they and the
+// ACK cross every hop, then the receiver waits dm_ack_delay
+unsigned long myDmTimeout(int hops, unsigned long toa)
+{
+ return hops*((toa+myLoraAirtime(24))/1000+2*tx_turnaround)+dm_ack_delay+dm_slack;
+}
+
+
+// station from has fragments mask of our message id
+void myDmAcked(uint16_t from, int id, unsigned int mask)
+{
+ int s;
+ int last;
+ int i;
+ int got=0;
+ for(s=0;s<dm_txn;s++) if((dm_tx_len[s]!=0) && (dm_tx_dest[s]==from) && (dm_tx_id[s]==id)) break;
+ if((s==dm_txn) || ((mask & ~dm_tx_acked[s])==0)) return; // old news
+ last=(dm_tx_len[s]-1)/dm_fragsize;
+ dm_tx_acked[s]|=mask & ((2 << last)-1);
+ dm_tx_tries[s]=0;
+ i=myRouteFind(from);
+ if(i>=0) myAdrResult(rt_next[i], 1);
+ for(i=0;i<=last;i++) if(dm_tx_acked[s] & (1 << i)) got++;
+ if(got>last)
+ {
+  myChatSet(dm_tx_lineno[s], username+">"+myRouteName(from)+"(ok):"+dm_tx_line[s]);
+  dm_tx_len[s]=0;
+  dm_tx_line[s]="";
+  dm_delivered++;
+  return;
+ }
+ myChatSet(dm_tx_lineno[s], username+">"+myRouteName(from)+"("+String(got)+"/"+String(last+1)+"):"+dm_tx_line[s]);
+ myDmRound(s); // the rest right away
+}
+
+
+// fragment f of a reliable direct message came in: store it, owe its sender an ACK, and show the
+// message once it's complete. A message that doesn't decode then is never ACKed in full, so its
+// sender doesn't take it as delivered: it tries again and finally gives up.
+void myDmReceive(const XplFrame *f)
+{
+ int i;
+ int s=-1;
+ int len;
+ int missing=0;
+ unsigned long ms=millis();
+ static byte text[2*dm_max];
+ String line;
+ for(i=0;i<dm_rxn;i++)
+ {
+  if((dm_rx_got[i]!=0) && (dm_rx_origin[i]==f->origin) && (dm_rx_id[i]==f->msgid)) {s=i; break;}
+  if((s<0) || ((dm_rx_got[s]!=0) && ((dm_rx_got[i]==0) || ((long)(dm_rx_T[i]-dm_rx_T[s])<0)))) s=i; // a free slot or the stalest
+ }
+ if((dm_rx_got[s]==0) || (dm_rx_origin[s]!=f->origin) || (dm_rx_id[s]!=f->msgid)) // new message
+ {
+  dm_rx_origin[s]=f->origin;
+  dm_rx_id[s]=f->msgid;
+  dm_rx_last[s]=f->fraglast;
+  dm_rx_lastlen[s]=0;
+  dm_rx_got[s]=0;
+  dm_rx_done[s]=0;
+ }
+ if(dm_rx_done[s]==2) return; // it didn't decode, we don't take any more of it
+ if((f->frag<0) || (f->fraglast!=dm_rx_last[s]) || (f->frag>dm_rx_last[s]) || (f->len<0) || (f->len>dm_fragsize) || ((f->frag<dm_rx_last[s]) && (f->len!=dm_fragsize)) || ((f->frag+1)*dm_fragsize>dm_max)) return; // damaged
+ memcpy(dm_rx_buf[s]+f->frag*dm_fragsize, f->payload, f->len);
+ if(f->frag==dm_rx_last[s]) dm_rx_lastlen[s]=f->len;
+ dm_rx_got[s]|=1 << f->frag;
+ dm_rx_flags[s]=f->flags;
+ dm_rx_T[s]=ms;
+ // the ACK waits for the fragments still on their way in this round, paced like the sender does
+ for(i=f->frag+1;i<=dm_rx_last[s];i++) if((dm_rx_got[s] & (1 << i))==0) missing++;
+ dm_rx_ackT[s]=ms+dm_ack_delay+min(missing,dm_window-1)*max(myDmGap(f->hops+1, 255), myLoraAirtime(255)/1000+tx_turnaround);
+ if((dm_rx_done[s]==1) || (dm_rx_got[s]!=(unsigned int)((2 << dm_rx_last[s])-1))) // shown already, or not complete
+ {
+  dm_rx_ack[s]=1;
+  return;
+ }
+ len=dm_rx_last[s]*dm_fragsize+dm_rx_lastlen[s];
+ if(dm_rx_flags[s] & pck_flag_zip) len=myZipDecode(dm_rx_buf[s], len, text, sizeof(text));
+ else memcpy(text, dm_rx_buf[s], len);
+ if(len<0) // damaged
+ {
+  dm_rx_done[s]=2;
+  dm_rx_ack[s]=0;
+  dm_undecoded++;
+  return;
+ }
+ dm_rx_done[s]=1;
+ dm_rx_ack[s]=1;
+ line="*"; // for our eyes only, "*ABC(2):hi"
+ line.concat((const char *)f->name, f->namelen);
+ if(f->hops>0) line+="("+String(f->hops)+")";
+ line+=":";
+ pck_hops_heard[f->hops]++;
+ line.concat((const char *)text, len);
+ myChatHeard(line, f, 0); // (fragments, no one RSSI)
+}
+
+
+// sends the ACKs that are due, one frame per station for all its messages, and the next round of
+// our messages that timed out. Gives up on those after dm_tries rounds, or if no route was found.
+void myDmRun()
+{
+ byte frame[64];
+ byte acks[dm_rxn*3];
+ int i;
+ int j;
+ int n;
+ int r;
+ unsigned long ms=millis();
+ for(i=0;i<dm_rxn;i++)
+ {
+  if((dm_rx_ack[i]==0) || ((long)(ms-dm_rx_ackT[i])<0)) continue;
+  if(rx_sf!=lora_sf) break; // we listen faster for more frames, see myAdrListen()
+  n=0;
+  for(j=i;j<dm_rxn;j++)
+  {
+   if((dm_rx_ack[j]==0) || (dm_rx_origin[j]!=dm_rx_origin[i])) continue;
+   acks[n++]=dm_rx_id[j];
+   acks[n++]=dm_rx_got[j] >> 8;
+   acks[n++]=dm_rx_got[j] & 255;
+   dm_rx_ack[j]=0;
+  }
+  r=myRouteFind(dm_rx_origin[i]);
+  my_seq=(my_seq+1) & seq_mask;
+  myDupCheck(my_addr,my_seq);
+  n=myFrameBuild(frame, pck_type_ack, pck_flag_from, my_addr, my_seq, rt_ttl, dm_rx_origin[i], (r>=0) ? rt_next[r] : addr_all, 0, username, acks, n);
+  if(r>=0) myTxAdd(tx_prio_own, frame, n);
+  else myRouteWait(dm_rx_origin[i], frame, n, ms, rt_tries-1); // the route it came over is gone, ask once
+  dm_acks++;
+ }
+ for(i=0;i<dm_txn;i++)
+ {
+  if(dm_tx_len[i]==0) continue;
+  myDmNext(i);
+  if((long)(ms-dm_tx_T[i])<0) continue;
+  dm_tx_tries[i]++;
+  r=myRouteFind(dm_tx_dest[i]);
+  if(r>=0) myAdrResult(rt_next[r], 0); // maybe the faster rate doesn't carry
+  if((dm_tx_tries[i]<dm_tries) && ((rt_flood==1) || (myRouteFind(dm_tx_dest[i])>=0)))
+  {
+   myDmRound(i);
+   continue;
+  }
+  myChatSet(dm_tx_lineno[i], username+">"+myRouteName(dm_tx_dest[i])+"(failed):"+dm_tx_line[i]);
+  dm_tx_len[i]=0;
+  dm_tx_line[i]="";
+  dm_failed++;
+ }
+}
+
+
+// writes a version 2 XPLORA frame (see the globals section) into b, returns its length. ext holds
+// the fragment and ACK fields, if flags call for them. A payload that doesn't fit into one LoRa
+// frame is cut.
+int myFrameBuild(byte *b, int type, int flags, uint16_t origin, int seq, int ttl, uint16_t dest, uint16_t next, const byte *ext, const String &name, const byte *payload, int len)
+{
+ int n=name.length();
+ int i=0;
+ int e;
+ if(n>15) n=15;
+ b[i++]=xpl_magic+xpl_version;
+ b[i++]=((flags & 15) << 4) | (type & 15);
+ b[i++]=origin >> 8;
+ b[i++]=origin & 255;
+ b[i++]=((ttl & 15) << 4) | ((seq >> 8) & 15);
+ b[i++]=seq & 255;
+ b[i++]=n; // no hops yet
+ if(flags & pck_flag_from) // that's us
+ {
+  b[i++]=my_addr >> 8;
+  b[i++]=my_addr & 255;
+ }
+ if((type>=pck_type_direct) && (type<=pck_type_rate))
+ {
+  b[i++]=dest >> 8;
+  b[i++]=dest & 255;
+  b[i++]=next >> 8;
+  b[i++]=next & 255;
+  e=((flags & pck_flag_frag) ? 2 : 0)+((flags & pck_flag_ack) ? 3 : 0);
+  memcpy(b+i,ext,e);
+  i+=e;
+ }
+ memcpy(b+i,name.c_str(),n);
+ i+=n;
+ if(len>255-i-1) len=255-i-1;
+ b[i++]=len;
+ memcpy(b+i,payload,len);
+ return i+len;
+}
+
+
+// builds the lookup tables for myZipEncode() from the dictionary
+void myZipInit()
+{
+ int i;
+ int j;
+ int c;
+ byte t;
+ int count[256];
+ for(c=0;c<256;c++) count[c]=0;
+ for(i=0;i<254;i++)
+ {
+  zip_len[i]=strlen(zip_dict[i]);
+  count[(byte)zip_dict[i][0]]++;
+ }
+ zip_start[0]=0;
+ for(c=0;c<256;c++) zip_start[c+1]=zip_start[c]+count[c];
+ for(c=0;c<256;c++) count[c]=zip_start[c];
+ for(i=0;i<254;i++) zip_order[count[(byte)zip_dict[i][0]]++]=i;
+ for(c=0;c<256;c++) // longest first within each letter, so the first match is the best
+ {
+  for(i=zip_start[c]+1;i<zip_start[c+1];i++)
+  {
+   t=zip_order[i];
+   for(j=i;(j>zip_start[c]) && (zip_len[zip_order[j-1]]<zip_len[t]);j--) zip_order[j]=zip_order[j-1];
+   zip_order[j]=t;
+  }
+ }
+ zip_ready=1;
+}
+
+
+// compresses in[0..len-1] into out, returns the compressed length or -1 if it needs more than
+// outmax bytes
+int myZipEncode(const byte *in, int len, byte *out, int outmax)
+{
+ int i=0;
+ int o=0;
+ int k;
+ int e;
+ int best;
+ int vstart=0; // bytes in[vstart..i-1] wait for a verbatim run
+ if(zip_ready==0) myZipInit();
+ while(i<=len)
+ {
+  best=-1;
+  if(i<len)
+  {
+   for(k=zip_start[in[i]];k<zip_start[in[i]+1];k++)
+   {
+    e=zip_order[k];
+    if((zip_len[e]<=len-i) && (memcmp(zip_dict[e],in+i,zip_len[e])==0)){ best=e; break; }
+   }
+  }
+  if((best>=0) || (i==len)) // write out what's waiting for a verbatim run
+  {
+   while(vstart<i)
+   {
+    k=i-vstart;
+    if(k>255) k=255;
+    if(k==1)
+    {
+     if(o+2>outmax) return -1;
+     out[o++]=254;
+    }
+    else
+    {
+     if(o+2+k>outmax) return -1;
+     out[o++]=255;
+     out[o++]=k;
+    }
+    memcpy(out+o,in+vstart,k);
+    o+=k;
+    vstart+=k;
+   }
+  }
+  if(i==len) break;
+  if(best>=0)
+  {
+   if(o+1>outmax) return -1;
+   out[o++]=best;
+   i+=zip_len[best];
+   vstart=i;
+  }
+  else i++;
+ }
+ return o;
+}
+
+
+// uncompresses in[0..len-1] into out, returns the length or -1 if the data is damaged or would
+// need more than outmax bytes
+int myZipDecode(const byte *in, int len, byte *out, int outmax)
+{
+ int i=0;
+ int o=0;
+ int c;
+ int n;
+ while(i<len)
+ {
+  c=in[i++];
+  if(c<254)
+  {
+   n=strlen(zip_dict[c]);
+   if(o+n>outmax) return -1;
+   memcpy(out+o,zip_dict[c],n);
+  }
+  else
+  {
+   n=1;
+   if(c==255)
+   {
+    if(i>=len) return -1;
+    n=in[i++];
+   }
+   if((i+n>len) || (o+n>outmax)) return -1;
+   memcpy(out+o,in+i,n);
+   i+=n;
+  }
+  o+=n;
+ }
+ return o;
+}
+
+
+// Takes apart a received frame, version 2, 1 or legacy, without copying anything: the name and
+// payload pointers in f point into b. Returns 0 if it's no XPLORA frame or a damaged one.
+int myFrameParse(const byte *b, int len, XplFrame *f)
+{
+ int i;
+ int d;
+ int id=0;
+ if((len>=8) && (b[0]==xpl_magic+1) && (((b[1] & 15)>pck_type_yell) || (((b[1] >> 4) & ~pck_flag_zip)!=0))) return 0; // version 1 knew speak, yell and zip only
+ if((len>=8) && ((b[0]==xpl_magic+xpl_version) || (b[0]==xpl_magic+1)))
+ {
+  f->legacy=0;
+  f->type=b[1] & 15;
+  f->flags=b[1] >> 4;
+  f->origin=(b[2] << 8) | b[3];
+  f->ttl=b[4] >> 4;
+  f->seq=((b[4] & 15) << 8) | b[5];
+  f->hops=b[6] >> 4;
+  f->namelen=b[6] & 15;
+  f->from=0;
+  f->dest=addr_all;
+  f->next=addr_all;
+  i=7;
+  if(f->flags & pck_flag_from)
+  {
+   if(len<9) return 0;
+   f->from=(b[7] << 8) | b[8];
+   i+=2;
+  }
+  if((f->type>=pck_type_direct) && (f->type<=pck_type_rate))
+  {
+   if((i!=9) || (len<13)) return 0; // these always carry "from", myRouteForward() relies on it
+   f->dest=(b[9] << 8) | b[10];
+   f->next=(b[11] << 8) | b[12];
+   i+=4;
+   if(f->flags & pck_flag_frag)
+   {
+    if(len<i+2) return 0;
+    f->msgid=b[i];
+    f->frag=b[i+1] >> 4;
+    f->fraglast=b[i+1] & 15;
+    i+=2;
+   }
+   if(f->flags & pck_flag_ack)
+   {
+    if(len<i+3) return 0;
+    f->ackid=b[i];
+    f->ackmask=(b[i+1] << 8) | b[i+2];
+    i+=3;
+   }
+  }
+  f->name=b+i;
+  i+=f->namelen;
+  if(i>=len) return 0;
+  f->len=b[i];
+  f->payload=b+i+1;
+  if(i+1+f->len>len) return 0;
+  return 1;
+ }
+ // legacy: "XPL" + type digit + 7 hex digit packet ID + ">" + name + ":" + text
+ if((len>12) && (b[0]=='X') && (b[1]=='P') && (b[2]=='L') && ((b[3]=='0') || (b[3]=='1')) && (b[11]=='>'))
+ {
+  for(i=4;i<11;i++)
+  {
+   d=myHexDigit(b[i]);
+   if(d<0) return 0;
+   id=id*16+d;
+  }
+  f->legacy=1;
+  f->type=b[3]-'0';
+  f->flags=0;
+  f->origin=id >> 12;
+  f->seq=id & seq_mask;
+  f->ttl=0;
+  f->hops=0;
+  f->from=0;
+  f->dest=addr_all;
+  f->next=addr_all;
+  f->name=b+12;
+  for(i=12;(i<len) && (b[i]!=':');i++);
+  f->namelen=i-12;
+  if(i<len) i++; // skip the ":"
+  f->payload=b+i;
+  f->len=len-i;
+  return 1;
+ }
+ return 0;
+}
+
+
+// radio task: adds line to the chat, it wakes the screen. Returns its number (see chat_lines), 0 if
+// the screen didn't keep up and it was dropped.
+unsigned long myChatAdd(String line)
+{
+ return myUiPost(0, line, my_addr, 0, 0, 0);
+}
+
+
+// radio task: adds line to the chat, a message we received in frame f with the given RSSI
+unsigned long myChatHeard(String line, const XplFrame *f, int rssi)
+{
+ return myUiPost(0, line, f->origin, rssi, f->hops, f->seq);
+}
+
+
+// radio task: replaces chat line number lineno, if it's still in the chat
+void myChatSet(unsigned long lineno, String line)
+{
+ if(lineno!=0) myUiPost(lineno, line, 0, 0, 0, 0);
+}
+
+
+// radio task: hands line to core 1, as a new chat line (lineno 0) or in place of line number lineno.
+// Returns the number of the line, 0 if the queue was full.
+unsigned long myUiPost(unsigned long lineno, const String &line, uint16_t from, int rssi, int hops, uint16_t seq)
+{
+ unsigned int h=ui_q_head;
+ int slot=h & (ui_qsize-1);
+ int n=min((int)line.length(),ui_linemax);
+ if(h-__atomic_load_n(&ui_q_tail,__ATOMIC_ACQUIRE)>=(unsigned int)ui_qsize)
+ {
+  ui_q_overflows++;
+  return 0;
+ }
+ memcpy(ui_q_line[slot],line.c_str(),n);
+ ui_q_line[slot][n]=0;
+ ui_q_lineno[slot]=lineno;
+ ui_q_from[slot]=from;
+ ui_q_rssi[slot]=(rssi < -128) ? -128 : rssi;
+ ui_q_hops[slot]=hops;
+ ui_q_seq[slot]=seq;
+ __atomic_store_n(&ui_q_head,h+1,__ATOMIC_RELEASE); // publish it, after the slot is written
+ if(lineno!=0) return lineno;
+ ui_q_lines++; // core 1 numbers the lines in the same order
+ return ui_q_lines;
+}
+
+
+// core 1: takes the chat lines the radio task handed over into the chat store
+void myUiRun()
+{
+ unsigned int t=ui_q_tail;
+ int slot;
+ while(t!=__atomic_load_n(&ui_q_head,__ATOMIC_ACQUIRE))
+ {
+  slot=t & (ui_qsize-1);
+  if(ui_q_lineno[slot]==0)
+  {
+   myChatPut(ui_q_line[slot], ui_q_from[slot], ui_q_rssi[slot], ui_q_hops[slot], ui_q_seq[slot]);
+   if(log_part!=0) myLogAppend(ui_q_line[slot], ui_q_from[slot], ui_q_rssi[slot], ui_q_hops[slot], ui_q_seq[slot]);
+   chatxo=0;
+   screensaverT=millis()+screensaverAfter;
+   ui_dirty|=ui_inv_line;
+#ifdef XPLORA_HOST
+   simOnChat(ui_q_line[slot]); // lets the host simulator (sim/) follow messages to the screen
+#endif
+  }
+  else
+  {
+   myChatReplace(ui_q_lineno[slot], ui_q_line[slot]);
+   ui_dirty|=ui_inv_line;
+  }
+  t++;
+  __atomic_store_n(&ui_q_tail,t,__ATOMIC_RELEASE); // the slot is free again
+ }
+}
+
+
+// adds line as the newest one to the chat store, with what we know about it
+void myChatPut(const char *line, uint16_t from, int rssi, int hops, uint16_t seq)
+{
+ int len=min((int)strlen(line),chat_arenasize-1);
+ int s;
+ chat_lines++;
+ s=chat_lines & (chat_slots-1);
+ chat_off[s]=myChatWrite(line, len);
+ chat_len[s]=len;
+ chat_from[s]=from;
+ chat_T[s]=millis();
+ chat_rssi[s]=rssi;
+ chat_hops[s]=hops;
+ chat_seq[s]=seq;
+ chat_kept++;
+ myChatKeep();
+}
+
+
+// replaces the text of chat line number lineno, if it's still there. In place if the new text fits,
+// else it's written as if new, the old text is left to be written over.
+void myChatReplace(unsigned long lineno, const char *line)
+{
+ int len=min((int)strlen(line),chat_arenasize-1);
+ int s=lineno & (chat_slots-1);
+ if((lineno>chat_lines) || (chat_lines-lineno>=(unsigned long)chat_kept)) return; // gone
+ for(int k=0;k<strip_max;k++) if(strip_line[k]==lineno) strip_line[k]=0; // made again when drawn
+ if(len<=chat_len[s]) memcpy(chat_arena+chat_off[s]%chat_arenasize, line, len+1);
+ else
+ {
+  chat_off[s]=myChatWrite(line, len);
+  myChatKeep();
+ }
+ chat_len[s]=len;
+}
+
+
+// writes line[0..len-1] and a 0 into the arena, returns where (in chat_bytes)
+unsigned long myChatWrite(const char *line, int len)
+{
+ unsigned long at=chat_bytes;
+ if(at%chat_arenasize+len+1>chat_arenasize) at+=chat_arenasize-at%chat_arenasize; // not across the end
+ memcpy(chat_arena+at%chat_arenasize, line, len);
+ chat_arena[at%chat_arenasize+len]=0;
+ chat_bytes=at+len+1;
+ return at;
+}
+
+
+// forgets the oldest lines, from the newest one on whose slot was reused or whose text got written over
+void myChatKeep()
+{
+ int back;
+ if(chat_kept>chat_slots) chat_kept=chat_slots;
+ for(back=0;back<chat_kept;back++)
+ {
+  if(chat_off[(chat_lines-back) & (chat_slots-1)]+chat_arenasize<chat_bytes) break;
+ }
+ chat_kept=back;
+}
+
+
+// text of the chat line back lines before the newest one (0 is the newest), "" if there is none.
+// O(1) from the chat store, for the scroll view of myLoraChat(), older lines come from the chat log.
+const char *myChatGet(int back)
+{
+ if(back<0) return "";
+ if(back<chat_kept) return chat_arena+chat_off[(chat_lines-back) & (chat_slots-1)]%chat_arenasize;
+ if((log_part==0) || (back>=myChatBack())) return "";
+ return myLogGet(chat_lines-back);
+}
+
+
+// lines the chat can be scrolled back through, the newest one included
+int myChatBack()
+{
+ if((log_part==0) || (myLogOldest()==0)) return chat_kept;
+ return max((long)chat_kept, (long)(chat_lines-myLogOldest()+1));
+}
+
+
+// the strip of the chat line back lines before the newest one, made if there is none yet.
+// -1 if the line can't have one, it's drawn with drawString() then.
+int myStripLine(int back)
+{
+ int k;
+ unsigned long lineno;
+ if((back<0) || (back>=myChatBack())) return -1;
+ lineno=chat_lines-back;
+ for(k=0;k<strip_max;k++) if(strip_line[k]==lineno) break;
+ if(k<strip_max) strip_hits++;
+ else
+ {
+  k=myStripMake(lineno, myChatGet(back));
+  if(k<0) return -1;
+ }
+ strip_used[k]=++strip_clock;
+ return k;
+}
+
+
+// rasterizes chat line lineno into a new strip, dropping the least recently drawn ones for room,
+// returns it. -1 for lines that are empty, wider than strip_pool, or more than one line of text.
+int myStripMake(unsigned long lineno, const char *line)
+{
+ int k;
+ int j;
+ int live;
+ int w;
+ if(strchr(line,10)!=0) return -1; // drawString() draws it as more lines
+ w=myStripRaster(line, 0);
+ if((w<=0) || (w>strip_poolsize)) return -1;
+ for(;;)
+ {
+  k=-1;
+  j=-1;
+  live=0;
+  for(int i=0;i<strip_max;i++)
+  {
+   if(strip_line[i]==0){ if(k<0) k=i; continue; }
+   live+=strip_w[i];
+   if((j<0) || (strip_used[i]<strip_used[j])) j=i;
+  }
+  if((k>=0) && (strip_end+w<=strip_poolsize)) break;
+  if((k>=0) && (live+w<=strip_poolsize)){ myStripPack(); continue; }
+  strip_line[j]=0; // the least recently drawn one goes
+  strip_drops++;
+ }
+ strip_line[k]=lineno;
+ strip_off[k]=strip_end;
+ strip_w[k]=w;
+ memset(strip_pool+strip_end, 0, w*sizeof(uint16_t));
+ myStripRaster(line, strip_pool+strip_end);
+ strip_end+=w;
+ strip_makes++;
+ return k;
+}
+
+
+// ORs the pixels of line in the chat font into strip (0: just measures it), the way drawString()
+// sets them left aligned at y=0: a glyph is a column after column of rasterHeight bytes, 8 rows
+// each. Returns the width of the line in columns, -1 if the font is higher than a strip.
+int myStripRaster(const char *line, uint16_t *strip)
+{
+ const uint8_t *font=ArialMT_Plain_10;
+ int raster=(pgm_read_byte(font+HEIGHT_POS)+7)/8;
+ int first=pgm_read_byte(font+FIRST_CHAR_POS);
+ int count=pgm_read_byte(font+CHAR_NUM_POS);
+ int x=0;
+ if(raster>2) return -1;
+ for(const char *c=line;*c!=0;c++)
+ {
+  int code=(uint8_t)DefaultFontTableLookup(*c); // UTF-8 to the font's codes, 0: no letter
+  if((code==0) || (code<first)) continue;
+  const uint8_t *jump=font+JUMPTABLE_START+(code-first)*JUMPTABLE_BYTES;
+  int msb=pgm_read_byte(jump);
+  int lsb=pgm_read_byte(jump+JUMPTABLE_LSB);
+  int size=pgm_read_byte(jump+JUMPTABLE_SIZE);
+  int width=pgm_read_byte(jump+JUMPTABLE_WIDTH);
+  if((strip!=0) && !((msb==0xFF) && (lsb==0xFF))) // else a glyph without pixels, a space
+  {
+   const uint8_t *data=font+JUMPTABLE_START+count*JUMPTABLE_BYTES+((msb<<8)+lsb);
+   for(int i=0;i<size;i++) strip[x+i/raster]|=(uint16_t)pgm_read_byte(data+i)<<(8*(i%raster));
+  }
+  x+=width;
+ }
+ return x;
+}
+
+
+// moves the strips left in strip_pool together at its start, in the order they lie there
+void myStripPack()
+{
+ int end=0;
+ int from=0;
+ for(;;)
+ {
+  int k=-1;
+  for(int i=0;i<strip_max;i++)
+  {
+   if((strip_line[i]!=0) && (strip_off[i]>=from) && ((k<0) || (strip_off[i]<strip_off[k]))) k=i;
+  }
+  if(k<0) break;
+  from=strip_off[k]+strip_w[k];
+  memmove(strip_pool+end, strip_pool+strip_off[k], strip_w[k]*sizeof(uint16_t));
+  strip_off[k]=end;
+  end+=strip_w[k];
+ }
+ strip_end=end;
+ strip_packs++;
+}
+
+
+// ORs strip k into the display buffer with its top left corner at x, y (0 or more), clipped to the
+// screen: column c goes into the pages y/8 to y/8+2, shifted down by y%8 rows
+void myStripBlit(int k, int x, int y)
+{
+ int w=display.width();
+ int pages=display.height()/8;
+ int p=y>>3;
+ int c=max(0,-x);
+ int end=min((int)strip_w[k], w-x);
+ const uint16_t *strip=strip_pool+strip_off[k];
+ uint8_t *b=display.buffer+p*w+x;
+ for(;c<end;c++)
+ {
+  uint32_t v=(uint32_t)strip[c]<<(y&7);
+  if(p<pages) b[c]|=v;
+  if(p+1<pages) b[c+w]|=v>>8;
+  if(p+2<pages) b[c+2*w]|=v>>16;
+ }
+}
+
+
+// finds the chat log in flash and the end of it (see log_seq), continues the line numbers from it
+// and puts its last lines into the chat store
+void myLogInit()
+{
+ int s;
+ int n;
+ unsigned long last=0;
+ const char *line;
+ log_part=esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+ if((log_part==0) || (log_part->size<(uint32_t)(log_sectors*log_sectorsize))) {log_part=0; return;}
+ log_head=-1;
+ log_pg[0]=-1;
+ log_pg[1]=-1;
+ for(s=0;s<log_sectors;s++)
+ {
+  if(myLogSector(s)==0) continue;
+  if((log_head<0) || ((int32_t)(log_seq[s]-log_seq[log_head])>0)) log_head=s;
+ }
+ if(log_head<0) // no log yet
+ {
+  log_head=log_sectors-1;
+  log_seq[log_head]=0;
+  log_first[log_head]=1;
+  log_count[log_head]=0;
+  log_pos=log_sectorsize;
+  myLogRotate(); // sector 0 is erased now, not when the first line comes
+ }
+ else
+ {
+  for(s=0;s<log_sectors;s++) if((log_seq[s]!=0) && (s!=log_head)) myLogPage(s, 1);
+  log_pos=myLogPage(log_head, 1); // last, so its end is where we go on
+  last=log_first[log_head]+log_count[log_head]-1;
+ }
+ n=(last==0) ? 0 : min((unsigned long)chat_slots, last-myLogOldest()+1);
+ chat_lines=last-n; // the chat store takes up the last n lines again
+ for(;n>0;n--)
+ {
+  line=myLogGet(chat_lines+1);
+  myChatPut(line, log_rd_from, log_rd_rssi, log_rd_hops, log_rd_seq);
+ }
+ ui_q_lines=chat_lines; // the radio task goes on from here
+ if(ser_kiss==0) Serial.println("Chat log: "+String(last)+" lines so far, from line "+String(myLogOldest())+" in flash");
+}
+
+
+// reads the header of sector s into log_seq[s] etc. Returns 0 if it isn't part of the log.
+int myLogSector(int s)
+{
+ byte h[log_hdrsize];
+ log_seq[s]=0;
+ log_count[s]=0;
+ if(esp_partition_read(log_part, s*log_sectorsize, h, log_hdrsize)!=ESP_OK) return 0;
+ log_erases[s]=h[12] | (h[13] << 8);
+ if(myCrc16(0xFFFF, h, 14)!=(h[14] | (h[15] << 8))) {log_erases[s]=0; return 0;} // erased, or an erase/header cut short
+ if((h[0] | (h[1] << 8) | (h[2] << 16) | ((uint32_t)h[3] << 24))!=log_magic) return 0;
+ log_seq[s]=h[4] | (h[5] << 8) | (h[6] << 16) | ((uint32_t)h[7] << 24);
+ log_first[s]=h[8] | (h[9] << 8) | (h[10] << 16) | ((uint32_t)h[11] << 24);
+ return (log_seq[s]!=0);
+}
+
+
+// reads the record offsets of sector s into a log_pg_off[] page, counts its lines. check=1 (at
+// boot) reads the whole records and marks those that were cut short. Returns where the next record
+// would go, log_sectorsize if nothing more may be written there.
+int myLogPage(int s, int check)
+{
+ int p=log_pg_old;
+ int pos=log_hdrsize;
+ int len;
+ byte kill[2];
+ log_pg_old=1-p;
+ log_pg[p]=s;
+ log_count[s]=0;
+ log_pageins++;
+ while((pos+4<=log_sectorsize) && (log_count[s]<log_pgmax))
+ {
+  len=myLogRecord(s, pos, check);
+  if(len==0) return pos; // erased, the end
+  if(len<0) return log_sectorsize; // garbage, don't write over it
+  if(log_buf[0]==1)
+  {
+   log_pg_off[p][log_count[s]]=pos;
+   log_count[s]++;
+  }
+  else if(log_buf[0]==2) // cut short by a power loss
+  {
+   log_torn++;
+   kill[0]=log_buf[1];
+   kill[1]=log_buf[2] & ~(log_live >> 8);
+   esp_partition_write(log_part, s*log_sectorsize+pos, kill, 2);
+  }
+  pos+=len;
+ }
+ return log_sectorsize;
+}
+
+
+// the log_pg_off[] page with the record offsets of sector s, read in if need be
+int myLogPaged(int s)
+{
+ if(log_pg[0]==s) {log_pg_old=1; return 0;}
+ if(log_pg[1]==s) {log_pg_old=0; return 1;}
+ myLogPage(s, 0);
+ return 1-log_pg_old;
+}
+
+
+// reads the header of the record at pos in sector s into log_buf[1..4], with check=1 the rest of it
+// too. log_buf[0] is 1 if it's a line, 0 if it was cut short, 2 if it was cut short and isn't marked
+// yet (wrong CRC). Returns its size with padding, 0 if the flash is erased there, -1 if it isn't a
+// record.
+int myLogRecord(int s, int pos, int check)
+{
+ int len;
+ uint16_t crc;
+ if(esp_partition_read(log_part, s*log_sectorsize+pos, log_buf+1, 4)!=ESP_OK) return -1;
+ len=log_buf[1] | (log_buf[2] << 8);
+ crc=log_buf[3] | (log_buf[4] << 8);
+ if(len==0xFFFF) return 0;
+ log_buf[0]=((len & log_live)!=0);
+ len&=~log_live;
+ if((len<6) || (len>6+ui_linemax) || (pos+4+len>log_sectorsize)) return -1;
+ if((check==1) && (log_buf[0]==1))
+ {
+  if(esp_partition_read(log_part, s*log_sectorsize+pos+4, log_buf+5, len)!=ESP_OK) return -1;
+  log_buf[5+len]=0;
+  if(myCrc16(0xFFFF, log_buf+5, len)!=crc) log_buf[0]=2;
+ }
+ return (4+len+3) & ~3;
+}
+
+
+// appends a chat line to the log. Returns 0 if the flash failed, the log is off then.
+int myLogAppend(const char *line, uint16_t from, int rssi, int hops, uint16_t seq)
+{
+ int n=min((int)strlen(line),ui_linemax);
+ int len=6+n;
+ int size=(4+len+3) & ~3;
+ int p;
+ int k;
+ uint16_t crc;
+ if((log_pos+size>log_sectorsize) || (log_count[log_head]>=log_pgmax)) myLogRotate();
+ if(log_part==0) return 0;
+ log_buf[5]=from & 255;
+ log_buf[6]=from >> 8;
+ log_buf[7]=(byte)rssi;
+ log_buf[8]=hops;
+ log_buf[9]=seq & 255;
+ log_buf[10]=seq >> 8;
+ memcpy(log_buf+11, line, n);
+ memset(log_buf+5+len, 0xFF, size-4-len); // the padding stays erased
+ crc=myCrc16(0xFFFF, log_buf+5, len);
+ log_buf[1]=len & 255;
+ log_buf[2]=(len | log_live) >> 8;
+ log_buf[3]=crc & 255;
+ log_buf[4]=crc >> 8;
+ for(p=0;p<size;p+=k) // a page at a time, the flash cache is off while one is written
+ {
+  k=min(size-p, log_pagesize-(log_pos+p)%log_pagesize);
+  if(esp_partition_write(log_part, log_head*log_sectorsize+log_pos+p, log_buf+1+p, k)!=ESP_OK)
+  {
+   log_fails++;
+   log_part=0;
+   return 0;
+  }
+ }
+ for(p=0;p<2;p++) if(log_pg[p]==log_head) log_pg_off[p][log_count[log_head]]=log_pos;
+ log_count[log_head]++;
+ log_pos+=size;
+ log_appends++;
+ return 1;
+}
+
+
+// goes on in the next sector: erases it if myLogErase() didn't (its lines, the oldest ones, are
+// gone) and writes its header
+void myLogRotate()
+{
+ int s=(log_head+1)%log_sectors;
+ int p;
+ byte h[log_hdrsize];
+ uint32_t seq=log_seq[log_head]+1;
+ unsigned long first=log_first[log_head]+log_count[log_head];
+ uint16_t crc;
+ int asked=0;
+ if(log_erased!=s) // not erased ahead (yet), the radio task mustn't be at it while we look
+ {
+  if(mesh_lock!=0) xSemaphoreTake(mesh_lock, portMAX_DELAY); // (none yet in myLogInit())
+  asked=(log_erase_req==s);
+  if(asked && (log_erase_done==s)) log_erased=s; // just done
+  log_erase_req=-1;
+  if(mesh_lock!=0) xSemaphoreGive(mesh_lock);
+ }
+ if(log_erased==s) log_aheads++;
+ else
+ {
+  if(asked==0) // else myLogErase() did that
+  {
+   log_seq[s]=0; // not in the log while it's erased
+   log_count[s]=0;
+   for(p=0;p<2;p++) if(log_pg[p]==s) log_pg[p]=-1;
+   log_erases[s]++;
+  }
+  if(esp_partition_erase_range(log_part, s*log_sectorsize, log_sectorsize)!=ESP_OK)
+  {
+   log_fails++;
+   log_part=0;
+   return;
+  }
+ }
+ log_erased=-1;
+ h[0]=log_magic & 255; h[1]=(log_magic >> 8) & 255; h[2]=(log_magic >> 16) & 255; h[3]=log_magic >> 24;
+ h[4]=seq & 255; h[5]=(seq >> 8) & 255; h[6]=(seq >> 16) & 255; h[7]=seq >> 24;
+ h[8]=first & 255; h[9]=(first >> 8) & 255; h[10]=(first >> 16) & 255; h[11]=(first >> 24) & 255;
+ h[12]=log_erases[s] & 255; h[13]=log_erases[s] >> 8;
+ crc=myCrc16(0xFFFF, h, 14);
+ h[14]=crc & 255; h[15]=crc >> 8;
+ if(esp_partition_write(log_part, s*log_sectorsize, h, log_hdrsize)!=ESP_OK)
+ {
+  log_fails++;
+  log_part=0;
+  return;
+ }
+ log_seq[s]=seq;
+ log_first[s]=first;
+ log_count[s]=0;
+ log_head=s;
+ log_pos=log_hdrsize;
+ p=log_pg_old; // an empty sector, its offsets are known
+ log_pg_old=1-p;
+ log_pg[p]=s;
+ if(log_pg[1-p]==s) log_pg[1-p]=-1;
+ log_rotations++;
+}
+
+
+// has the radio task erase the sector after log_head ahead, so myLogRotate() can go on there
+// without the 45 ms wait. Called by the house task on every pass, it also takes the answer.
+void myLogErase()
+{
+ int s=(log_head+1)%log_sectors;
+ int p;
+ if(log_erase_req>=0)
+ {
+  if(log_erase_done==-1) return; // not yet
+  if(log_erase_done==-2) {log_fails++; log_part=0;}
+  else log_erased=log_erase_req;
+  log_erase_req=-1;
+  return;
+ }
+ if((log_part==0) || (log_erased==s)) return;
+ log_seq[s]=0; // not in the log any more
+ log_count[s]=0;
+ for(p=0;p<2;p++) if(log_pg[p]==s) log_pg[p]=-1;
+ log_erases[s]++;
+ log_erase_done=-1;
+ log_erase_req=s;
+}
+
+
+// the radio task erases the sector myLogErase() asked for, when nothing is on the channel and it
+// has nothing to send for log_eraseT at least
+void myLogEraseRun()
+{
+ int s=log_erase_req;
+ int p;
+ if((s<0) || (log_erase_done!=-1) || (log_part==0)) return;
+ if((tx_busy==1) || (lbt_state!=0) || (rx_pending!=0) || (rx_ring_head!=rx_ring_tail) || (rx_sf!=lora_sf)) return;
+ if((pck_jobcount>0) && ((long)(pck_heapT[0]-millis())<(long)log_eraseT)) return;
+ for(p=0;p<tx_prios;p++) if(tx_q_head[p]!=tx_q_tail[p]) return;
+ if(LoRa.rssi()>=lbt_rssi) return; // a frame is coming in
+ log_erase_done=(esp_partition_erase_range(log_part, s*log_sectorsize, log_sectorsize)==ESP_OK) ? s : -2;
+}
+
+
+// number of the oldest line in the log, 0 if there is none
+unsigned long myLogOldest()
+{
+ int s;
+ unsigned long oldest=0;
+ for(s=0;s<log_sectors;s++)
+ {
+  if((log_seq[s]!=0) && (log_count[s]!=0) && ((oldest==0) || (log_first[s]<oldest))) oldest=log_first[s];
+ }
+ return oldest;
+}
+
+
+// text of chat line number lineno from the log, "" if it isn't there. Reads the record offsets of
+// its sector first if they aren't in RAM, a page of about 100 lines.
+const char *myLogGet(unsigned long lineno)
+{
+ int s;
+ int p;
+ int len;
+ for(s=0;s<log_sectors;s++)
+ {
+  if((log_seq[s]!=0) && (lineno>=log_first[s]) && (lineno<log_first[s]+log_count[s])) break;
+ }
+ if(s==log_sectors) return "";
+ p=myLogPaged(s);
+ if(lineno-log_first[s]>=log_count[s]) return ""; // (fewer lines than the boot scan found)
+ len=myLogRecord(s, log_pg_off[p][lineno-log_first[s]], 1);
+ if((len<=0) || (log_buf[0]!=1)) return "";
+ log_rd_from=log_buf[5] | (log_buf[6] << 8);
+ log_rd_rssi=(int8_t)log_buf[7];
+ log_rd_hops=log_buf[8];
+ log_rd_seq=log_buf[9] | (log_buf[10] << 8);
+ return (const char *)log_buf+11;
+}
+
+
+// blinks the LED once, 100 ms, after the blinks still pending. Returns at once, myHouse() does
+// the blinking, so it can be called from anywhere, the radio task included.
+void blinkLED(){
+  led_blinks++;
+  }
+
+void myLEDon(){digitalWrite(LED_BUILTIN, HIGH);}
+void myLEDoff(){digitalWrite(LED_BUILTIN, LOW);}
+
+
+
+
+// LoRa frames are received by the DIO0 interrupt: the LoRa library calls myLoraOnReceive()
+// as soon as the radio has a frame, no matter what the radio task is busy with. It notes the
+// frame's length and time and wakes the radio task, which fetches the frame from the radio's
+// FIFO (myLoraFetch()) before anything else. The next frame takes at least its preamble and
+// header to come in, and myTxRun() keeps tx_turnaround quiet after one, so the frame is still
+// there. If the last one wasn't fetched yet, it's lost and counted.
+void IRAM_ATTR myLoraOnReceive(int packetSize)
+{
+ rx_lastT=millis();
+ if(rx_pending!=0) rx_ring_overflows++; // the library points the FIFO at the new one
+ rx_pending=packetSize;
+ task_event[task_radio]=1;
+}
+
+
+// radio task: copies the frame myLoraOnReceive() told about from the radio's FIFO into the
+// rx_ring, with RSSI, SNR and time of arrival. If the ring is full it's dropped and counted.
+void myLoraFetch()
+{
+ unsigned int slot;
+ int i=0;
+ if(rx_pending==0) return;
+ rx_pending=0;
+ if(rx_ring_head-rx_ring_tail>=rx_ringsize) // ring full, myLoraPoll() didn't keep up
+ {
+  rx_ring_overflows++;
+  return;
+ }
+ slot=rx_ring_head & (rx_ringsize-1);
+ while((LoRa.available()) && (i<rx_framemax))
+ {
+  rx_ring_buf[slot][i]=LoRa.read();
+  i++;
+ }
+ rx_ring_len[slot]=i;
+ rx_ring_rssi[slot]=LoRa.packetRssi();
+ rx_ring_snr[slot]=LoRa.packetSnr();
+ rx_ring_T[slot]=rx_lastT;
+ rx_ring_head++;
+}
+
+
+// The following function lies at the core of the OS. It takes the LoRa frames myLoraFetch()
+// stored in the rx_ring and hands them to the local chat messages array. If it receives a
+// "yell" type message, it checks whether it re-broadcasted this packet already, and if not, it
+// will schedule it for re-broadcasting once (myDupCheck() remembers the packet from then on).
+// Additionally it checks whether any packet is scheduled for re-broadcasting at the current moment,
+// and if so it hands this packet to the transmit queue, which it keeps going as well.
+// It's the radio task, myRadioCore() runs it on core 0 (loop() with dualcore=0) every millisecond
+// and whenever a radio interrupt came in.
+// A call from inside (eg. some day a function used here that itself calls it again) just returns.
+void myLoraPoll()
+{
+ static int busy=0;
+ int found=0;
+ unsigned int slot;
+ byte *b;
+ XplFrame f;
+ byte text[255];
+ byte meta[6];
+ int readable;
+ String line;
+ if(busy==1) return;
+ busy=1;
+ myLoraFetch(); // the frame the interrupt told about, before we send anything over it
+
+ if(rx_ring_overflows!=rx_ring_overflows_shown){ // tell about frames the ring had to drop
+  rx_ring_overflows_shown=rx_ring_overflows;
+  if(ser_kiss==0) Serial.println("LoRa RX ring overflow, frames dropped so far: "+String(rx_ring_overflows_shown));
+ }
+
+ while(rx_ring_tail!=rx_ring_head){
+   slot=rx_ring_tail & (rx_ringsize-1);
+   b=rx_ring_buf[slot];
+   if(ser_kiss==1) // modem mode: the host gets every frame, before we touch it
+   {
+    meta[0]=(byte)(rx_ring_rssi[slot] < -128 ? -128 : rx_ring_rssi[slot]);
+    meta[1]=(byte)(int)(rx_ring_snr[slot]*4);
+    meta[2]=(rx_ring_T[slot] >> 24) & 255;
+    meta[3]=(rx_ring_T[slot] >> 16) & 255;
+    meta[4]=(rx_ring_T[slot] >> 8) & 255;
+    meta[5]=rx_ring_T[slot] & 255;
+    if(myKissSend(kiss_cmd_frame, meta, 6, b, rx_ring_len[slot])==1) ser_streamed++;
+    else ser_dropped++;
+   }
+   // investigte packet, right where myLoraFetch() put it...
+   if(myFrameParse(b, rx_ring_len[slot], &f)==1) // is XPLORA data packet
+   {
+    found=0;
+    myRouteHeard(&f); // whoever sent it is a neighbour, and its origin reachable over them
+    myNbHeard(&f, rx_ring_rssi[slot], rx_ring_snr[slot]); // ... and that well
+    if((f.type==pck_type_yell) || (f.type==pck_type_rreq) || ((f.type==pck_type_direct) && (f.next==addr_all))) // "yell", unlike "speak" to be re-broadcasted once. So are route requests, and direct messages nobody knew a route for.
+    {
+      // did we send or re-broadcast this already?
+      found=myDupCheck(f.origin, f.seq);
+      if((found==0) && (f.type==pck_type_rreq) && (f.dest==my_addr)) myRouteReply(&f); // it's us they look for
+      else if((found==0) && (f.type==pck_type_direct) && (f.dest==my_addr)) myDmReceive(&f); // the first copy, our ACK goes back the way it came
+      else if(found==0) // not sent already, re-broadcast!
+      {
+        // we have found out we have to re-broadcast this packet, but sending it right now
+        // would cause havoc when multiple stations would repeat it right now, at the same time.
+        // So we schedule it for sending, using a random delay.
+        if(f.ttl==1) pck_ttl_expired++; // we are its last hop
+        else
+        {
+         if((f.legacy==0) && (f.hops<15)) b[6]+=16; // count the hop in the copy we send
+         if(f.ttl>1) b[4]-=16; // and the TTL down
+         if(f.flags & pck_flag_from) {b[7]=my_addr >> 8; b[8]=my_addr & 255;} // and that it's us who sends the copy
+         myJobAdd(millis()+myJobDelay(rx_ring_rssi[slot]), f.origin, f.seq, b, rx_ring_len[slot]); // point in time to send it, and a copy of the packet
+        }
+      }else{ // found=1, we sent it already or it's still pending: a neighbour re-broadcasted it, count that
+       myJobHeard(f.origin, f.seq);
+      }
+    } // endif pck type 1?
+    if((f.type==pck_type_direct) || (f.type==pck_type_rrep) || (f.type==pck_type_ack)) // passed on along a route
+    {
+      found=1; // nothing to show, unless it's for us
+      if((f.next==my_addr) && (f.dest!=my_addr)) myRouteForward(b, rx_ring_len[slot], &f); // we are the next hop
+      else if(f.next==my_addr) // it's for us
+      {
+       if(f.flags & pck_flag_frag) myDmReceive(&f); // a piece of a reliable one, shown when it's complete
+       else found=myDupCheck(f.origin, f.seq); // a route reply did its job by being heard already
+       if(f.flags & pck_flag_ack) myDmAcked(f.origin, f.ackid, f.ackmask);
+       if(f.type==pck_type_ack) for(int i=0;i+3<=f.len;i+=3) myDmAcked(f.origin, f.payload[i], (f.payload[i+1] << 8) | f.payload[i+2]);
+      }
+    }
+    if(f.type==pck_type_rate) // a neighbour has frames for us, at a faster rate
+    {
+      found=1;
+      if((f.next==my_addr) && (f.len>=3)) myAdrListen(f.payload[0], (f.payload[1] << 8) | f.payload[2]);
+    }
+    readable=((f.flags & ~pck_flags_known)==0);
+    if((readable==1) && (found==0) && (f.flags & pck_flag_zip)) // compressed text we'll show? uncompress it
+    {
+     f.len=myZipDecode(f.payload, f.len, text, sizeof(text));
+     f.payload=text;
+     if(f.len<0) readable=0; // damaged
+    }
+    if(((f.type==pck_type_speak) || (((f.type==pck_type_yell) || (f.type==pck_type_direct)) && (found==0))) && (readable==1)) // is it a speak, or a new yell or direct message? Then show it onscreen etc.
+      {
+       line="";
+       line.reserve(f.namelen+6+f.len);
+       if(f.type==pck_type_direct) line+="*"; // for our eyes only, "*ABC(2):hi"
+       line.concat((const char *)f.name, f.namelen);
+       if(f.hops>0) line+="("+String(f.hops)+")"; // came over f.hops re-broadcasts, "ABC(2):hi"
+       line+=":";
+       if(f.legacy==0) pck_hops_heard[f.hops]++;
+       line.concat((const char *)f.payload, f.len);
+       myChatHeard(line, &f, rx_ring_rssi[slot]);//    add received msg to the chat store, it wakes the screen
+      }
+   } // proper XPLORA packet?
+   rx_ring_tail++; // slot is free again
+ } // wend frames in the ring
+
+  // check schedule whether we must re-broadcast a packet...------------------------------------------------
+ mySendRun(); // messages from the screen
+ myJobRun();
+ myRouteRun(); // direct messages waiting for a route
+ myDmRun(); // ... or for their ACK, and ACKs we owe
+ myAdrRun(); // window to listen faster in over?
+ myTxRun(); // radio done with the last frame? send the next one
+ myKissRun(); // serial modem mode: frames from the host, and room for more
+ myLogEraseRun(); // the chat log's next sector, if now is a good moment
+ if((repeater==1) && (millis()-rep_T>=rep_reportT))
+ {
+  rep_T+=rep_reportT;
+  myRepeaterReport();
+ }
+ busy=0;
+}
+
+
+// schedules a re-broadcast of the packet data[0..len-1] (origin, sequence number seq) for
+// millis()==T. Returns 0 if the schedule is full, the packet is then not re-broadcasted.
+int myJobAdd(unsigned long T, uint16_t origin, int seq, const byte *data, int len)
+{
+ int i;
+ int slot;
+ if(pck_pool_freecount==0)
+ {
+  pck_job_overflows++;
+  if(ser_kiss==0) Serial.println("Re-broadcast schedule full, jobs refused so far: "+String(pck_job_overflows));
+  return 0;
+ }
+ if(len>255) len=255;
+ pck_pool_freecount--;
+ slot=pck_pool_free[pck_pool_freecount];
+ memcpy(pck_pool[slot],data,len);
+ pck_pool_len[slot]=len;
+ // append at the end of the heap and let it rise to its place
+ i=pck_jobcount;
+ pck_jobcount++;
+ while((i>0) && ((long)(T-pck_heapT[(i-1)/2])<0))
+ {
+  pck_heapT[i]=pck_heapT[(i-1)/2];
+  pck_heapslot[i]=pck_heapslot[(i-1)/2];
+  i=(i-1)/2;
+ }
+ pck_heapT[i]=T;
+ pck_heapslot[i]=slot;
+ pck_pool_origin[slot]=origin;
+ pck_pool_seq[slot]=seq;
+ pck_pool_heard[slot]=0;
+ if(pck_jobcount>pck_job_maxdepth) pck_job_maxdepth=pck_jobcount;
+ return 1;
+}
+
+
+// a copy of packet origin/seq was overheard: if its re-broadcast is still pending and this was
+// the pck_suppress-th copy, the job is cancelled. Returns 1 then.
+int myJobHeard(uint16_t origin, int seq)
+{
+ int i;
+ int slot;
+ for(i=0;i<pck_jobcount;i++) // few jobs pending at any time, a look at each is fine
+ {
+  slot=pck_heapslot[i];
+  if((pck_pool_origin[slot]==origin) && (pck_pool_seq[slot]==seq))
+  {
+   pck_pool_heard[slot]++;
+   if((pck_suppress>0) && (pck_pool_heard[slot]>=pck_suppress))
+   {
+    myJobRemove(i);
+    pck_job_suppressed++;
+    return 1;
+   }
+   return 0;
+  }
+ }
+ return 0;
+}
+
+
+// ms to wait before re-broadcasting a packet we received with rssi dBm
+unsigned long myJobDelay(int rssi)
+{
+ long x;
+ if(pck_rssi_delay==0) return 100+random(2000);
+ x=constrain(rssi,pck_rssi_far,pck_rssi_near)-pck_rssi_far; // 0 for far stations
+ return 100+(1000*x)/(pck_rssi_near-pck_rssi_far)+random(1000);
+}
+
+
+// takes job i off the heap and frees its pool slot: the last job moves into its place and
+// rises or sinks to where it belongs
+void myJobRemove(int i)
+{
+ int c;
+ int slot;
+ unsigned long T;
+ pck_pool_free[pck_pool_freecount]=pck_heapslot[i]; // the pool slot can be used again
+ pck_pool_freecount++;
+ pck_jobcount--;
+ if(i==pck_jobcount) return; // was the last one
+ T=pck_heapT[pck_jobcount];
+ slot=pck_heapslot[pck_jobcount];
+ while((i>0) && ((long)(T-pck_heapT[(i-1)/2])<0))
+ {
+  pck_heapT[i]=pck_heapT[(i-1)/2];
+  pck_heapslot[i]=pck_heapslot[(i-1)/2];
+  i=(i-1)/2;
+ }
+ while(2*i+1<pck_jobcount)
+ {
+  c=2*i+1; // the earlier of both children
+  if((c+1<pck_jobcount) && ((long)(pck_heapT[c+1]-pck_heapT[c])<0)) c++;
+  if((long)(pck_heapT[c]-T)>=0) break;
+  pck_heapT[i]=pck_heapT[c];
+  pck_heapslot[i]=pck_heapslot[c];
+  i=c;
+ }
+ pck_heapT[i]=T;
+ pck_heapslot[i]=slot;
+}
+
+
+// moves every scheduled re-broadcast that is due into the transmit queue. If the re-broadcast
+// ring of the queue is full (duty cycle budget used up...) the jobs stay in the heap until there is room.
+void myJobRun()
+{
+ int slot;
+ unsigned long late;
+ while((pck_jobcount>0) && ((long)(millis()-pck_heapT[0])>=0) && (tx_q_head[tx_prio_relay]-tx_q_tail[tx_prio_relay]<tx_qsize))
+ {
+  slot=pck_heapslot[0];
+  late=millis()-pck_heapT[0];
+  // rebroadcast!
+  myTxAdd(tx_prio_relay, pck_pool[slot], pck_pool_len[slot]);
+  myJobRemove(0); // take it off the heap
+  pck_job_sent++;
+  pck_job_late_sum+=late;
+  if(late>pck_job_late_max) pck_job_late_max=late;
+ }
+}
+
+
+// learns what frame f tells about routes: the station that sent it is a neighbour, its origin is
+// hops+1 away over that neighbour. Frames without "from" only tell about the origin, if they
+// weren't re-broadcasted.
+void myRouteHeard(const XplFrame *f)
+{
+ if(f->legacy==1) return;
+ if(f->flags & pck_flag_from)
+ {
+  if(f->from==f->origin) myRouteLearn(f->origin, f->from, 1, f->name, f->namelen);
+  else
+  {
+   myRouteLearn(f->from, f->from, 1, 0, 0);
+   myRouteLearn(f->origin, f->from, f->hops+1, f->name, f->namelen);
+  }
+ }
+ else if(f->hops==0) myRouteLearn(f->origin, f->origin, 1, f->name, f->namelen);
+}
+
+
+// station dest is hops away over neighbour next (and named name, if that isn't 0). Taken if we
+// knew no route to dest, the new one isn't longer, it's over the same neighbour (which confirms
+// or updates ours), or ours wasn't confirmed for rt_fresh.
+void myRouteLearn(uint16_t dest, uint16_t next, int hops, const byte *name, int namelen)
+{
+ int set=(((uint32_t)dest*40503) >> 8) & (rt_sets-1);
+ int i;
+ int e=-1;
+ int oldest=-1;
+ unsigned long ms=millis();
+ if(dest==my_addr) return;
+ for(i=set*rt_ways;i<(set+1)*rt_ways;i++)
+ {
+  if((rt_hops[i]!=0) && (rt_dest[i]==dest)) {e=i; break;}
+  if(rt_hops[i]==0) {if((oldest<0) || (rt_hops[oldest]!=0)) oldest=i;} // free entries first
+  else if((oldest<0) || ((rt_hops[oldest]!=0) && ((long)(rt_T[i]-rt_T[oldest])<0))) oldest=i;
+ }
+ if(e<0) // new destination, takes a free entry or the stalest one
+ {
+  e=oldest;
+  rt_dest[e]=dest;
+  rt_hops[e]=0;
+  rt_name[e][0]=0;
+ }
+ if((rt_hops[e]==0) || (rt_next[e]==next) || (hops<=rt_hops[e]) || (ms-rt_T[e]>rt_fresh))
+ {
+  rt_next[e]=next;
+  rt_hops[e]=min(hops,255);
+  rt_T[e]=ms;
+ }
+ if(name!=0)
+ {
+  namelen=min(namelen,3);
+  memcpy(rt_name[e],name,namelen);
+  rt_name[e][namelen]=0;
+ }
+}
+
+
+// route table entry of station dest, -1 if we know no route to it (anymore)
+int myRouteFind(uint16_t dest)
+{
+ int set=(((uint32_t)dest*40503) >> 8) & (rt_sets-1);
+ int i;
+ for(i=set*rt_ways;i<(set+1)*rt_ways;i++)
+ {
+  if((rt_hops[i]!=0) && (rt_dest[i]==dest))
+  {
+   if(millis()-rt_T[i]<=rt_maxage) return i;
+   rt_hops[i]=0; // aged out
+   return -1;
+  }
+ }
+ return -1;
+}
+
+
+// name of station dest for the screen, its address in hex if we never heard its name
+String myRouteName(uint16_t dest)
+{
+ int r=myRouteFind(dest);
+ if((r>=0) && (rt_name[r][0]!=0)) return String(rt_name[r]);
+ return String(dest, HEX);
+}
+
+
+// passes on direct message or route reply b[0..len-1] (taken apart in f), we are its next hop
+void myRouteForward(byte *b, int len, const XplFrame *f)
+{
+ int r=myRouteFind(f->dest);
+ if((r<0) || (f->ttl==1))
+ {
+  rt_dropped++;
+  return;
+ }
+ if(f->hops<15) b[6]+=16;
+ if(f->ttl>1) b[4]-=16;
+ b[7]=my_addr >> 8; // from
+ b[8]=my_addr & 255;
+ b[11]=rt_next[r] >> 8; // next
+ b[12]=rt_next[r] & 255;
+ myTxAdd(tx_prio_relay, b, len);
+ rt_forwarded++;
+}
+
+
+// asks everyone up to ttl hops away (0 = all) for a route to dest
+void myRouteRequest(uint16_t dest, int ttl)
+{
+ byte frame[32];
+ int n;
+ my_seq=(my_seq+1) & seq_mask;
+ myDupCheck(my_addr,my_seq);
+ n=myFrameBuild(frame, pck_type_rreq, pck_flag_from, my_addr, my_seq, ttl, dest, addr_all, 0, username, (const byte *)"", 0);
+ myTxAdd(tx_prio_own, frame, n);
+ rt_rreq_sent++;
+}
+
+
+// answers route request f, which was looking for us. The way back to its origin we learned from
+// the request itself, the reply waits rt_reply_delay though: the stations along that way are
+// still busy re-broadcasting the request, and meanwhile we may hear of a shorter way.
+void myRouteReply(const XplFrame *f)
+{
+ byte frame[32];
+ int n;
+ my_seq=(my_seq+1) & seq_mask;
+ myDupCheck(my_addr,my_seq);
+ n=myFrameBuild(frame, pck_type_rrep, pck_flag_from, my_addr, my_seq, rt_ttl, f->origin, addr_all, 0, username, (const byte *)"", 0);
+ if(myRouteWait(f->origin, frame, n, millis()+rt_reply_delay, rt_tries)==1) rt_rrep_sent++; // no route requests of our own for it
+}
+
+
+// parks frame (a direct message or route reply) until there is a route to dest and sendT has
+// come, see myRouteRun(). Returns 0 if there's no room.
+int myRouteWait(uint16_t dest, const byte *frame, int len, unsigned long sendT, int tries)
+{
+ int i;
+ for(i=0;(i<rt_waitn) && (rt_wait_len[i]!=0);i++);
+ if(i==rt_waitn) return 0;
+ memcpy(rt_wait_buf[i],frame,len);
+ rt_wait_len[i]=len;
+ rt_wait_dest[i]=dest;
+ rt_wait_sendT[i]=sendT;
+ rt_wait_T[i]=millis(); // ask right away
+ rt_wait_tries[i]=tries;
+ return 1;
+}
+
+
+// sends the frames that waited for a route and found one, asks again for the others from time
+// to time, and gives up after rt_tries route requests
+void myRouteRun()
+{
+ int i;
+ int r;
+ for(i=0;i<rt_waitn;i++)
+ {
+  if(rt_wait_len[i]==0) continue;
+  r=myRouteFind(rt_wait_dest[i]);
+  if((r>=0) && ((long)(millis()-rt_wait_sendT[i])<0)) continue; // not yet
+  if(r>=0) // got one, fill in the next hop and off it goes
+  {
+   rt_wait_buf[i][11]=rt_next[r] >> 8;
+   rt_wait_buf[i][12]=rt_next[r] & 255;
+   myTxAdd(((rt_wait_buf[i][1] & 15)==pck_type_direct) ? tx_prio_own : tx_prio_relay, rt_wait_buf[i], rt_wait_len[i]);
+   rt_wait_len[i]=0;
+  }
+  else if((long)(millis()-rt_wait_T[i])>=0)
+  {
+   if(rt_wait_tries[i]==rt_tries)
+   {
+    if((rt_wait_buf[i][1] & 15)==pck_type_direct)
+    {
+     rt_given_up++;
+     myChatAdd("no route to "+String(rt_wait_dest[i], HEX));
+    }
+    rt_wait_len[i]=0;
+    continue;
+   }
+   // first ask the neighbourhood, then everyone, the flood takes its time
+   myRouteRequest(rt_wait_dest[i], (rt_wait_tries[i]==0) ? rt_ttl_first : 0);
+   rt_wait_T[i]=millis()+((rt_wait_tries[i]==0) ? 5000 : 20000);
+   rt_wait_tries[i]++;
+  }
+ }
+}
 
-void myLEDon(){digitalWrite(LED_BUILTIN, HIGH);}
-void myLEDoff(){digitalWrite(LED_BUILTIN, LOW);}
 
+// the radio finished sending a frame, called by the LoRa library from the DIO0 interrupt.
+// The radio is in standby now, the radio task it wakes takes it back to listening at once (see
+// myTxRun()), the answer to our frame (a route reply passed on, the next hop of a direct
+// message...) may be on its way already.
+void IRAM_ATTR myLoraOnTxDone()
+{
+ tx_done=1;
+ task_event[task_radio]=1; // back to receive, and the next frame can go
+}
 
 
+// puts a frame into the transmit queue, ring prio (tx_prio_...). Returns 0 if that ring is full,
+// the frame is then dropped.
+int myTxAdd(int prio, const byte *data, int len)
+{
+ unsigned int slot;
+ if(tx_q_head[prio]-tx_q_tail[prio]>=tx_qsize)
+ {
+  tx_overflows++;
+  if(ser_kiss==0) Serial.println("TX queue full, frames refused so far: "+String(tx_overflows));
+  return 0;
+ }
+ if(len>255) len=255;
+ slot=tx_q_head[prio] & (tx_qsize-1);
+ memcpy(tx_q_buf[prio][slot],data,len);
+ tx_q_len[prio][slot]=len;
+ tx_q_head[prio]++;
+ tx_queued_bytes+=len;
+ if(tx_queued_bytes>tx_queued_bytes_max) tx_queued_bytes_max=tx_queued_bytes;
+ myTxRun(); // radio idle? then it goes out right now
+ return 1;
+}
 
-// The following function lies at the core of the OS, it substitutes the delay() function,
-// but rather than to just "delay" it listens to LoRa packets, and in case one is received,
-// writes it into the local chat messages array. If it receives a "yell" type message, it
-// checks whether it re-broadcasted this packet already, and if not, it will schedule it
-// for re-broadcasting once, and write the packet ID to the stack of already sent packets.
-// Additionally it checks whether any packet is scheduled for re-broadcasting at the current moment,
-// and if so it sends this packet and removes its scheduling from the packet jobs stack.
 
-// Note: do not use any function call inside this function that by itself calls this function
-// (example: blinkLED() ), as it would be a recursive call and probably cause a stack overflow crash.
-void mydelay(int t)
-{  
- int pck_id=0;
- int found=0;
- int pck_type=0; 
- int i=0;
- int packetSize = 0;
- int ms=millis()+t;
- String msg="";
- while(millis()<ms){
-  packetSize = LoRa.parsePacket();
-  if (packetSize) {
-   // Serial.print("Received packet '");
-   msg="";
-   while (LoRa.available()) {
-     msg+=(char)LoRa.read();
-   }
-   // investigte packet...
-   if(msg.length()>12) // minimal length for XPLORA packet
-   {
-    if(msg.substring(0,3)=="XPL") // is XPLORA data packet header
-    {
-     pck_type=0; 
-     if(msg.substring(3,4)=="0") pck_type=0; // packet is of type "speak"
-     if(msg.substring(3,4)=="1") pck_type=1; // or "yell", unlike "speak" to be re-broadcasted once.
+// keeps the transmit queue going: when the radio is done with the last frame it goes back to
+// receiving (at once, the interrupt wakes the radio task for that), and the first frame of the most important non-empty ring is sent, if the duty cycle
+// budget allows. Called from myLoraPoll(), so about every millisecond.
+void myTxRun()
+{
+ int p;
+ unsigned int slot;
+ unsigned long toa;
+ unsigned long ms=millis();
+ byte rate[32];
+ int ratelen;
+ int ratesf;
+ const byte *data;
+ int len;
+ int sf;
+ if(tx_busy==1)
+ {
+  if((tx_done==0) && (ms-tx_startT<tx_toa+1000)) return; // still on air (the timeout is in case the interrupt got lost)
+  if(tx_sf!=rx_sf) LoRa.setSpreadingFactor(rx_sf); // it went out faster than we listen
+  LoRa.receive();
+  tx_busy=0;
+  if(tx_rate==1) tx_holdT=ms+adr_switch; // give our neighbour time to switch to the faster rate
+  tx_rate=0;
+  myLEDoff();
+ }
+ for(p=0;p<tx_prios;p++) if(tx_q_head[p]!=tx_q_tail[p]) break;
+ if(p==tx_prios) return; // nothing to send
+ if(ms-rx_lastT<tx_turnaround) return; // a reply right on the heels of a frame would find its sender still transmitting
+ if((long)(ms-tx_holdT)<0) return;
+ slot=tx_q_tail[p] & (tx_qsize-1);
+ data=tx_q_buf[p][slot];
+ len=tx_q_len[p][slot];
+ sf=myAdrTxSf(data, len, rate, &ratelen, &ratesf);
+ if(sf<0) return; // its receiver listens at another rate for now
+ if(sf==0) // a rate frame goes first, the frame stays queued until it's out
+ {
+  data=rate;
+  len=ratelen;
+  sf=ratesf;
+ }
+ toa=(myLoraAirtimeAt(len, sf)+999)/1000;
 
-     if(pck_type==1)
-     {
-      // search sent-packets ID stack, did we send this already?
-      pck_id=myHexToInt(msg.substring(4,11));
-      found=0;
-      for(i=0;i< pck_stacksize; i++)
-      {
-        if(pck_stack[i]==pck_id) found=1;
-      }
-      if(found==0) // not sent already, re-broadcast!
-      {
-        // we have found out we have to re-broadcast this packet, but sending it right now
-        // would cause havoc when multiple stations would repeat it right now, at the same time.
-        // So we schedule it for sending, using a random delay.
-        pck_jobT[pck_jobcount]=millis()+100+random(2000);  // point in time to send it
-        pck_job[pck_jobcount]=msg; // make copy of the packet
-        pck_jobcount++;
-        if(pck_jobcount>(pck_jobsize-1)) pck_jobcount=0; // yet another "stack" we just cycle through, overwriting oldest entries as they should be obsolete anyway.
-        // (that is currently 100 packets scheduled at max)
-        
-        pck_stack[pck_stackpointer]=pck_id;  // and remember it in a other stack, so we re-broadcast it only once
-        pck_stackpointer++;
-        if(pck_stackpointer>=pck_stacksize){ pck_stackpointer=0;}
-      }else{ // found=1, ignore this packet as we sent it already
-       //... hence do nothing here
-      }
-    } // endif pck type 1?
-    if((pck_type==0) || ( (pck_type==1) && (found==0) ) ) // is it type 0 or type 1 and new? Then show it onscreen etc.
-      {
-       for(i=0;i<chatn;i++){//
-        chat[i]=chat[i+1];//
-       }//    Next
-       chat[chatn]=msg.substring(12);//    add received msg to chat string array
-       chatxo=0;
-       // print RSSI of packet, radio signal strength indicator?
-       // Serial.print("' with RSSI ");
-       // Serial.println(LoRa.packetRssi());
-       screensaverT=millis()+screensaverAfter;
-      }
-  } // proper XPLn packet header? 
- } // packet length >12?
+ // does it fit into the duty cycle budget of the last hour?
+ myDutyAdvance();
+ if((dc_band>=0) && (dc_sum[dc_band]+toa>(unsigned long)dc_band_permille[dc_band]*dc_slots*dc_slotT/1000))
+ {
+  if(tx_waiting==0)
+  {
+   tx_waiting=1;
+   tx_dc_waits++;
+   if(ser_kiss==0) Serial.println("Duty cycle budget used up, sending held back");
+  }
+  else tx_dc_waitT+=ms-tx_waitT;
+  tx_waitT=ms;
+  return;
+ }
+ if(tx_waiting==1)
+ {
+  tx_waiting=0;
+  tx_dc_waitT+=ms-tx_waitT;
+ }
+ if((sf==lora_sf) && (myLbtClear(sf)==0)) return; // listening first, or someone else is on air
+
+ if(LoRa.beginPacket()==0) return; // radio still busy, try again next time
+ if(sf!=rx_sf) LoRa.setSpreadingFactor(sf); // switched back once it's out
+ LoRa.write(data,len);
+ tx_done=0;
+ tx_busy=1;
+ tx_sf=sf;
+ tx_startT=ms;
+ tx_toa=toa;
+ LoRa.endPacket(true); // returns right away, myLoraOnTxDone() tells when the frame is out
+ myLEDon();
+ if(dc_band>=0)
+ {
+  dc_used[dc_band][dc_slot_now % dc_slots]+=toa;
+  dc_sum[dc_band]+=toa;
+  if(dc_sum[dc_band]>tx_dc_max) tx_dc_max=dc_sum[dc_band];
+ }
+ tx_frames++;
+ tx_airtime+=toa;
+ if(data==rate)
+ {
+  adr_saved-=toa;
+  tx_rate=1;
+  adr_rates++;
+  myAdrSent(rate, len, toa);
+  return;
+ }
+ if(sf<lora_sf)
+ {
+  adr_fast++;
+  adr_saved+=(long)((myLoraAirtime(len)+999)/1000)-(long)toa;
+ }
+ tx_queued_bytes-=tx_q_len[p][slot];
+ tx_q_tail[p]++;
+}
+
+
+// time on air of a frame with len bytes payload at our radio settings, in microseconds
+// (the formula from the Semtech SX1276 datasheet, explicit header)
+unsigned long myLoraAirtime(int len)
+{
+ return myLoraAirtimeAt(len, lora_sf);
+}
 
 
- } // endif whether lora received any packet
+// ... at spreading factor sf instead of the base rate
+unsigned long myLoraAirtimeAt(int len, int sf)
+{
+ float tsym=(float)(1L << sf)*1E6/lora_bw; // symbol time, us
+ int de=(tsym>16000) ? 1 : 0; // the library switches on low data rate optimization above 16 ms symbols
+ long num=8L*len-4*sf+28+16*lora_crc;
+ long den=4*(sf-2*de);
+ long nsym=8;
+ if(num>0) nsym+=((num+den-1)/den)*lora_cr;
+ return (unsigned long)((lora_preamble+4.25+nsym)*tsym);
+}
+
 
-  // check schedule whether we must re-broadcast a packet...------------------------------------------------
-  int ms2=millis();
-  String msg2="";
-  for(i=0;i<pck_jobsize;i++)
+// learns from frame f who sent it and how well we hear them (rssi in dBm, snr in dB), see the
+// neighbour table
+void myNbHeard(const XplFrame *f, int rssi, float snr)
+{
+ uint16_t addr;
+ int set;
+ int i;
+ int e=-1;
+ int oldest=-1;
+ int gap;
+ unsigned long ms=max(millis(),1UL); // 0 is for unused entries
+ if(f->legacy==1) return;
+ if(f->flags & pck_flag_from) addr=f->from;
+ else if(f->hops==0) addr=f->origin;
+ else return; // a copy, we don't know who sent it
+ if(addr==my_addr) return;
+ set=(((uint32_t)addr*40503) >> 8) & (nb_sets-1);
+ for(i=set*nb_ways;i<(set+1)*nb_ways;i++)
+ {
+  if((nb_T[i]!=0) && (nb_addr[i]==addr)) {e=i; break;}
+  if((oldest<0) || ((nb_T[oldest]!=0) && ((nb_T[i]==0) || ((long)(nb_T[i]-nb_T[oldest])<0)))) oldest=i; // free entries first
+ }
+ if((e>=0) && (ms-nb_T[e]>nb_maxage)) nb_T[e]=0; // aged out, starts over
+ if((e<0) || (nb_T[e]==0)) // new neighbour, takes a free entry or the stalest one
+ {
+  if(e<0) e=oldest;
+  if((nb_T[e]!=0) && (ms-nb_T[e]<=nb_maxage)) nb_evicted++;
+  nb_addr[e]=addr;
+  nb_rssi[e]=rssi*4;
+  nb_snr[e]=(int)(snr*4);
+  nb_frames[e]=0;
+  nb_got[e]=0;
+  nb_lost[e]=0;
+  adr_fail[e]=0;
+ }
+ else
+ {
+  nb_rssi[e]+=(rssi*4-nb_rssi[e])/4;
+  nb_snr[e]+=((int)(snr*4)-nb_snr[e])/4;
+ }
+ nb_T[e]=ms;
+ nb_frames[e]++;
+ if(f->origin!=addr) return; // a re-broadcast, its sequence number is the origin's
+ gap=(f->seq-nb_seq[e]) & seq_mask;
+ if((nb_got[e]==0) && (nb_lost[e]==0)) gap=1; // the first one we hear
+ if((gap==0) || (gap>seq_mask+1-nb_lossn)) return; // one we had, or an older one that waited for a route
+ if(gap>nb_lossn) gap=1; // it was gone for long, or rebooted
+ nb_seq[e]=f->seq;
+ nb_got[e]++;
+ nb_lost[e]+=gap-1;
+ while(nb_got[e]+nb_lost[e]>=nb_lossn)
+ {
+  nb_got[e]/=2;
+  nb_lost[e]/=2;
+ }
+}
+
+
+// neighbour table entry of station addr, -1 if we didn't hear it for nb_maxage
+int myNbFind(uint16_t addr)
+{
+ int set=(((uint32_t)addr*40503) >> 8) & (nb_sets-1);
+ int i;
+ for(i=set*nb_ways;i<(set+1)*nb_ways;i++)
+ {
+  if((nb_T[i]!=0) && (nb_addr[i]==addr))
   {
-   if((pck_jobT[i]!=0)&&(ms2 > pck_jobT[i])) // if T=0 then it's nothing. Else, if millis>T then it's time for sending this msg.
-   {
-    // rebroadcast!
-    msg2=pck_job[i];
-    myLEDon();
-    LoRa.beginPacket();
-    LoRa.print(msg2); // actually re-broadcast it!
-    LoRa.endPacket();
-    delay(1);
-    myLEDoff();
-    pck_jobT[i]=0; // "delete" this job from packet-sending-schedule
-   }
+   if(millis()-nb_T[i]<=nb_maxage) return i;
+   nb_T[i]=0; // aged out
+   return -1;
+  }
+ }
+ return -1;
+}
+
+
+// percentage of its own frames we miss from neighbour table entry e, -1 if we have too few to tell
+int myNbLoss(int e)
+{
+ int n=nb_got[e]+nb_lost[e];
+ if(n<4) return -1;
+ return (nb_lost[e]*100+n/2)/n;
+}
+
+
+// writes the neighbour table to Serial, one line per neighbour. The lines are copied out under
+// mesh_lock and printed after it, Serial takes far longer than the radio task can wait.
+void myNbDump()
+{
+ int i;
+ int loss;
+ unsigned long ms=millis();
+ String rows="";
+ if(ser_kiss==1) return; // the host reads frames there
+ xSemaphoreTake(mesh_lock, portMAX_DELAY);
+ for(i=0;i<nb_sets*nb_ways;i++)
+ {
+  if((nb_T[i]==0) || (myNbFind(nb_addr[i])!=i)) continue;
+  loss=myNbLoss(i);
+  rows+=myRouteName(nb_addr[i])+"  "+String(nb_rssi[i]/4)+" dBm  "+String(nb_snr[i]/4.0f,1)+" dB  "+
+        ((loss<0) ? String("-") : String(loss)+"%")+"  "+String(nb_frames[i])+"  "+String((ms-nb_T[i])/1000)+" s ago\n";
+ }
+ xSemaphoreGive(mesh_lock);
+ Serial.println("neighbour  rssi   snr   loss  frames  heard");
+ Serial.print(rows);
+}
+
+
+// fastest spreading factor for frames to neighbour addr, lora_sf if we don't know it
+int myAdrSf(uint16_t addr)
+{
+ int e=myNbFind(addr);
+ int sf;
+ if((adr==0) || (e<0)) return lora_sf;
+ for(sf=7;sf<lora_sf;sf++) if(nb_snr[e]>=adr_snr_min[sf]+adr_margin) break;
+ return min(sf+adr_fail[e], lora_sf);
+}
+
+
+// spreading factor to send frame b[0..len-1] at. Returns 0 if its neighbour must be told to
+// listen faster first: the rate frame is then built into rate, its length put into *ratelen and
+// the spreading factor it goes at (the one the neighbour listens at now) into *ratesf. The
+// window we ask for covers all the frames we have queued for that neighbour, and the fragments
+// of our direct messages about to follow right away. While it's in a window, frames for it go
+// at the rate of that window, or wait for its end (returns -1). Only looks, myAdrSent() books
+// the window once the rate frame is really out.
+int myAdrTxSf(const byte *b, int len, byte *rate, int *ratelen, int *ratesf)
+{
+ XplFrame f;
+ XplFrame g;
+ int sf;
+ int p;
+ int open;
+ int k;
+ int r;
+ unsigned int t;
+ unsigned int slot;
+ long saved=0;
+ unsigned long window=adr_switch+adr_slack;
+ unsigned long ms=millis();
+ byte w[3];
+ if((adr==0) || (myFrameParse(b, len, &f)!=1) || (f.legacy==1)) return lora_sf;
+ if((f.type<pck_type_direct) || (f.type>pck_type_ack) || (f.next==addr_all)) return lora_sf; // meant for all
+ open=0;
+ if((tx_fast_next==f.next) && ((long)(ms-tx_fast_endT-adr_slack)<0)) // it listens at tx_fast_sf for now, or may still
+ {
+  if((long)(ms+myLoraAirtimeAt(len, tx_fast_sf)/1000+adr_slack/2-tx_fast_endT)<0) return tx_fast_sf; // long enough for this one
+  if((long)(ms+myLoraAirtimeAt(24, tx_fast_sf)/1000+adr_slack/2-tx_fast_endT)>=0) return -1; // not even for a rate frame
+  open=1;
+ }
+ sf=myAdrSf(f.next);
+ if(sf>=lora_sf) return (open==1) ? -1 : lora_sf;
+ for(p=0;p<tx_prios;p++)
+ {
+  for(t=tx_q_tail[p];t!=tx_q_head[p];t++)
+  {
+   slot=t & (tx_qsize-1);
+   if((myFrameParse(tx_q_buf[p][slot], tx_q_len[p][slot], &g)!=1) || (g.legacy==1) || (g.next!=f.next)) continue;
+   if((g.type<pck_type_direct) || (g.type>pck_type_ack)) continue;
+   window+=myLoraAirtimeAt(tx_q_len[p][slot], sf)/1000+tx_turnaround;
+   saved+=(long)(myLoraAirtime(tx_q_len[p][slot])/1000)-(long)(myLoraAirtimeAt(tx_q_len[p][slot], sf)/1000);
+  }
+ }
+ for(p=0;p<dm_txn;p++)
+ {
+  if((dm_tx_len[p]==0) || (dm_tx_todo[p]==0)) continue;
+  r=myRouteFind(dm_tx_dest[p]);
+  if((r<0) || (rt_next[r]!=f.next) || (myDmGap(rt_hops[r], 255)!=0)) continue;
+  for(k=0;k<16;k++)
+  {
+   if((dm_tx_todo[p] & (1 << k))==0) continue;
+   t=min(dm_tx_len[p]-k*dm_fragsize, dm_fragsize)+24+username.length(); // the frame it goes in
+   window+=myLoraAirtimeAt(t, sf)/1000+tx_turnaround;
+   saved+=(long)(myLoraAirtime(t)/1000)-(long)(myLoraAirtimeAt(t, sf)/1000);
+  }
+ }
+ window=min(window, 65535UL);
+ *ratesf=(open==1) ? tx_fast_sf : lora_sf;
+ w[0]=sf;
+ w[1]=window >> 8;
+ w[2]=window & 255;
+ *ratelen=myFrameBuild(rate, pck_type_rate, pck_flag_from, my_addr, (my_seq+1) & seq_mask, 1, f.next, f.next, 0, username, w, 3);
+ if((open==0) && (saved<=(long)(myLoraAirtimeAt(*ratelen, *ratesf)/1000))) return lora_sf; // doesn't pay off
+ return 0;
+}
+
+
+// the rate frame rate[0..len-1] built by myAdrTxSf() went on air, toa ms long: its neighbour
+// listens faster for us from now on
+void myAdrSent(const byte *rate, int len, unsigned long toa)
+{
+ XplFrame f;
+ if(myFrameParse(rate, len, &f)!=1) return;
+ my_seq=f.seq;
+ myDupCheck(my_addr,my_seq);
+ tx_fast_next=f.next;
+ tx_fast_sf=f.payload[0];
+ tx_fast_endT=millis()+toa+(((unsigned long)f.payload[1] << 8) | f.payload[2]);
+}
+
+
+// a neighbour has frames for us at spreading factor sf, we listen at that for window ms
+void myAdrListen(int sf, unsigned long window)
+{
+ if((adr==0) || (sf<7) || (sf>=lora_sf)) return;
+ rx_sf=sf;
+ rx_fastT=millis()+window;
+ adr_windows++;
+ if(tx_busy==1) return; // myTxRun() switches when the frame is out
+ LoRa.idle();
+ LoRa.setSpreadingFactor(sf);
+ LoRa.receive();
+ lbt_state=0; // that was the end of a CAD too, myLbtClear() starts another one
+}
+
+
+// back to the base rate when the window is over
+void myAdrRun()
+{
+ if((rx_sf==lora_sf) || ((long)(millis()-rx_fastT)<0)) return;
+ rx_sf=lora_sf;
+ if(tx_busy==1) return;
+ LoRa.idle();
+ LoRa.setSpreadingFactor(lora_sf);
+ LoRa.receive();
+ lbt_state=0;
+}
+
+
+// frames to neighbour addr got through (ok=1) or not: a failure slows its rate down a step,
+// every success speeds it up again
+void myAdrResult(uint16_t addr, int ok)
+{
+ int e=myNbFind(addr);
+ if(e<0) return;
+ if((ok==1) && (adr_fail[e]>0)) adr_fail[e]--;
+ if((ok==0) && (adr_fail[e]<12-7)) adr_fail[e]++;
+}
+
+
+// the CAD started by myLbtClear() is done, called by the LoRa library from the DIO0 interrupt.
+// Like myLoraOnTxDone() it leaves the radio in standby to the radio task it wakes, which takes it
+// back to listening at once: whatever is on air may be for us.
+void IRAM_ATTR myLoraOnCadDone(boolean busy)
+{
+ lbt_cad_busy=busy ? 1 : 0;
+ lbt_cad_done=1;
+ task_event[task_radio]=1; // send now, or back off
+}
+
+
+// listen before talk for a frame at spreading factor sf: returns 1 if the channel is free and
+// the frame may go out right now. Otherwise 0, while the CAD is running or we back off. Called
+// by myTxRun() on every pass until it says yes.
+int myLbtClear(int sf)
+{
+ unsigned long ms=millis();
+ unsigned long cadT=((2UL << lbt_sf)*1000)/lora_bw+1; // ms a CAD takes
+ unsigned long slotT=((lbt_slot << lbt_sf)*1000)/lora_bw; // ms
+ int be;
+ if(lbt==0) return 1;
+ if(lbt_state>=1)
+ {
+  if(lbt_cad_done==0)
+  {
+   if(ms-lbt_T<cadT+50) return 0; // still listening
+   lbt_state=0; // interrupt got lost (or a rate change cut the CAD short), start over
+   LoRa.idle();
+   if(rx_sf!=lbt_sf) LoRa.setSpreadingFactor(rx_sf);
+   LoRa.receive();
+   return 0;
+  }
+  if(lbt_state==1) // the radio is in standby after the CAD
+  {
+   if(rx_sf!=lbt_sf) LoRa.setSpreadingFactor(rx_sf);
+   LoRa.receive();
+  }
+  lbt_state=0;
+  if(ms-lbt_T>cadT+slotT) return 0; // too old to go by, myTxRun() was held up, listen again
+  if((lbt_cad_busy==0) && (lbt_sf==sf))
+  {
+   lbt_busyrow=0;
+   lbt_waitT+=ms-lbt_startT;
+   return 1;
+  }
+  if(lbt_cad_busy==0) return 0; // the frame at the head changed its rate, listen again for that
+  lbt_busy++;
+  if(lbt_busyrow==0) lbt_deferred++;
+  lbt_busyrow++;
+  if(lbt_busyrow>=lbt_tries) // busy for too long, send anyway
+  {
+   lbt_forced++;
+   lbt_busyrow=0;
+   lbt_waitT+=ms-lbt_startT;
+   return 1;
+  }
+  be=min(lbt_busyrow, lbt_be_max);
+  lbt_T=ms+random(1, (1L << be)+1)*slotT;
+  return 0;
+ }
+ if((long)(ms-lbt_T)<0) return 0; // backing off
+ if(lbt_busyrow==0) lbt_startT=ms;
+ lbt_sf=sf;
+ lbt_T=ms;
+ if(LoRa.rssi()>=lbt_rssi) // a frame is coming in right now, a CAD would cut it off
+ {
+  lbt_state=2;
+  lbt_loud++;
+  lbt_cad_busy=1;
+  lbt_cad_done=1; // taken as a busy CAD on the next call
+  return 0;
+ }
+ lbt_state=1;
+ lbt_cad_done=0;
+ lbt_cads++;
+ LoRa.idle();
+ if(sf!=rx_sf) LoRa.setSpreadingFactor(sf);
+ LoRa.channelActivityDetection();
+ return 0;
+}
+
+
+// CRC-16 (CCITT) of b[0..len-1], continuing crc (0xFFFF to start)
+uint16_t myCrc16(uint16_t crc, const byte *b, int len)
+{
+ int i;
+ int k;
+ for(i=0;i<len;i++)
+ {
+  crc^=(uint16_t)b[i] << 8;
+  for(k=0;k<8;k++) crc=(crc & 0x8000) ? (crc << 1)^0x1021 : crc << 1;
+ }
+ return crc;
+}
+
+
+// sends a KISS frame to the host: command cmd, head[0..headlen-1] and data[0..len-1] as its
+// data, and the CRC. Escaped into one buffer, so it goes to the UART in one write. Returns 0 if
+// the UART had no room for it, it's dropped then.
+int myKissSend(int cmd, const byte *head, int headlen, const byte *data, int len)
+{
+ byte out[2*(1+8+255+2)+2];
+ byte c=cmd;
+ byte crc[2];
+ const byte *part[4]={&c, head, data, crc};
+ int partlen[4]={1, headlen, len, 2};
+ uint16_t sum;
+ int n=0;
+ int i;
+ int k;
+ sum=myCrc16(myCrc16(myCrc16(0xFFFF, &c, 1), head, headlen), data, len);
+ crc[0]=sum >> 8;
+ crc[1]=sum & 255;
+ out[n++]=kiss_fend;
+ for(k=0;k<4;k++)
+ {
+  for(i=0;i<partlen[k];i++)
+  {
+   if(part[k][i]==kiss_fend) {out[n++]=kiss_fesc; out[n++]=kiss_tfend;}
+   else if(part[k][i]==kiss_fesc) {out[n++]=kiss_fesc; out[n++]=kiss_tfesc;}
+   else out[n++]=part[k][i];
+  }
+ }
+ out[n++]=kiss_fend;
+ if(Serial.availableForWrite()<n) return 0;
+ Serial.write(out, n);
+ return 1;
+}
+
+
+// tells the host how many frames it may send, see the serial modem mode
+void myKissStatus()
+{
+ byte b[7];
+ int slots=tx_qsize-(tx_q_head[tx_prio_own]-tx_q_tail[tx_prio_own]);
+ b[0]=my_addr >> 8;
+ b[1]=my_addr & 255;
+ b[2]=slots;
+ b[3]=(ser_got >> 8) & 255;
+ b[4]=ser_got & 255;
+ b[5]=(ser_refused >> 8) & 255;
+ b[6]=ser_refused & 255;
+ if(myKissSend(kiss_cmd_status, b, 7, 0, 0)==1) ser_free=slots;
+ else ser_free=-1; // again on the next pass
+}
+
+
+// handles frame b[0..len-1] from the host, unescaped, CRC included
+void myKissFrame(const byte *b, int len)
+{
+ XplFrame f;
+ String txt;
+ if((len<3) || (myCrc16(0xFFFF, b, len-2)!=((b[len-2] << 8) | b[len-1]))) {ser_bad++; return;}
+ len-=2;
+ ser_kiss=1; // a host talks to us
+ if(b[0]==kiss_cmd_status) {myKissStatus(); return;}
+ if((b[0]!=kiss_cmd_frame) && (b[0]!=kiss_cmd_text)) return; // a command we don't know
+ ser_got++;
+ if((len<2) || ((b[0]==kiss_cmd_text) && (len<3))) {ser_bad++; return;} // nothing to send
+ if(tx_q_head[tx_prio_own]-tx_q_tail[tx_prio_own]>=tx_qsize) {ser_refused++; myKissStatus(); return;}
+ if(b[0]==kiss_cmd_frame)
+ {
+  if(myFrameParse(b+1, len-1, &f)==1) myDupCheck(f.origin, f.seq); // so we don't re-broadcast it
+  myTxAdd(tx_prio_own, b+1, len-1);
+  return;
+ }
+ txt.concat((const char *)b+2, len-2);
+ myLoraQueue(tx_prio_own, (b[1]==pck_type_yell) ? pck_type_yell : pck_type_speak, txt);
+}
+
+
+// reads what the host sent, and tells it when the transmit queue has room for more. Called by
+// myLoraPoll().
+void myKissRun()
+{
+ int c;
+ while(Serial.available()>0)
+ {
+  c=Serial.read();
+  if(c<0) break;
+  if(c==kiss_fend) // end of a frame, or the start of the next one
+  {
+   if(ser_inlen>0) myKissFrame(ser_in, ser_inlen);
+   if(ser_inlen<0) ser_bad++;
+   ser_inlen=0;
+   ser_inesc=0;
+   continue;
+  }
+  if(ser_inlen<0) continue;
+  if(ser_inesc==1)
+  {
+   ser_inesc=0;
+   if(c==kiss_tfend) c=kiss_fend;
+   if(c==kiss_tfesc) c=kiss_fesc;
+  }
+  else if(c==kiss_fesc) {ser_inesc=1; continue;}
+  if(ser_inlen>=(int)sizeof(ser_in)) {ser_inlen=-1; continue;}
+  ser_in[ser_inlen]=c;
+  ser_inlen++;
+ }
+ if((ser_kiss==1) && (tx_qsize-(tx_q_head[tx_prio_own]-tx_q_tail[tx_prio_own])!=ser_free)) myKissStatus();
+}
+
+
+// one line of relay counters on Serial, all of them since booting
+void myRepeaterReport()
+{
+ if(ser_kiss==1) return; // the host reads frames there
+ Serial.println("relay "+String(millis()/1000)+" s: rx "+String(rx_ring_head)+", ring overflows "+String(rx_ring_overflows)+
+                ", re-broadcast "+String(pck_job_sent)+", suppressed "+String(pck_job_suppressed)+", refused "+String(pck_job_overflows)+
+                ", passed on "+String(rt_forwarded)+", dropped "+String(rt_dropped)+", tx "+String(tx_frames)+
+                ", tx refused "+String(tx_overflows)+", on air "+String(tx_airtime/1000)+" s, busy CADs "+String(lbt_busy)+
+                ", radio task late max "+String(task_late_max[task_radio])+" ms");
+}
+
+
+// moves the duty cycle window up to now, airtime older than an hour drops out
+void myDutyAdvance()
+{
+ unsigned long now=millis()/dc_slotT;
+ int b;
+ int s;
+ if(now-dc_slot_now>=(unsigned long)dc_slots) // nothing sent for an hour (or millis() wrapped), start over
+ {
+  memset(dc_used,0,sizeof(dc_used));
+  memset(dc_sum,0,sizeof(dc_sum));
+  dc_slot_now=now;
+ }
+ while(dc_slot_now!=now)
+ {
+  dc_slot_now++;
+  s=dc_slot_now % dc_slots;
+  for(b=0;b<dc_bands;b++)
+  {
+   dc_sum[b]-=dc_used[b][s];
+   dc_used[b][s]=0;
   }
-  delay(1);
- } // wend
+ }
 }
+
+
 //-------------------------------------------------------------------------------------------------  
 
 
@@ -1244,7 +4715,6 @@ void myScreensaver()
     if((stary[i]<-48)||(stary[i]>48)){ starx[i]=random(1,64)*((   floor(random(0,195)/100) *2)-1);stary[i]=random(1,32)*((   floor(random(0,195)/100) *2)-1);ox=starx[i];oy=stary[i];}
     display.drawLine(64+starx[i],32+stary[i],64+ox,32+oy);
    }
-   mydelay(30);
 }
 
 
@@ -1292,6 +4762,14 @@ void myUpdateMouse()
   // smoothing mouse movement
   realmousex-=((realmousex-mousex)/5); // this divisor affects the speed at which the smoothed mouse catches up with the real mouse coords
   realmousey-=((realmousey-mousey)/5); // (so the name may be confusing, but anyway :-) ) 
+  // anything for the screen? (a release of the click pad counts too, the menu waits for it)
+  if((realmousex!=ui_mousex) || (realmousey!=ui_mousey) || (approx3<touch_baselevel3-35) || (approx4<touch_baselevel4-150) || (ui_touched==1))
+  {
+   ui_dirty|=ui_inv_input;
+  }
+  ui_mousex=realmousex;
+  ui_mousey=realmousey;
+  ui_touched=(approx4<touch_baselevel4-150) ? 1 : 0;
 }
 
 
@@ -1350,119 +4828,103 @@ void drawPattern(float x,float y,float w,float h,float p, float p2)
 void myGames()
 {
  // a simple 4x4 choice menu screen
- int myexit=0;
  int i;
  int j;
  int game_hover=0;
  String tit="";
- while(myexit != 1)
+ display.clear();
+ for(j=0;j<4;j++)
  {
-  myUpdateMouse();
-  display.clear();
-  for(j=0;j<4;j++)
+  for(i=0;i<4;i++)
   {
-   for(i=0;i<4;i++)
+   tit=gametitles[i+(j*4)];
+   if(tit!="")
    {
-    tit=gametitles[i+(j*4)];
-    if(tit!="")
-    {
-     display.drawRect(i*32,j*16,32,16);
-     display.drawString(2+i*32,2+j*16,tit);
-    } // endif
-   } // next i
-  } // next j
-
-  myDrawMouse();
-  display.display();
-  mydelay(10);
-  game_hover=floor(realmousex/32)+( floor(realmousey/16)*4  );
-  if(approx4<touch_baselevel4-150)// yeah, it's cryptic... it means "if user clicked button"
-  {
-    if(game_hover==0){myGamePong();}
-    if(game_hover==1){myGameDoom();}
-    if(game_hover==15){myexit=1;}
-  }//endif
- }//wend
- mydelay(300);
+    display.drawRect(i*32,j*16,32,16);
+    display.drawString(2+i*32,2+j*16,tit);
+   } // endif
+  } // next i
+ } // next j
+
+ myDrawMouse();
+ myOledSend();
+ game_hover=floor(realmousex/32)+( floor(realmousey/16)*4  );
+ if(myClick()==1)// "if user clicked button"
+ {
+   myHold(300);
+   if(game_hover==0){myGamePongStart();}
+   if(game_hover==1){myApp(app_doom);}
+   if(game_hover==15){myApp(app_menu);}
+ }//endif
 }// eo function
 
 
+// new pong game, ball in the corner
+void myGamePongStart()
+{
+ pong_ballx=0;
+ pong_bally=0;
+ pong_ballxs=4;
+ pong_ballys=4;
+ pong_playerx=32;
+ pong_score=0;
+ myApp(app_pong);
+}
+
 
 void myGamePong()
 {
  // a simple pong-oid game, not finished in any way 
- float ballx=0;
- float bally=0;
- float ballxs=4;
- float ballys=4;
- int playerx=32;
- int score=0;
- int myexit=0;
- int i;
- int j;
- int game_hover=0;
- String tit="";
- mydelay(300);
- while(myexit != 1)
- {
-  myUpdateMouse();
-  display.clear();
+ display.clear();
 
-  display.fillCircle(ballx,bally,3);
-  display.drawLine(playerx-8,63,playerx+8,63);
-  display.drawString(0,0,"SCORE "+(String)score);
-  display.drawString(72,0,"HI "+(String)hiscore);
-  display.drawRect(0,0,128,65);
-  ballx+=(ballxs/10);
-  if( (ballx<0) || (ballx>127)) {ballxs=-ballxs; ballys=(ballys*  (1.0+random(100)/200.0)  );}
+ display.fillCircle(pong_ballx,pong_bally,3);
+ display.drawLine(pong_playerx-8,63,pong_playerx+8,63);
+ display.drawString(0,0,"SCORE "+(String)pong_score);
+ display.drawString(72,0,"HI "+(String)hiscore);
+ display.drawRect(0,0,128,65);
+ pong_ballx+=(pong_ballxs/10);
+ if( (pong_ballx<0) || (pong_ballx>127)) {pong_ballxs=-pong_ballxs; pong_ballys=(pong_ballys*  (1.0+random(100)/200.0)  );}
 
-  bally+=(ballys/10);
-  if( bally<0 ) {ballys=-ballys; ballxs=(ballxs*1.0+(random(100)/200.0));}
+ pong_bally+=(pong_ballys/10);
+ if( pong_bally<0 ) {pong_ballys=-pong_ballys; pong_ballxs=(pong_ballxs*1.0+(random(100)/200.0));}
 
-  if( bally>62 )
-  {
-    if( (ballx>=(playerx-9)) && (ballx<=(playerx+13))) // catched it
-    {
-      ballys=-ballys;
-      ballxs=(ballxs*1.0+(random(100)/200.0));
-      ballxs*=1.02;
-      ballys*=1.02;
-    }
-    else // missed it
-    {
-      ballx=0;
-      bally=0;
-      ballxs=4+(float(random(100))/30.0);
-      ballys=4+(float(random(100))/30.0);
-      if(score>hiscore)hiscore=score;
-      score=0;
-    }
-  }
+ if( pong_bally>62 )
+ {
+   if( (pong_ballx>=(pong_playerx-9)) && (pong_ballx<=(pong_playerx+13))) // catched it
+   {
+     pong_ballys=-pong_ballys;
+     pong_ballxs=(pong_ballxs*1.0+(random(100)/200.0));
+     pong_ballxs*=1.02;
+     pong_ballys*=1.02;
+   }
+   else // missed it
+   {
+     pong_ballx=0;
+     pong_bally=0;
+     pong_ballxs=4+(float(random(100))/30.0);
+     pong_ballys=4+(float(random(100))/30.0);
+     if(pong_score>hiscore)hiscore=pong_score;
+     pong_score=0;
+   }
+ }
 
 //  myDrawMouse();
-  display.display();
-  mydelay(10);
-  // game_hover=floor(realmousex/32)+( floor(realmousey/16)*4  );
-  if(approx4<touch_baselevel4-150){myexit=1;}
-  if(approx2<touch_baselevel2-150) // steer left
-  {
-   playerx-=2;
-   if(playerx<0){playerx=0;}
-  }
-  if(approx1<touch_baselevel1-150) // steer right
-  {
-   playerx+=2;
-   if(playerx>127){playerx=127;}
-  }
-
-//  ballxs*=1.01;
-//  ballys*=1.01;
-  score++;
- }//wend
-
-
+ myOledSend();
+ if(myClick()==1){myHold(300); myApp(app_games); return;}
+ if(approx2<touch_baselevel2-150) // steer left
+ {
+  pong_playerx-=2;
+  if(pong_playerx<0){pong_playerx=0;}
+ }
+ if(approx1<touch_baselevel1-150) // steer right
+ {
+  pong_playerx+=2;
+  if(pong_playerx>127){pong_playerx=127;}
+ }
 
- mydelay(300);
+//  pong_ballxs*=1.01;
+//  pong_ballys*=1.01;
+ pong_score++;
 }// eo pong
 
 
@@ -1476,60 +4938,38 @@ void myGamePong()
 // -------------------------------------------------------------------------------------- 3D Maze Game
 void myGameDoom()
 {
- int game_T=millis()+30;
  float wspeed=50; //walk speed, the higher, the slower, 5 to 100
- int myexit=0;
- int i;
- int j;
- int game_hover=0;
- String tit="";
- float mxs=0;
- int old_realmousex=realmousex;
- mydelay(300);
- while(myexit != 1)
- {
-  myUpdateMouse();
-  
-  display.clear();
+ 
+ display.clear();
 
-  if(approx3<touch_baselevel3-150)// walk forward
-  {
-   pxold=px;
-   pzold=pz;
-   px=px+(mysin(angle)/wspeed);
-   pz=pz+(mycos(angle)/wspeed);
-   sliding();    
-  }
-  angle=(angle-mxs);// ; //use mouse to steer
-  if(angle<  0)angle+=360;
-  if(angle>360)angle-=360;
-  raycast(); 
+ if(approx3<touch_baselevel3-150)// walk forward
+ {
+  pxold=px;
+  pzold=pz;
+  px=px+(mysin(angle)/wspeed);
+  pz=pz+(mycos(angle)/wspeed);
+  sliding();    
+ }
+ angle=(angle-doom_mxs);// ; //use mouse to steer
+ if(angle<  0)angle+=360;
+ if(angle>360)angle-=360;
+ raycast(); 
 
-  if(approx1<touch_baselevel1-150){ // turn left
-   if(mxs<5)mxs+=.25;
-  }
-  if(approx2<touch_baselevel2-150){ // turn left
-   if(mxs>-5)mxs-=.25;
-  }
+ if(approx1<touch_baselevel1-150){ // turn left
+  if(doom_mxs<5)doom_mxs+=.25;
+ }
+ if(approx2<touch_baselevel2-150){ // turn left
+  if(doom_mxs>-5)doom_mxs-=.25;
+ }
 
-  mxs*=0.9;
-  
-  old_realmousex=realmousex;
-  display.display();
-  mydelay(1);
-  while(millis()<game_T){
-   mydelay(1);
-  }
-  game_T=millis()+15;
-  game_hover=floor(realmousex/32)+( floor(realmousey/16)*4  );
-  if(approx4<touch_baselevel4-150)
-  {
-    if(game_hover==15){myexit=1;}
-    myexit=1;
-  }//endif
- }//wend
- mydelay(300);
-  
+ doom_mxs*=0.9;
+ 
+ myOledSend();
+ if(myClick()==1)
+ {
+   myHold(300);
+   myApp(app_games);
+ }//endif
 }
 // eo doom main ---------------------
 
@@ -0,0 +1,27 @@
+// Dictionary for the chat text compression in xplora1src.cpp (see myZipEncode()).
+// 254 strings, a compressed byte below 254 stands for the string at that index. Single letters
+// and punctuation make sure ordinary text never needs a verbatim byte, the rest are syllables and
+// words frequent in short English chat messages. Digits and '#' are left out on purpose, they're
+// cheaper as verbatim runs than as single codes taking dictionary slots.
+// Changing this table changes the meaning of compressed frames on air, all stations must agree.
+
+const char *const zip_dict[254] = {
+  " ", "e", "t", "a", "o", "i", "n", "s", "r", "h", "l", "d", "c", "u", "m", "f", "p", "g", "w",
+  "y", "b", "v", "k", "x", "j", "q", "z", "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K",
+  "L", "M", "N", "O", "P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", ".", ",", "!", "?",
+  "'", ":", "-", "(", ")", "/", "=", "+", "@", "*", "&", ";", "\"", " the ", "the", " you",
+  " is ", ", ", "ing ", " t", "good", "anyone", "on ", "test", "re", "thank", " s", " n", " at ",
+  "from", "will", "XPLORA", " m", "est", " a", "r ", "s ", " h", "ne", "where", "battery", "...",
+  "message", "ter ", " b", "ro", " w", "and", "ha", " f", "ge", "ar", "ng", "ing", "for", "I ",
+  "see", "signal", "one", "ow", "you ", "what", "need", " on ", "are ", "here", "that", "very",
+  "way ", "or", "y ", "we ", " c", " l", "ea", "ri", "ere", "all", "there", "hello", "yes",
+  "no ", "CQ ", "can", "great", "sorry", "day", "ate", "d ", "et", "ee", "ve", "at", "it", " o",
+  " p", "lo", "an", "es", "t ", "wa", "is", "st", " d", "as", "not", "ight", " a ", "your",
+  "this", "now", "copy", "home", "morning", "how", "it's", "open", "station", "rain", "be ",
+  "all ", "did ", "ine", "ind", "ack", "ill", "te", "time", "in", "li", "ut", "ay", "please",
+  "should", "there ", "e ", " i", "to", "ad", "ot", "he", "ce", " and ", "en", "nd", "le", "hi",
+  "ma", "ra", "la", "ur", "il", "ent", "his", "are", "Hello", "going", "today", "who", "up ",
+  "er ", "again", "me ", "my ", "or ", "in ", "to ", "up", "ll ", "as ", "thing", "other",
+  "right", "ation", "ake", "ight ", "ou", "me", " g", "se", "ll", "ti", "si", "we", "ch", "us",
+  "el", " of ", " in ", " be ", "have", "just", "meet", "back", "LoRa", "I'm ", "come"
+};